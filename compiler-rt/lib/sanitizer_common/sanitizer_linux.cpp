@@ -810,6 +810,22 @@ uptr internal_lseek(fd_t fd, OFF_T offset, int whence) {
 uptr internal_prctl(int option, uptr arg2, uptr arg3, uptr arg4, uptr arg5) {
   return internal_syscall(SYSCALL(prctl), option, arg2, arg3, arg4, arg5);
 }
+
+uptr internal_mbind(uptr addr, uptr length, int mode, const uptr *nodemask,
+                    uptr maxnode, unsigned flags) {
+  return internal_syscall(SYSCALL(mbind), addr, length, mode, (uptr)nodemask,
+                          maxnode, flags);
+}
+
+uptr internal_get_mempolicy(int *mode, uptr *nodemask, uptr maxnode, uptr addr,
+                            unsigned flags) {
+  return internal_syscall(SYSCALL(get_mempolicy), (uptr)mode, (uptr)nodemask,
+                          maxnode, addr, flags);
+}
+
+uptr internal_mincore(uptr addr, uptr length, u8 *vec) {
+  return internal_syscall(SYSCALL(mincore), addr, length, (uptr)vec);
+}
 #      if defined(__x86_64__)
 #        include <asm/unistd_64.h>
 // Currently internal_arch_prctl() is only needed on x86_64.
@@ -69,6 +69,11 @@ uptr internal_clock_gettime(__sanitizer_clockid_t clk_id, void *tp);
 // Linux-only syscalls.
 #if SANITIZER_LINUX
 uptr internal_prctl(int option, uptr arg2, uptr arg3, uptr arg4, uptr arg5);
+uptr internal_mbind(uptr addr, uptr length, int mode, const uptr *nodemask,
+                    uptr maxnode, unsigned flags);
+uptr internal_get_mempolicy(int *mode, uptr *nodemask, uptr maxnode, uptr addr,
+                            unsigned flags);
+uptr internal_mincore(uptr addr, uptr length, u8 *vec);
 #    if defined(__x86_64__)
 uptr internal_arch_prctl(int option, uptr arg2);
 #    endif
@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+# Runs the kernels of arbalest_offload.cpp built plain, with TSan only and
+# with TSan+Arbalest, and reports kernel time, peak RSS and both relative to
+# the plain build.
+#
+# Usage: arbalest_bench.sh [scale] [kernel...]
+# CXX selects the compiler (default: clang++), it has to support -farbalest.
+
+set -e
+
+CXX=${CXX:-clang++}
+SCALE=${1:-1}
+shift || true
+KERNELS=${@:-stencil spmv reduction update nest enter}
+SRC=$(dirname "$0")/arbalest_offload.cpp
+OUT=$(mktemp -d)
+trap "rm -rf $OUT" EXIT
+
+FLAGS="-O2 -g -fopenmp -fopenmp-targets=x86_64-pc-linux-gnu"
+$CXX $FLAGS "$SRC" -o $OUT/plain
+$CXX $FLAGS -fsanitize=thread "$SRC" -o $OUT/tsan
+$CXX $FLAGS -fsanitize=thread -farbalest "$SRC" -o $OUT/arbalest
+
+export TSAN_OPTIONS="ignore_noninstrumented_modules=1 $TSAN_OPTIONS"
+
+printf "%-10s %-9s %9s %9s %9s %9s\n" kernel build time\(s\) rss\(MB\) slowdown rss\(x\)
+for k in $KERNELS; do
+  for b in plain tsan arbalest; do
+    line=$($OUT/$b $k $SCALE)
+    t=$(echo "$line" | sed -n 's/.* time=\([^ ]*\).*/\1/p')
+    rss=$(echo "$line" | sed -n 's/.* maxrss_kb=\([^ ]*\).*/\1/p')
+    if [ $b = plain ]; then
+      base_t=$t
+      base_rss=$rss
+    fi
+    awk -v k=$k -v b=$b -v t=$t -v rss=$rss -v bt=$base_t -v brss=$base_rss \
+      'BEGIN { printf("%-10s %-9s %9.3f %9.1f %9.2f %9.2f\n", k, b, t,
+                      rss / 1024, bt > 0 ? t / bt : 0,
+                      brss > 0 ? rss / brss : 0) }'
+  done
+done
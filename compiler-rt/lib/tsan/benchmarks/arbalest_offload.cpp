@@ -0,0 +1,212 @@
+// Offloading kernels for measuring the overhead of Arbalest.
+// Build with -fopenmp -fopenmp-targets=x86_64-pc-linux-gnu, with and without
+// -fsanitize=thread -farbalest.
+// First argument is the kernel name (stencil, spmv, reduction, update, nest,
+// enter), second optional arg scales the problem size.
+// arbalest_bench.sh runs all of them in the plain, TSan-only and TSan+Arbalest
+// configurations.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+static int scale = 1;
+
+// 2D Jacobi sweeps over arrays that stay mapped across iterations.
+static double stencil() {
+  const int n = 512 * scale;
+  const int kIter = 20;
+  double *a = new double[n * n];
+  double *b = new double[n * n];
+  for (int i = 0; i < n * n; i++)
+    a[i] = i % 7;
+#pragma omp target data map(tofrom : a[0:n * n]) map(alloc : b[0:n * n])
+  for (int it = 0; it < kIter; it++) {
+#pragma omp target teams distribute parallel for collapse(2)
+    for (int i = 1; i < n - 1; i++)
+      for (int j = 1; j < n - 1; j++)
+        b[i * n + j] = 0.25 * (a[(i - 1) * n + j] + a[(i + 1) * n + j] +
+                               a[i * n + j - 1] + a[i * n + j + 1]);
+#pragma omp target teams distribute parallel for collapse(2)
+    for (int i = 1; i < n - 1; i++)
+      for (int j = 1; j < n - 1; j++)
+        a[i * n + j] = b[i * n + j];
+  }
+  double res = a[n + 1];
+  delete[] a;
+  delete[] b;
+  return res;
+}
+
+// Banded CSR matrix-vector product, indirect reads on the device.
+static double spmv() {
+  const int n = 200000 * scale;
+  const int kBand = 9;
+  const int kIter = 20;
+  int nnz = n * kBand;
+  int *rowptr = new int[n + 1];
+  int *col = new int[nnz];
+  double *val = new double[nnz];
+  double *x = new double[n];
+  double *y = new double[n];
+  for (int i = 0, k = 0; i < n; i++) {
+    rowptr[i] = k;
+    for (int d = -kBand / 2; d <= kBand / 2; d++, k++) {
+      col[k] = (i + d + n) % n;
+      val[k] = 1.0 / kBand;
+    }
+    x[i] = i % 13;
+  }
+  rowptr[n] = nnz;
+#pragma omp target data map(to : rowptr[0:n + 1], col[0:nnz], val[0:nnz])    \
+    map(tofrom : x[0:n]) map(alloc : y[0:n])
+  for (int it = 0; it < kIter; it++) {
+#pragma omp target teams distribute parallel for
+    for (int i = 0; i < n; i++) {
+      double sum = 0;
+      for (int k = rowptr[i]; k < rowptr[i + 1]; k++)
+        sum += val[k] * x[col[k]];
+      y[i] = sum;
+    }
+#pragma omp target teams distribute parallel for
+    for (int i = 0; i < n; i++)
+      x[i] = y[i];
+  }
+  double res = x[n / 2];
+  delete[] rowptr;
+  delete[] col;
+  delete[] val;
+  delete[] x;
+  delete[] y;
+  return res;
+}
+
+// Repeated reductions, every region maps the input again.
+static double reduction() {
+  const int n = (1 << 20) * scale;
+  const int kIter = 50;
+  double *a = new double[n];
+  for (int i = 0; i < n; i++)
+    a[i] = i % 3;
+  double res = 0;
+  for (int it = 0; it < kIter; it++) {
+    double sum = 0;
+#pragma omp target teams distribute parallel for reduction(+ : sum)         \
+    map(to : a[0:n]) map(tofrom : sum)
+    for (int i = 0; i < n; i++)
+      sum += a[i];
+    res += sum;
+  }
+  delete[] a;
+  return res;
+}
+
+// Many small target updates of a mapped array.
+static double update() {
+  const int n = 4096;
+  const int kIter = 50 * scale;
+  double *a = new double[n];
+  for (int i = 0; i < n; i++)
+    a[i] = i;
+#pragma omp target data map(tofrom : a[0:n])
+  for (int it = 0; it < kIter; it++) {
+    for (int i = 0; i < n; i += 16) {
+      a[i] += 1;
+#pragma omp target update to(a[i:1])
+    }
+#pragma omp target teams distribute parallel for
+    for (int i = 0; i < n; i += 16)
+      a[i] *= 2;
+    for (int i = 0; i < n; i += 16) {
+#pragma omp target update from(a[i:1])
+    }
+  }
+  double res = a[16];
+  delete[] a;
+  return res;
+}
+
+// Deeply nested target data regions mapping the same and fresh data.
+static double nestLevel(double *a, int n, int depth) {
+  double local[64];
+  for (int i = 0; i < 64; i++)
+    local[i] = depth;
+  double res = 0;
+#pragma omp target data map(tofrom : a[0:n]) map(to : local[0:64])
+  {
+    if (depth > 0) {
+      res = nestLevel(a, n, depth - 1);
+    } else {
+#pragma omp target teams distribute parallel for
+      for (int i = 0; i < n; i++)
+        a[i] += local[i % 64];
+    }
+  }
+  return res + a[0];
+}
+
+static double nest() {
+  const int n = 1 << 16;
+  const int kDepth = 64;
+  const int kIter = 20 * scale;
+  double *a = new double[n]();
+  double res = 0;
+  for (int it = 0; it < kIter; it++)
+    res += nestLevel(a, n, kDepth);
+  delete[] a;
+  return res;
+}
+
+// Huge unstructured mapping of which only a small part is touched.
+static double enter() {
+  const long n = (64L << 20) * scale;
+  const long kStride = 4096;
+  char *a = new char[n];
+  memset(a, 1, n);
+#pragma omp target enter data map(to : a[0:n])
+#pragma omp target teams distribute parallel for
+  for (long i = 0; i < n; i += kStride)
+    a[i] += 1;
+#pragma omp target exit data map(from : a[0:n])
+  double res = a[kStride];
+  delete[] a;
+  return res;
+}
+
+struct Kernel {
+  const char *name;
+  double (*fn)();
+};
+
+static const Kernel kKernels[] = {
+    {"stencil", stencil}, {"spmv", spmv}, {"reduction", reduction},
+    {"update", update},   {"nest", nest}, {"enter", enter},
+};
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <kernel> [scale]\n", argv[0]);
+    return 1;
+  }
+  if (argc > 2)
+    scale = atoi(argv[2]);
+  for (const Kernel &k : kKernels) {
+    if (strcmp(argv[1], k.name))
+      continue;
+    timeval start, end;
+    gettimeofday(&start, 0);
+    double res = k.fn();
+    gettimeofday(&end, 0);
+    double secs = end.tv_sec - start.tv_sec +
+                  (end.tv_usec - start.tv_usec) / 1000000.0;
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    printf("%s: scale=%d time=%.3f maxrss_kb=%ld result=%g\n", k.name, scale,
+           secs, ru.ru_maxrss, res);
+    return 0;
+  }
+  fprintf(stderr, "unknown kernel '%s'\n", argv[1]);
+  return 1;
+}
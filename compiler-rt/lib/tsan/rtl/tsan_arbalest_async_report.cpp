@@ -0,0 +1,96 @@
+//===-- tsan_arbalest_async_report.cpp ------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+//===----------------------------------------------------------------------===//
+#include "tsan_arbalest_async_report.h"
+
+#include "sanitizer_common/sanitizer_placement_new.h"
+#include "sanitizer_common/sanitizer_stackdepot.h"
+#include "tsan_flags.h"
+
+namespace __tsan {
+
+static StaticSpinMutex queue_mtx;
+static Vector<ArbalestPendingReport> *queue;  // guarded by queue_mtx
+static Semaphore queue_sem;
+static int report_thread_pid;  // the thread does not survive fork
+// Number of queued and of printed reports.
+static atomic_uint64_t queued;
+static atomic_uint64_t printed;
+
+static void *ReportThread(void *arg) {
+  // Same as the background thread, a non-user thread.
+  ThreadState *thr = cur_thread_init();
+  thr->ignore_interceptors++;
+  Vector<ArbalestPendingReport> batch;
+  for (;;) {
+    queue_sem.Wait();
+    {
+      SpinMutexLock l(&queue_mtx);
+      batch.Resize(queue->Size());
+      for (uptr i = 0; i < batch.Size(); i++) batch[i] = (*queue)[i];
+      queue->Resize(0);
+    }
+    // Symbolization runs without the thread registry lock, reporting
+    // threads don't wait for it.
+    for (uptr i = 0; i < batch.Size(); i++)
+      OutputDMIReport(thr, batch[i], StackDepotGet(batch[i].stack));
+    atomic_fetch_add(&printed, batch.Size(), memory_order_release);
+    batch.Resize(0);
+  }
+  return nullptr;
+}
+
+// Requires queue_mtx.
+static bool StartReportThread() {
+  int pid = internal_getpid();
+  if (report_thread_pid == pid)
+    return true;
+  if (!queue)
+    queue = New<Vector<ArbalestPendingReport>>();
+  // Reports queued before a fork are lost with the thread of the parent.
+  queue->Resize(0);
+  atomic_store_relaxed(&printed, atomic_load_relaxed(&queued));
+  if (!internal_start_thread(&ReportThread, nullptr))
+    return false;
+  report_thread_pid = pid;
+  return true;
+}
+
+bool ArbalestQueueReport(ArbalestPendingReport *r, StackTrace trace) {
+  if (!flags()->arbalest_async_reports)
+    return false;
+  r->stack = StackDepotPut(trace);
+  {
+    SpinMutexLock l(&queue_mtx);
+    if (!StartReportThread())
+      return false;
+    queue->PushBack(*r);
+    atomic_fetch_add(&queued, 1, memory_order_relaxed);
+  }
+  queue_sem.Post();
+  return true;
+}
+
+void ArbalestFlushReports() {
+  if (!flags()->arbalest_async_reports)
+    return;
+  {
+    SpinMutexLock l(&queue_mtx);
+    int pid = internal_getpid();
+    if (report_thread_pid != pid)
+      return;
+  }
+  while (atomic_load(&printed, memory_order_acquire) !=
+         atomic_load_relaxed(&queued))
+    internal_sched_yield();
+}
+
+}  // namespace __tsan
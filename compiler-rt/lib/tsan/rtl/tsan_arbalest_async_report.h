@@ -0,0 +1,87 @@
+//===-- tsan_arbalest_async_report.h ----------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+// Out of band output of data inconsistency reports. With
+// arbalest_async_reports the reporting thread only puts its stack into the
+// stack depot and queues the report; an internal thread symbolizes and prints
+// it. Everything that needs the thread registry or the mapping trees is
+// copied when the report is queued, only symbolization is left to the
+// internal thread.
+//===----------------------------------------------------------------------===//
+#ifndef TSAN_ARBALEST_ASYNC_REPORT_H
+#define TSAN_ARBALEST_ASYNC_REPORT_H
+
+#include "tsan_rtl.h"
+
+namespace __tsan {
+
+// The access thread, the owner of the location and a few of their parents
+// with print_full_thread_history, see nthreads_omitted.
+const uptr kArbalestReportMaxThreads = 8;
+
+// A thread of the report as found in the thread registry.
+struct ArbalestReportThread {
+  Tid id;
+  tid_t os_id;
+  bool running;
+  ThreadType thread_type;
+  Tid parent_tid;
+  StackID creation_stack;
+  char name[64];
+};
+
+// Location of the report as found by ScopedReportBase::AddLocation.
+// ReportLocationGlobal stands for a location that is symbolized.
+struct ArbalestReportLocation {
+  ReportLocationType type;
+  uptr heap_chunk_start;
+  uptr heap_chunk_size;
+  uptr external_tag;
+  Tid tid;
+  int fd;
+  StackID stack;
+};
+
+// Everything ReportDMI needs to build the report, except the stack.
+struct ArbalestPendingReport {
+  ReportType typ;
+  DMIType dmi_typ;
+  AccessType access;
+  Tid tid;
+  uptr tag;
+  uptr addr;
+  uptr size;
+  bool on_target;  // the report comes from a device access
+  int sample;  // check sampling rate, 0 if it does not apply
+  StackID stack;  // only set for queued reports
+  Node mapping;  // info.var_id is resolved
+  MutexSet mset;
+  ArbalestReportLocation loc;
+  uptr nthreads;
+  uptr nthreads_omitted;  // threads of the report that did not fit
+  ArbalestReportThread threads[kArbalestReportMaxThreads];
+};
+
+// Queues r with stack trace for the report thread. Returns false if
+// arbalest_async_reports is off or the thread can't be started; the caller
+// outputs the report itself then.
+bool ArbalestQueueReport(ArbalestPendingReport *r, StackTrace trace);
+
+// Waits until the queued reports are printed.
+void ArbalestFlushReports();
+
+// Builds and outputs the report r of the stack trace. Does not need the
+// thread registry lock.
+void OutputDMIReport(ThreadState *thr, const ArbalestPendingReport &r,
+                     StackTrace trace);
+
+}  // namespace __tsan
+
+#endif  // TSAN_ARBALEST_ASYNC_REPORT_H
@@ -0,0 +1,109 @@
+//===-- tsan_arbalest_clean.cpp -------------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+//===----------------------------------------------------------------------===//
+#include "tsan_arbalest_clean.h"
+
+#include "tsan_rtl.h"
+
+namespace __tsan {
+
+atomic_uint32_t arbalest_clean_mappings;
+
+static const u64 kHostLatest8 = 0x0404040404040404;
+
+static bool IsHostValid(RawVsm *p) {
+  const u8 mask = static_cast<u8>(VariableStateMachine::kHostMask);
+  return (static_cast<u8>(LoadVsm(p)) & mask) == mask;
+}
+
+// Whether every byte of [beg, end) is host initialized and host latest.
+static bool IsHostValid(uptr beg, uptr end) {
+  RawVsm *p = MemToVsm(beg);
+  RawVsm *e = MemToVsm(end);
+  for (; p < e && !IsAligned(reinterpret_cast<uptr>(p), sizeof(u64)); p++) {
+    if (!IsHostValid(p))
+      return false;
+  }
+  const u64 mask = VariableStateMachine::kHostMask8;
+  for (; p + sizeof(u64) <= e; p += sizeof(u64)) {
+    if ((atomic_load_relaxed(reinterpret_cast<atomic_uint64_t *>(p)) & mask) !=
+        mask)
+      return false;
+  }
+  for (; p < e; p++) {
+    if (!IsHostValid(p))
+      return false;
+  }
+  return true;
+}
+
+void ArbalestVerifyHostClean(Node *n) {
+  if (atomic_load_relaxed(&n->info.host_clean) & kArbalestHostClean)
+    return;
+  // Counted before the generation is loaded and the VSM is scanned. Pairs
+  // with the fence in ArbalestInvalidateHostClean: either the invalidation
+  // sees the count and bumps the generation, or the scan sees its VSM
+  // change.
+  atomic_fetch_add(&arbalest_clean_mappings, 1, memory_order_seq_cst);
+  u32 v = atomic_load(&n->info.host_clean, memory_order_acquire);
+  if (!(v & kArbalestHostClean) &&
+      IsHostValid(n->interval.left_end, n->interval.right_end) &&
+      atomic_compare_exchange_strong(&n->info.host_clean, &v,
+                                     v | kArbalestHostClean,
+                                     memory_order_acq_rel))
+    return;  // the count is kept for the clean mapping
+  atomic_fetch_sub(&arbalest_clean_mappings, 1, memory_order_relaxed);
+}
+
+// Clears the clean bit of n. The generation is bumped even if the bit is
+// clear, so that a verification in progress fails.
+static void Invalidate(Node *n) {
+  u32 v = atomic_load_relaxed(&n->info.host_clean);
+  while (!atomic_compare_exchange_weak(&n->info.host_clean, &v,
+                                       (v | kArbalestHostClean) + 1,
+                                       memory_order_acq_rel)) {
+  }
+  if (v & kArbalestHostClean)
+    atomic_fetch_sub(&arbalest_clean_mappings, 1, memory_order_relaxed);
+}
+
+void ArbalestInvalidateHostClean(const Interval &range) {
+  // Store-load ordering between the VSM change of range and the load of the
+  // count, mirrored by the seq_cst increment and VSM scan in
+  // ArbalestVerifyHostClean. Release/acquire would let both sides miss the
+  // other's write, leaving a mapping marked clean over a stale host range.
+  // Only the first device write that clears a host-latest cell pays for it.
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!ArbalestHasCleanMapping())
+    return;
+  // Mappings don't overlap, the one that contains range is the only one.
+  if (Node *n = ctx->h_to_t.find(range)) {
+    Invalidate(n);
+    return;
+  }
+  Vector<Interval> result;
+  ctx->h_to_t.searchRange(result, range);
+  for (uptr i = 0; i < result.Size(); i++) {
+    if (Node *n = ctx->h_to_t.find(result[i]))
+      Invalidate(n);
+  }
+}
+
+bool ArbalestIsHostLatest(uptr addr, uptr size) {
+  for (uptr a = RoundDown(addr, kVsmCell); a < addr + size; a += kVsmCell) {
+    if (atomic_load_relaxed(reinterpret_cast<atomic_uint64_t *>(MemToVsm(a))) &
+        kHostLatest8)
+      return true;
+  }
+  return false;
+}
+
+}  // namespace __tsan
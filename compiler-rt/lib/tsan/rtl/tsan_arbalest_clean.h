@@ -0,0 +1,97 @@
+//===-- tsan_arbalest_clean.h -----------------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+// Mappings whose host side is known to be clean. Once every byte of the host
+// range of a mapping is host initialized and host latest, host reads of the
+// mapping can't fail and skip the VSM check. Host writes keep the mapping
+// clean; device writes, copies from the device and the end of the mapping
+// invalidate it.
+//
+// A thread verifies the whole range of a mapping after as many successful
+// checks of it as the mapping has VSM cells, so the scans cost at most one
+// cell per check. The counts are kept per thread to not write to the nodes
+// on every check. MapInfo::host_clean holds the clean bit and a generation
+// in the other bits, so a verification that raced with an invalidation does
+// not set the bit. Invalidations are skipped while no mapping is clean, so
+// verifications in progress are counted as clean mappings: an invalidation
+// either sees the count or the verification sees the new VSM state.
+//===----------------------------------------------------------------------===//
+#ifndef TSAN_ARBALEST_CLEAN_H
+#define TSAN_ARBALEST_CLEAN_H
+
+#include "sanitizer_common/sanitizer_atomic.h"
+#include "tsan_avltree.h"
+#include "tsan_defs.h"
+
+namespace __tsan {
+
+const u32 kArbalestHostClean = 1;
+
+// Per thread counts of successful host checks, direct-mapped by node.
+struct ArbalestCleanCache {
+  static const uptr kSize = 8;
+  struct Entry {
+    Node *node;
+    uptr checks;
+  };
+  Entry entries[kSize];
+};
+
+// Number of mappings of ctx->h_to_t with the clean bit set, plus the number
+// of verifications in progress.
+extern atomic_uint32_t arbalest_clean_mappings;
+
+ALWAYS_INLINE bool ArbalestHasCleanMapping() {
+  return atomic_load_relaxed(&arbalest_clean_mappings) != 0;
+}
+
+ALWAYS_INLINE bool ArbalestIsHostClean(Node *n) {
+  return atomic_load_relaxed(&n->info.host_clean) & kArbalestHostClean;
+}
+
+// Sets the clean bit of n if its whole host range is valid.
+void ArbalestVerifyHostClean(Node *n);
+
+// Accounts a host check of n that found no error.
+ALWAYS_INLINE void ArbalestNoteHostCheck(ArbalestCleanCache *c, Node *n) {
+  auto &e = c->entries[(reinterpret_cast<uptr>(n) / sizeof(Node)) %
+                       ArbalestCleanCache::kSize];
+  if (e.node != n) {
+    e.node = n;
+    e.checks = 0;
+  }
+  if (LIKELY(++e.checks <=
+             (n->interval.right_end - n->interval.left_end) / kVsmCell))
+    return;
+  e.checks = 0;
+  ArbalestVerifyHostClean(n);
+}
+
+// Invalidates the mappings of ctx->h_to_t overlapping range. Called after
+// the VSM of range changed, so that a concurrent verification either fails
+// its scan or is undone. Bumps the generation of the overlapping mappings
+// whether they are clean or not, unless no mapping is clean or being
+// verified.
+void ArbalestInvalidateHostClean(const Interval &range);
+
+bool ArbalestIsHostLatest(uptr addr, uptr size);
+
+// Called before a device write to the host range [addr, addr + size), whether
+// the write may end the host latest state of a clean mapping. Only the first
+// device write to a cell after a copy to the host can. It does not look at
+// arbalest_clean_mappings: a verification may start before the write is
+// done, the count is checked by ArbalestInvalidateHostClean after it.
+ALWAYS_INLINE bool ArbalestDeviceWriteEndsClean(uptr addr, uptr size) {
+  return ArbalestIsHostLatest(addr, size);
+}
+
+}  // namespace __tsan
+
+#endif  // TSAN_ARBALEST_CLEAN_H
@@ -0,0 +1,331 @@
+//===-- tsan_arbalest_lazy_reset.cpp --------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+//===----------------------------------------------------------------------===//
+#include "tsan_arbalest_lazy_reset.h"
+
+#include "tsan_arbalest_stats.h"
+#include "tsan_flags.h"
+#include "tsan_rtl.h"
+
+namespace __tsan {
+
+atomic_uint32_t arbalest_lazy_resets;
+
+// Taken for reading to look up the lazy reset of a node and reference it,
+// for writing to attach a reset to a node or to take it away.
+static Mutex lazy_reset_mtx;
+// Bumped whenever a node gains or loses its lazy reset, invalidates the
+// ranges cached without a reset.
+static atomic_uint64_t lazy_reset_gen;
+
+static const uptr kBitsPerWord = 64;
+
+static uptr GranuleIdx(const ArbalestLazyReset *r, uptr addr) {
+  return (addr - RoundDownTo(r->begin, kArbalestLazyResetGranule)) /
+         kArbalestLazyResetGranule;
+}
+
+// Range of granule i within the mapping.
+static void GranuleRange(const ArbalestLazyReset *r, uptr i, uptr *beg,
+                         uptr *end) {
+  uptr g = RoundDownTo(r->begin, kArbalestLazyResetGranule) +
+           i * kArbalestLazyResetGranule;
+  *beg = Max(g, r->begin);
+  *end = Min(g + kArbalestLazyResetGranule, r->end);
+}
+
+static bool IsPending(ArbalestLazyReset *r, uptr i) {
+  u64 w = atomic_load(&r->pending[i / kBitsPerWord], memory_order_acquire);
+  return w & (1ull << (i % kBitsPerWord));
+}
+
+// Requires r->mtx. The release pairs with the acquire of IsPending, so a
+// thread that sees the bit cleared also sees the reset VSM.
+static void ClearPending(ArbalestLazyReset *r, uptr i) {
+  atomic_uint64_t *w = &r->pending[i / kBitsPerWord];
+  atomic_store(w, atomic_load_relaxed(w) & ~(1ull << (i % kBitsPerWord)),
+               memory_order_release);
+}
+
+static void Unref(ArbalestLazyReset *r) {
+  if (atomic_fetch_sub(&r->refs, 1, memory_order_acq_rel) == 1)
+    InternalFree(r);
+}
+
+// Requires r->mtx.
+static void ResetGranule(ArbalestLazyReset *r, uptr i) {
+  uptr beg, end;
+  GranuleRange(r, i, &beg, &end);
+  VsmRangeDeviceReset(beg, end - beg);
+  ArbalestStatIncCur(ArbalestStatLazyResetBytes, end - beg);
+  ClearPending(r, i);
+}
+
+static ArbalestLazyReset *CreateLazyReset(uptr addr, uptr size) {
+  uptr granules = (addr + size - RoundDownTo(addr, kArbalestLazyResetGranule) +
+                   kArbalestLazyResetGranule - 1) /
+                  kArbalestLazyResetGranule;
+  uptr words = (granules + kBitsPerWord - 1) / kBitsPerWord;
+  uptr bytes =
+      sizeof(ArbalestLazyReset) + (words - 1) * sizeof(atomic_uint64_t);
+  ArbalestLazyReset *r =
+      reinterpret_cast<ArbalestLazyReset *>(InternalAlloc(bytes));
+  internal_memset(r, 0, bytes);
+  atomic_store_relaxed(&r->refs, 1);
+  r->begin = addr;
+  r->end = addr + size;
+  for (uptr w = 0; w < words; w++) {
+    uptr bits = Min(granules - w * kBitsPerWord, kBitsPerWord);
+    atomic_store_relaxed(&r->pending[w],
+                         bits == kBitsPerWord ? ~0ull : (1ull << bits) - 1);
+  }
+  return r;
+}
+
+static void AttachLazyReset(Node *n, ArbalestLazyReset *r) {
+  {
+    Lock l(&lazy_reset_mtx);
+    n->info.lazy_reset = r;
+    atomic_fetch_add(&lazy_reset_gen, 1, memory_order_relaxed);
+  }
+  atomic_fetch_add(&arbalest_lazy_resets, 1, memory_order_relaxed);
+}
+
+static void DropLazyReset(Node *n) {
+  ArbalestLazyReset *r = n->info.lazy_reset;
+  if (!r)
+    return;
+  {
+    // Threads that still reference r stop resetting its granules.
+    SpinMutexLock l(&r->mtx);
+    atomic_store_relaxed(&r->dropped, 1);
+  }
+  {
+    Lock l(&lazy_reset_mtx);
+    n->info.lazy_reset = nullptr;
+    atomic_fetch_add(&lazy_reset_gen, 1, memory_order_relaxed);
+  }
+  atomic_fetch_sub(&arbalest_lazy_resets, 1, memory_order_relaxed);
+  Unref(r);
+}
+
+void ArbalestDeviceReset(uptr addr, uptr size) {
+  Node *n = ctx->h_to_t.find({addr, addr + size});
+  if (!n || !flags()->arbalest_lazy_device_reset ||
+      size < kArbalestLazyResetMinSize) {
+    VsmRangeDeviceReset(addr, size);
+    return;
+  }
+  DropLazyReset(n);
+  AttachLazyReset(n, CreateLazyReset(addr, size));
+}
+
+// Resets the pending granules of r outside of range.
+static void ResetOutside(ArbalestLazyReset *r, const Interval &range) {
+  if (r->begin >= range.left_end && r->end <= range.right_end)
+    return;
+  SpinMutexLock l(&r->mtx);
+  for (uptr i = 0, last = GranuleIdx(r, r->end - 1); i <= last; i++) {
+    if (!IsPending(r, i))
+      continue;
+    uptr beg, end;
+    GranuleRange(r, i, &beg, &end);
+    if (beg < range.left_end) {
+      uptr e = Min(end, range.left_end);
+      VsmRangeDeviceReset(beg, e - beg);
+      ArbalestStatIncCur(ArbalestStatLazyResetBytes, e - beg);
+    }
+    if (end > range.right_end) {
+      uptr b = Max(beg, range.right_end);
+      VsmRangeDeviceReset(b, end - b);
+      ArbalestStatIncCur(ArbalestStatLazyResetBytes, end - b);
+    }
+  }
+}
+
+void ArbalestDropDeviceResets(const Interval &range) {
+  if (!ArbalestHasLazyReset())
+    return;
+  Vector<Interval> result;
+  ctx->h_to_t.searchRange(result, range);
+  for (uptr i = 0; i < result.Size(); i++) {
+    Node *n = ctx->h_to_t.find(result[i]);
+    if (!n || !n->info.lazy_reset)
+      continue;
+    ResetOutside(n->info.lazy_reset, range);
+    DropLazyReset(n);
+  }
+}
+
+void ArbalestLazyResetTouch(ArbalestLazyReset *r, uptr addr, uptr size) {
+  uptr beg = Max(addr, r->begin);
+  uptr end = Min(addr + size, r->end);
+  if (beg >= end)
+    return;
+  for (uptr i = GranuleIdx(r, beg), last = GranuleIdx(r, end - 1); i <= last;
+       i++) {
+    if (LIKELY(!IsPending(r, i)))
+      continue;
+    SpinMutexLock l(&r->mtx);
+    if (atomic_load_relaxed(&r->dropped))
+      return;
+    // Another thread may have reset it meanwhile.
+    if (IsPending(r, i))
+      ResetGranule(r, i);
+  }
+}
+
+void ArbalestMaterializeDeviceReset(ArbalestLazyResetCache *c,
+                                    ArbalestStats &s, uptr addr, uptr size) {
+  ArbalestLazyReset *r = c->r;
+  if (r ? !atomic_load_relaxed(&r->dropped) && addr >= r->begin &&
+              addr + size <= r->end
+        : c->gen == atomic_load_relaxed(&lazy_reset_gen) &&
+              addr >= c->begin && addr + size <= c->end) {
+    if (r)
+      ArbalestLazyResetTouch(r, addr, size);
+    return;
+  }
+  ArbalestLazyResetCacheRelease(c);
+  {
+    ReadLock l(&lazy_reset_mtx);
+    c->gen = atomic_load_relaxed(&lazy_reset_gen);
+    Node *n = ArbalestTreeFind(s, ctx->h_to_t, {addr, addr + size});
+    r = n ? n->info.lazy_reset : nullptr;
+    if (r)
+      atomic_fetch_add(&r->refs, 1, memory_order_relaxed);
+    c->r = r;
+    c->begin = n ? n->interval.left_end : addr;
+    c->end = n ? n->interval.right_end : addr + size;
+  }
+  if (r)
+    ArbalestLazyResetTouch(r, addr, size);
+}
+
+void ArbalestLazyResetCacheRelease(ArbalestLazyResetCache *c) {
+  if (c->r)
+    Unref(c->r);
+  c->r = nullptr;
+  c->begin = c->end = 0;
+}
+
+// Lazy state of the mapping containing [addr, addr + size), if any. The
+// caller releases the returned reset with Unref.
+static ArbalestLazyReset *FindLazyReset(uptr addr, uptr size) {
+  if (!ArbalestHasLazyReset())
+    return nullptr;
+  ReadLock l(&lazy_reset_mtx);
+  Node *n = ctx->h_to_t.find({addr, addr + size});
+  ArbalestLazyReset *r = n ? n->info.lazy_reset : nullptr;
+  if (r)
+    atomic_fetch_add(&r->refs, 1, memory_order_relaxed);
+  return r;
+}
+
+// Whether [addr, addr + size) covers granule i of r.
+static bool CoversGranule(const ArbalestLazyReset *r, uptr i, uptr addr,
+                          uptr size) {
+  uptr beg, end;
+  GranuleRange(r, i, &beg, &end);
+  return addr <= beg && addr + size >= end;
+}
+
+// Requires r->mtx. The copy into [addr, addr + size) overwrote the device
+// bits of the granules that are still pending.
+static void ClearCopiedGranules(ArbalestLazyReset *r, uptr addr, uptr size) {
+  for (uptr i = GranuleIdx(r, addr), last = GranuleIdx(r, addr + size - 1);
+       i <= last; i++) {
+    if (IsPending(r, i))
+      ClearPending(r, i);
+  }
+}
+
+// Requires r->mtx, r not dropped.
+static void MapToLazy(ArbalestLazyReset *r, uptr addr, uptr size) {
+  // Only the first and the last granule can be partially covered, their
+  // remaining bytes still need the reset.
+  uptr first = GranuleIdx(r, addr), last = GranuleIdx(r, addr + size - 1);
+  if (IsPending(r, first) && !CoversGranule(r, first, addr, size))
+    ResetGranule(r, first);
+  if (IsPending(r, last) && !CoversGranule(r, last, addr, size))
+    ResetGranule(r, last);
+  VsmRangeUpdateMapTo(addr, size);
+  ClearCopiedGranules(r, addr, size);
+}
+
+void ArbalestMapTo(uptr addr, uptr size) {
+  ArbalestLazyReset *r = size ? FindLazyReset(addr, size) : nullptr;
+  if (!r) {
+    VsmRangeUpdateMapTo(addr, size);
+    return;
+  }
+  {
+    SpinMutexLock l(&r->mtx);
+    if (atomic_load_relaxed(&r->dropped))
+      VsmRangeUpdateMapTo(addr, size);
+    else
+      MapToLazy(r, addr, size);
+  }
+  Unref(r);
+}
+
+// The device bits of a pending granule are zero once reset, so copying them
+// back zeroes the whole VSM of the granule.
+static void MapFromRun(uptr beg, uptr end, bool pending) {
+  if (pending)
+    VsmRangeSet(beg, end - beg, static_cast<RawVsm>(0));
+  else
+    VsmRangeUpdateMapFrom(beg, end - beg);
+}
+
+// Requires r->mtx, r not dropped.
+static void MapFromLazy(ArbalestLazyReset *r, uptr addr, uptr size) {
+  // Consecutive granules of the same kind are transitioned together.
+  uptr run_beg = addr;
+  bool run_pending = false;
+  uptr first = GranuleIdx(r, addr), last = GranuleIdx(r, addr + size - 1);
+  for (uptr i = first; i <= last; i++) {
+    bool pending = IsPending(r, i);
+    if (pending && !CoversGranule(r, i, addr, size)) {
+      ResetGranule(r, i);
+      pending = false;
+    }
+    uptr beg = RoundDownTo(r->begin, kArbalestLazyResetGranule) +
+               i * kArbalestLazyResetGranule;
+    if (i == first) {
+      run_pending = pending;
+    } else if (pending != run_pending) {
+      MapFromRun(run_beg, beg, run_pending);
+      run_beg = beg;
+      run_pending = pending;
+    }
+  }
+  MapFromRun(run_beg, addr + size, run_pending);
+  ClearCopiedGranules(r, addr, size);
+}
+
+void ArbalestMapFrom(uptr addr, uptr size) {
+  ArbalestLazyReset *r = size ? FindLazyReset(addr, size) : nullptr;
+  if (!r) {
+    VsmRangeUpdateMapFrom(addr, size);
+    return;
+  }
+  {
+    SpinMutexLock l(&r->mtx);
+    if (atomic_load_relaxed(&r->dropped))
+      VsmRangeUpdateMapFrom(addr, size);
+    else
+      MapFromLazy(r, addr, size);
+  }
+  Unref(r);
+}
+
+}  // namespace __tsan
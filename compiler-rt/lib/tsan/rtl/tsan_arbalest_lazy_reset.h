@@ -0,0 +1,94 @@
+//===-- tsan_arbalest_lazy_reset.h ------------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+// Deferred device reset of alloc-only mappings. Associating a mapping without
+// a copy clears the device bits of its VSM; for large mappings the reset is
+// recorded in the h_to_t node instead, one pending bit per granule, and a
+// granule is reset only when the device first touches it. Mappings that are
+// released before the kernel touches them never write to the VSM.
+//===----------------------------------------------------------------------===//
+#ifndef TSAN_ARBALEST_LAZY_RESET_H
+#define TSAN_ARBALEST_LAZY_RESET_H
+
+#include "sanitizer_common/sanitizer_atomic.h"
+#include "sanitizer_common/sanitizer_mutex.h"
+#include "tsan_arbalest_stats.h"
+#include "tsan_avltree.h"
+#include "tsan_defs.h"
+
+namespace __tsan {
+
+const uptr kArbalestLazyResetGranule = 4096;
+// Smaller mappings are reset when they are associated.
+const uptr kArbalestLazyResetMinSize = 64 << 10;
+
+struct ArbalestLazyReset {
+  uptr begin;  // host range of the mapping
+  uptr end;
+  StaticSpinMutex mtx;  // serializes the resets of granules
+  // Held by the h_to_t node and by the ArbalestLazyResetCache of threads,
+  // the last reference frees the object.
+  atomic_uint32_t refs;
+  // Set under mtx once the node lets go of the reset. The granules of a
+  // dropped reset are never reset, the range may belong to a new mapping.
+  atomic_uint8_t dropped;
+  // One bit per granule of [RoundDown(begin, granule), end), set while the
+  // reset of the granule is pending. More words follow the struct.
+  atomic_uint64_t pending[1];
+};
+
+// Per-thread reference to the lazy reset of the mapping last touched by the
+// device accesses of the thread, so that the accesses to the same mapping
+// don't search ctx->h_to_t. A range without a lazy reset is cached too, with
+// r null.
+struct ArbalestLazyResetCache {
+  u64 gen;  // arbalest_lazy_reset_gen when [begin, end) was looked up
+  uptr begin;
+  uptr end;
+  ArbalestLazyReset *r;
+};
+
+// Number of ArbalestLazyReset objects held by nodes of ctx->h_to_t.
+extern atomic_uint32_t arbalest_lazy_resets;
+
+ALWAYS_INLINE bool ArbalestHasLazyReset() {
+  return atomic_load_relaxed(&arbalest_lazy_resets) != 0;
+}
+
+// Resets the device bits of the mapping [addr, addr + size) of ctx->h_to_t,
+// lazily if the mapping is large enough and arbalest_lazy_device_reset is set.
+void ArbalestDeviceReset(uptr addr, uptr size);
+
+// Forgets the pending resets of the mappings of ctx->h_to_t overlapping range
+// without touching the VSM of range, used when the mappings go away. The
+// pending granules of a mapping outside of range are reset first, the tree
+// keeps those parts as fragments of the mapping.
+void ArbalestDropDeviceResets(const Interval &range);
+
+// VsmRangeUpdateMapTo/VsmRangeUpdateMapFrom of the host range
+// [addr, addr + size), aware of the pending granules of its mapping.
+void ArbalestMapTo(uptr addr, uptr size);
+void ArbalestMapFrom(uptr addr, uptr size);
+
+// Resets the pending granules of r overlapping [addr, addr + size).
+void ArbalestLazyResetTouch(ArbalestLazyReset *r, uptr addr, uptr size);
+
+// Resets the pending granules of the mapping of ctx->h_to_t containing
+// [addr, addr + size) before the device accesses them. c keeps the reset
+// referenced, so a concurrent drop of the mapping can't free it under us.
+void ArbalestMaterializeDeviceReset(ArbalestLazyResetCache *c,
+                                    ArbalestStats &s, uptr addr, uptr size);
+
+// Releases the reference held by c, when the thread finishes.
+void ArbalestLazyResetCacheRelease(ArbalestLazyResetCache *c);
+
+}  // namespace __tsan
+
+#endif  // TSAN_ARBALEST_LAZY_RESET_H
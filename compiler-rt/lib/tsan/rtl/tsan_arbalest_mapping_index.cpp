@@ -0,0 +1,111 @@
+//===-- tsan_arbalest_mapping_index.cpp -----------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+//===----------------------------------------------------------------------===//
+#include "tsan_arbalest_mapping_index.h"
+
+#include "sanitizer_common/sanitizer_mutex.h"
+#include "tsan_interface.h"
+#include "tsan_rtl.h"
+
+namespace __tsan {
+
+atomic_uint32_t arbalest_num_mapping_indices;
+
+static atomic_uintptr_t mapping_indices[kArbalestMaxMappingIndices];
+static StaticSpinMutex mapping_indices_mtx;
+
+void ArbalestAttachMappingIndex(int device_num, ArbalestMappingIndex *index) {
+  SpinMutexLock l(&mapping_indices_mtx);
+  u32 cnt = atomic_load_relaxed(&arbalest_num_mapping_indices);
+  for (u32 i = 0; i < cnt; i++) {
+    if (atomic_load_relaxed(&mapping_indices[i]) ==
+        reinterpret_cast<uptr>(index))
+      return;
+  }
+  if (cnt == kArbalestMaxMappingIndices) {
+    Report("ThreadSanitizer: too many device mapping indices, accesses to the "
+           "mappings of device %d are not checked\n",
+           device_num);
+    return;
+  }
+  atomic_store_relaxed(&mapping_indices[cnt], reinterpret_cast<uptr>(index));
+  atomic_store(&arbalest_num_mapping_indices, cnt + 1, memory_order_release);
+  if (ctx->arbalest_verbose)
+    Printf("Arbalest: attached the mapping index of device %d\n", device_num);
+}
+
+void ArbalestDetachMappingIndicesForTesting() {
+  SpinMutexLock l(&mapping_indices_mtx);
+  u32 cnt = atomic_load_relaxed(&arbalest_num_mapping_indices);
+  atomic_store(&arbalest_num_mapping_indices, 0, memory_order_release);
+  for (u32 i = 0; i < cnt; i++) atomic_store_relaxed(&mapping_indices[i], 0);
+}
+
+// Copies the last entry of index starting at or before begin into *res.
+static bool FindEntry(ArbalestMappingIndex *index, uptr begin,
+                      ArbalestMappingEntry *res) {
+  for (;;) {
+    u64 version = atomic_load(&index->version, memory_order_acquire);
+    if (UNLIKELY(version & 1)) {
+      internal_sched_yield();
+      continue;
+    }
+    // size must be loaded before entries, see ompt_target_mapping_index_t.
+    uptr size = atomic_load(&index->size, memory_order_acquire);
+    const ArbalestMappingEntry *entries =
+        reinterpret_cast<const ArbalestMappingEntry *>(
+            atomic_load_relaxed(&index->entries));
+    uptr lo = 0, hi = size;
+    while (lo < hi) {
+      uptr mid = lo + (hi - lo) / 2;
+      if (entries[mid].target_begin <= begin)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (lo)
+      *res = entries[lo - 1];
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_relaxed(&index->version) == version)
+      return lo != 0;
+  }
+}
+
+static bool FindMapping(const Interval &i, ArbalestMappingEntry *res) {
+  u32 cnt = atomic_load(&arbalest_num_mapping_indices, memory_order_acquire);
+  for (u32 k = 0; k < cnt; k++) {
+    ArbalestMappingIndex *index = reinterpret_cast<ArbalestMappingIndex *>(
+        atomic_load_relaxed(&mapping_indices[k]));
+    if (FindEntry(index, i.left_end, res) && i.left_end >= res->target_begin &&
+        i.right_end <= res->target_end)
+      return true;
+  }
+  return false;
+}
+
+bool ArbalestMappingIndexFind(const Interval &i, Node *n) {
+  ArbalestMappingEntry e;
+  if (!FindMapping(i, &e))
+    return false;
+  *n = Node({e.target_begin, e.target_end},
+            {e.host_begin, e.target_end - e.target_begin,
+             kArbalestVarUnresolved});
+  return true;
+}
+
+bool ArbalestMappingIndexIsOverflow(uptr base, uptr addr) {
+  ArbalestMappingEntry e;
+  if (!FindMapping({base, base + 1}, &e))
+    return false;
+  return addr < e.target_begin || addr >= e.target_end;
+}
+
+}  // namespace __tsan
@@ -0,0 +1,64 @@
+//===-- tsan_arbalest_mapping_index.h ---------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+// Mapping indices of libomptarget (ompt_get_target_mapping_index), attached
+// by Archer through AnnotateTargetMappingIndex. Once an index is attached,
+// device addresses are translated with the indices and ctx->t_to_h is no
+// longer maintained.
+//===----------------------------------------------------------------------===//
+#ifndef TSAN_ARBALEST_MAPPING_INDEX_H
+#define TSAN_ARBALEST_MAPPING_INDEX_H
+
+#include "sanitizer_common/sanitizer_atomic.h"
+#include "tsan_avltree.h"
+#include "tsan_defs.h"
+
+namespace __tsan {
+
+// Layout of ompt_target_mapping_entry_t and ompt_target_mapping_index_t, keep
+// in sync with openmp/runtime/src/ompt-target-api.h.
+struct ArbalestMappingEntry {
+  u64 target_begin;
+  u64 target_end;  // excluded
+  u64 host_begin;
+  const char *name;
+};
+
+struct ArbalestMappingIndex {
+  atomic_uint64_t version;  // odd while libomptarget updates the index
+  atomic_uintptr_t entries;  // ArbalestMappingEntry *, sorted by target_begin
+  atomic_uint64_t size;
+};
+
+const uptr kArbalestMaxMappingIndices = 16;
+
+extern atomic_uint32_t arbalest_num_mapping_indices;
+
+ALWAYS_INLINE bool ArbalestHasMappingIndex() {
+  return atomic_load_relaxed(&arbalest_num_mapping_indices) != 0;
+}
+
+// Attaching an index twice is a no-op.
+void ArbalestAttachMappingIndex(int device_num, ArbalestMappingIndex *index);
+
+// Detaches all indices. ctx->t_to_h lacks the mappings made while an index
+// was attached, so this is only for tests that attach an index of their own.
+void ArbalestDetachMappingIndicesForTesting();
+
+// Looks up the mapping whose target range contains i in the attached indices
+// and fills in *n the way the node of ctx->t_to_h would look like.
+bool ArbalestMappingIndexFind(const Interval &i, Node *n);
+
+// Same as ctx->t_to_h.isOverflow(base, addr).
+bool ArbalestMappingIndexIsOverflow(uptr base, uptr addr);
+
+}  // namespace __tsan
+
+#endif  // TSAN_ARBALEST_MAPPING_INDEX_H
@@ -0,0 +1,93 @@
+//===-- tsan_arbalest_parallel.cpp ----------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+//===----------------------------------------------------------------------===//
+#include "tsan_arbalest_parallel.h"
+
+#include "sanitizer_common/sanitizer_atomic.h"
+#include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_mutex.h"
+#include "tsan_flags.h"
+#include "tsan_rtl.h"
+
+namespace __tsan {
+
+static const int kMaxWorkers = 64;
+
+// The job being run, written by the owner of job_mtx before the workers are
+// woken up.
+static VsmRangeFn job_fn;
+static uptr job_end;
+static atomic_uintptr_t job_next;  // start of the next chunk
+
+static StaticSpinMutex job_mtx;
+static Semaphore start_sem;
+static Semaphore done_sem;
+static int num_workers;
+static int workers_pid;  // workers do not survive fork
+
+static void RunChunks() {
+  for (;;) {
+    uptr beg = atomic_fetch_add(&job_next, kArbalestParallelChunk,
+                                memory_order_relaxed);
+    if (beg >= job_end)
+      return;
+    job_fn(beg, Min(job_end, beg + kArbalestParallelChunk) - beg);
+  }
+}
+
+static void *WorkerThread(void *arg) {
+  // Same as the background thread, a non-user thread.
+  cur_thread_init()->ignore_interceptors++;
+  for (;;) {
+    start_sem.Wait();
+    RunChunks();
+    done_sem.Post();
+  }
+  return nullptr;
+}
+
+// Requires job_mtx.
+static void StartWorkers() {
+  int pid = internal_getpid();
+  if (workers_pid != pid) {
+    workers_pid = pid;
+    num_workers = 0;
+  }
+  int want = Min(flags()->arbalest_parallel_vsm_workers, kMaxWorkers);
+  for (; num_workers < want; num_workers++) {
+    if (!internal_start_thread(&WorkerThread, nullptr))
+      break;
+  }
+}
+
+bool ArbalestParallelRange(uptr addr, uptr size, VsmRangeFn fn) {
+  uptr threshold = static_cast<uptr>(flags()->arbalest_parallel_vsm_mb) << 20;
+  if (!threshold || size < threshold || !job_mtx.TryLock())
+    return false;
+  StartWorkers();
+  if (!num_workers) {
+    job_mtx.Unlock();
+    return false;
+  }
+  uptr first_end =
+      Min(addr + size, RoundUpTo(addr + 1, kArbalestParallelChunk));
+  job_fn = fn;
+  job_end = addr + size;
+  atomic_store_relaxed(&job_next, first_end);
+  start_sem.Post(num_workers);
+  fn(addr, first_end - addr);
+  RunChunks();
+  for (int i = 0; i < num_workers; i++) done_sem.Wait();
+  job_mtx.Unlock();
+  return true;
+}
+
+}  // namespace __tsan
@@ -0,0 +1,36 @@
+//===-- tsan_arbalest_parallel.h --------------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+// Worker pool splitting the VSM transitions of very large mappings across
+// internal threads.
+//===----------------------------------------------------------------------===//
+#ifndef TSAN_ARBALEST_PARALLEL_H
+#define TSAN_ARBALEST_PARALLEL_H
+
+#include "tsan_defs.h"
+
+namespace __tsan {
+
+typedef void (*VsmRangeFn)(uptr addr, uptr size);
+
+// VSM ranges are handed to the workers in chunks of that many bytes. Chunks
+// are aligned with it (except for the first one), so the VSM page tricks keep
+// working on them.
+const uptr kArbalestParallelChunk = 16 << 20;
+
+// Runs fn over [addr, addr + size) on the worker pool and the calling thread,
+// and returns once all of the range is done. Returns false without running
+// anything if the range is below arbalest_parallel_vsm_mb or the pool is
+// busy or unavailable; the caller transitions the range itself then.
+bool ArbalestParallelRange(uptr addr, uptr size, VsmRangeFn fn);
+
+}  // namespace __tsan
+
+#endif  // TSAN_ARBALEST_PARALLEL_H
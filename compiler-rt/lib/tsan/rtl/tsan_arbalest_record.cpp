@@ -0,0 +1,200 @@
+//===-- tsan_arbalest_record.cpp ------------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+//===----------------------------------------------------------------------===//
+#include "tsan_arbalest_record.h"
+
+#include <fcntl.h>
+
+#include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_file.h"
+#include "sanitizer_common/sanitizer_libc.h"
+#include "tsan_flags.h"
+#include "tsan_rtl.h"
+
+namespace __tsan {
+
+atomic_uint8_t arbalest_recording;
+
+static fd_t log_fd = kInvalidFd;
+static ArbalestLogHeader *log_header;
+static ArbalestRecord *log_records;
+// Cleared by ArbalestRecordFinalize before the log is truncated. Every write
+// into the mapped log is bracketed by BeginLogWrite/EndLogWrite, so that
+// finalization can wait for the writers that are still in flight.
+static atomic_uint8_t log_open;
+static atomic_uint32_t log_writers;
+
+static bool BeginLogWrite() {
+  atomic_fetch_add(&log_writers, 1, memory_order_seq_cst);
+  if (LIKELY(atomic_load(&log_open, memory_order_seq_cst)))
+    return true;
+  atomic_fetch_sub(&log_writers, 1, memory_order_release);
+  return false;
+}
+
+static void EndLogWrite() {
+  atomic_fetch_sub(&log_writers, 1, memory_order_release);
+}
+
+void ArbalestRecordInit() {
+  const char *fname = flags()->arbalest_record;
+  if (!fname || !fname[0])
+    return;
+  InternalScopedString filename;
+  filename.append("%s.%d", fname, (int)internal_getpid());
+  // Truncate, a stale longer log of a recycled pid must not survive the
+  // final ftruncate.
+  uptr fd = internal_open(filename.data(), O_RDWR | O_CREAT | O_TRUNC, 0660);
+  if (internal_iserror(fd)) {
+    Printf("ThreadSanitizer: failed to open Arbalest record file '%s'\n",
+           filename.data());
+    return;
+  }
+  log_fd = static_cast<fd_t>(fd);
+  // The file is sparse, only the records that are written take up space.
+  uptr capacity = (uptr(flags()->arbalest_record_max_mb) << 20) /
+                  sizeof(ArbalestRecord);
+  uptr size = sizeof(ArbalestLogHeader) + capacity * sizeof(ArbalestRecord);
+  size = RoundUpTo(size, GetPageSizeCached());
+  if (internal_ftruncate(log_fd, size) ||
+      !(log_header = static_cast<ArbalestLogHeader *>(
+            MapWritableFileToMemory(nullptr, size, log_fd, 0)))) {
+    Printf("ThreadSanitizer: failed to map Arbalest record file '%s'\n",
+           filename.data());
+    CloseFile(log_fd);
+    log_fd = kInvalidFd;
+    return;
+  }
+  log_header->magic = kArbalestLogMagic;
+  log_header->version = kArbalestLogVersion;
+  log_header->record_size = sizeof(ArbalestRecord);
+  log_header->pid = internal_getpid();
+  log_header->capacity = capacity;
+  log_records = reinterpret_cast<ArbalestRecord *>(log_header + 1);
+  atomic_store(&log_open, 1, memory_order_release);
+  atomic_store(&arbalest_recording, 1, memory_order_release);
+  VPrintf(1, "ThreadSanitizer: recording Arbalest events to '%s'\n",
+          filename.data());
+}
+
+void ArbalestRecordFinalize() {
+  if (!atomic_exchange(&log_open, 0, memory_order_seq_cst))
+    return;
+  // Threads that are still running keep coming here through the record
+  // paths, they now find the log closed. Wait for the writes in flight, a
+  // write into the truncated part of the mapping would raise SIGBUS.
+  while (atomic_load(&log_writers, memory_order_acquire))
+    internal_sched_yield();
+  u64 n = Min(atomic_load(&log_header->nrecords, memory_order_acquire),
+              log_header->capacity);
+  if (n == log_header->capacity)
+    Printf("ThreadSanitizer: Arbalest record file is full, raise "
+           "arbalest_record_max_mb to record the whole execution\n");
+  // Drop the unused tail of the sparse file.
+  internal_ftruncate(log_fd, sizeof(ArbalestLogHeader) +
+                                 n * sizeof(ArbalestRecord));
+  CloseFile(log_fd);
+  log_fd = kInvalidFd;
+}
+
+// Must be called between BeginLogWrite and EndLogWrite.
+static ArbalestRecord *ReserveRecord() {
+  u64 idx = atomic_fetch_add(&log_header->nrecords, 1, memory_order_relaxed);
+  if (UNLIKELY(idx >= log_header->capacity))
+    return nullptr;
+  return &log_records[idx];
+}
+
+void ArbalestRecordBreakRun(ThreadState *thr) {
+  thr->arbalest_record.run = nullptr;
+  thr->arbalest_record.run_end = 0;
+}
+
+void ArbalestRecordMapping(ThreadState *thr, uptr pc, uptr host_addr,
+                           uptr target_addr, uptr size, u8 optype) {
+  ArbalestRecordBreakRun(thr);
+  if (!BeginLogWrite())
+    return;
+  if (ArbalestRecord *r = ReserveRecord()) {
+    r->flags = optype;
+    r->tid = static_cast<u32>(thr->tid);
+    r->addr = host_addr;
+    r->target_addr = target_addr;
+    r->size = size;
+    r->pc = pc;
+    r->kind = ArbalestEventMapping;
+  }
+  EndLogWrite();
+}
+
+void ArbalestRecordGlobal(uptr addr, uptr size) {
+  if (!BeginLogWrite())
+    return;
+  if (ArbalestRecord *r = ReserveRecord()) {
+    r->addr = addr;
+    r->size = size;
+    r->kind = ArbalestEventGlobal;
+  }
+  EndLogWrite();
+}
+
+void ArbalestRecordAccess(ThreadState *thr, uptr pc, uptr addr, uptr size,
+                          bool is_write) {
+  ArbalestRecordState &s = thr->arbalest_record;
+  u8 kind = is_write ? ArbalestEventWrite : ArbalestEventRead;
+  u8 access_flags = thr->is_on_target ? kArbalestAccessOnTarget : 0;
+  if (s.run_end == addr && s.run_kind == kind &&
+      s.run_flags == access_flags) {
+    if (!s.run) {
+      s.run_end = addr + size;
+      return;
+    }
+    if (!BeginLogWrite())
+      return;
+    // Extending the run moves the access back to the position of its record.
+    // That is only sound while no other thread has reserved a record since,
+    // otherwise the access would be replayed before events that precede it.
+    u64 tail = static_cast<u64>(s.run - log_records) + 1;
+    if (atomic_compare_exchange_strong(&log_header->nrecords, &tail, tail,
+                                       memory_order_acq_rel)) {
+      s.run->size += size;
+      s.run_end = addr + size;
+      EndLogWrite();
+      return;
+    }
+    EndLogWrite();
+  }
+  s.run_kind = kind;
+  s.run_flags = access_flags;
+  s.run_end = addr + size;
+  s.run = nullptr;
+  if (!is_write) {
+    // Reads only matter for detection, sample them. Writes always have to
+    // be recorded to keep the replayed VSM correct.
+    if (--s.read_countdown > 0)
+      return;
+    s.read_countdown = flags()->arbalest_record_read_sample;
+  }
+  if (!BeginLogWrite())
+    return;
+  if (ArbalestRecord *r = ReserveRecord()) {
+    r->flags = access_flags;
+    r->tid = static_cast<u32>(thr->tid);
+    r->addr = addr;
+    r->size = size;
+    r->pc = pc;
+    r->kind = kind;
+    s.run = r;
+  }
+  EndLogWrite();
+}
+
+}  // namespace __tsan
@@ -0,0 +1,96 @@
+//===-- tsan_arbalest_record.h ----------------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+// Record mode of Arbalest. Instead of maintaining the mapping trees and the
+// VSM live, mapping events and coalesced summaries of host/device accesses
+// are appended to a memory-mapped binary log, which is checked offline by
+// arbalest-replay (openmp/tools/arbalest-replay).
+//===----------------------------------------------------------------------===//
+#ifndef TSAN_ARBALEST_RECORD_H
+#define TSAN_ARBALEST_RECORD_H
+
+#include "sanitizer_common/sanitizer_atomic.h"
+#include "tsan_defs.h"
+
+namespace __tsan {
+
+struct ThreadState;
+
+// On-disk format, keep in sync with arbalest-replay.
+const u64 kArbalestLogMagic = 0x474f4c54534c4241ull;  // "ABLSTLOG"
+const u32 kArbalestLogVersion = 1;
+
+enum ArbalestEventKind : u8 {
+  ArbalestEventInvalid = 0,  // reserved slot that was never filled in
+  ArbalestEventMapping,      // addr: host, target_addr, size, flags: optype
+  ArbalestEventGlobal,       // addr, size of a global registered at startup
+  ArbalestEventRead,         // addr as seen by the accessing thread, size
+  ArbalestEventWrite,
+};
+
+// flags of ArbalestEventRead/ArbalestEventWrite.
+const u8 kArbalestAccessOnTarget = 1 << 0;
+
+struct ArbalestLogHeader {
+  u64 magic;
+  u32 version;
+  u32 record_size;
+  u64 pid;
+  // Number of reserved records. Records are reserved in program order, so
+  // the position of a record in the log is its position in the replay.
+  atomic_uint64_t nrecords;
+  u64 capacity;
+};
+
+struct ArbalestRecord {
+  u8 kind;
+  u8 flags;
+  u16 reserved;
+  u32 tid;
+  u64 addr;
+  u64 target_addr;
+  u64 size;
+  u64 pc;
+};
+
+// Per-thread state of the access run that is currently being coalesced.
+// Contiguous accesses of the same kind extend the record in place as long as
+// it is still the last reserved record of the log. Unsampled read runs have a
+// null record but still swallow their contiguous accesses.
+struct ArbalestRecordState {
+  ArbalestRecord *run;
+  uptr run_end;
+  u8 run_kind;
+  u8 run_flags;
+  int read_countdown;
+};
+
+// Set once at startup when record mode is enabled and never cleared, so that
+// accesses after ArbalestRecordFinalize do not fall back to live checking.
+extern atomic_uint8_t arbalest_recording;
+
+ALWAYS_INLINE bool ArbalestRecording() {
+  return atomic_load_relaxed(&arbalest_recording);
+}
+
+void ArbalestRecordInit();
+void ArbalestRecordFinalize();
+void ArbalestRecordMapping(ThreadState *thr, uptr pc, uptr host_addr,
+                           uptr target_addr, uptr size, u8 optype);
+void ArbalestRecordGlobal(uptr addr, uptr size);
+void ArbalestRecordAccess(ThreadState *thr, uptr pc, uptr addr, uptr size,
+                          bool is_write);
+// Ends the access run of the thread, e.g. when it enters or exits a target
+// region.
+void ArbalestRecordBreakRun(ThreadState *thr);
+
+}  // namespace __tsan
+
+#endif  // TSAN_ARBALEST_RECORD_H
@@ -0,0 +1,294 @@
+//===-- tsan_arbalest_report_sink.cpp -------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+//===----------------------------------------------------------------------===//
+#include "tsan_arbalest_report_sink.h"
+
+#include <fcntl.h>
+
+#include "sanitizer_common/sanitizer_common.h"
+#include "sanitizer_common/sanitizer_file.h"
+#include "sanitizer_common/sanitizer_libc.h"
+#include "sanitizer_common/sanitizer_placement_new.h"
+#include "sanitizer_common/sanitizer_symbolizer.h"
+#include "tsan_arbalest_async_report.h"
+#include "tsan_flags.h"
+
+namespace __tsan {
+
+enum SinkFormat { kSinkText, kSinkJsonl, kSinkBinary };
+
+static const uptr kSinkBufferSize = 64 << 10;
+static const u32 kNoModule = ~0u;
+
+static SinkFormat sink_format;
+static Mutex sink_mtx;
+// The state below is guarded by sink_mtx.
+static fd_t sink_fd = kInvalidFd;
+static int sink_pid;  // the file belongs to the process that opened it
+// Set by ArbalestReportSinkFinalize. Later reports of the process, e.g. from
+// atexit handlers, reopen the file for appending and are flushed right away.
+static bool sink_finalized;
+static char *sink_buf;
+static uptr sink_pos;
+// Binary format: module names written so far, their index is their id, and
+// whether the variable of an id was written.
+static Vector<const char *> *sink_modules;
+static Vector<bool> *sink_vars;
+
+static void FlushSink() {
+  if (sink_pos && !WriteToFile(sink_fd, sink_buf, sink_pos))
+    Printf("ThreadSanitizer: failed to write Arbalest reports\n");
+  sink_pos = 0;
+}
+
+static void Append(const void *data, uptr size) {
+  if (sink_pos + size > kSinkBufferSize)
+    FlushSink();
+  if (size > kSinkBufferSize) {
+    WriteToFile(sink_fd, data, size);
+    return;
+  }
+  internal_memcpy(sink_buf + sink_pos, data, size);
+  sink_pos += size;
+}
+
+static void SinkFileName(InternalScopedString *filename, int pid) {
+  filename->append("%s.%d.%s", flags()->arbalest_report_path, pid,
+                   sink_format == kSinkJsonl ? "jsonl" : "bin");
+}
+
+static bool OpenSink() {
+  int pid = internal_getpid();
+  if (sink_pid == pid && (sink_fd != kInvalidFd || !sink_finalized))
+    return sink_fd != kInvalidFd;
+  InternalScopedString filename;
+  SinkFileName(&filename, pid);
+  if (sink_pid == pid) {
+    // Reports after ArbalestReportSinkFinalize, the modules and variables
+    // written so far are still in the file.
+    uptr fd = internal_open(filename.data(), O_WRONLY | O_APPEND);
+    if (internal_iserror(fd))
+      return false;
+    sink_fd = static_cast<fd_t>(fd);
+    return true;
+  }
+  // A forked child starts its own file, the buffer and the descriptor are
+  // the parent's.
+  if (sink_fd != kInvalidFd)
+    CloseFile(sink_fd);
+  sink_pid = pid;
+  sink_finalized = false;
+  sink_pos = 0;
+  sink_modules->Resize(0);
+  sink_vars->Resize(0);
+  sink_fd = OpenFile(filename.data(), WrOnly);
+  if (sink_fd == kInvalidFd) {
+    Printf("ThreadSanitizer: failed to open Arbalest report file '%s'\n",
+           filename.data());
+    return false;
+  }
+  if (sink_format == kSinkBinary) {
+    ArbalestReportFileHeader h = {kArbalestReportMagic, kArbalestReportVersion,
+                                  static_cast<u32>(pid)};
+    Append(&h, sizeof(h));
+  }
+  VPrintf(1, "ThreadSanitizer: writing Arbalest reports to '%s'\n",
+          filename.data());
+  return true;
+}
+
+void ArbalestReportSinkInit() {
+  const char *format = flags()->arbalest_report_format;
+  if (!internal_strcmp(format, "jsonl")) {
+    sink_format = kSinkJsonl;
+  } else if (!internal_strcmp(format, "binary")) {
+    sink_format = kSinkBinary;
+  } else {
+    if (internal_strcmp(format, "text"))
+      Printf("ThreadSanitizer: unknown arbalest_report_format '%s', "
+             "printing reports as text\n", format);
+    return;
+  }
+  sink_buf = static_cast<char *>(InternalAlloc(kSinkBufferSize));
+  sink_modules = New<Vector<const char *>>();
+  sink_vars = New<Vector<bool>>();
+}
+
+void ArbalestReportSinkFinalize() {
+  if (sink_format == kSinkText)
+    return;
+  Lock lock(&sink_mtx);
+  int pid = internal_getpid();
+  if (sink_pid != pid || sink_fd == kInvalidFd)
+    return;
+  FlushSink();
+  CloseFile(sink_fd);
+  sink_fd = kInvalidFd;
+  sink_finalized = true;
+}
+
+static const char *const kTypeNames[] = {"uninitialized", "stale",
+                                         "overflow_access",
+                                         "overflow_mapping"};
+
+// Host and target address of the access of r and its element in the mapping.
+static void Addresses(const ArbalestPendingReport &r, uptr *host, uptr *target,
+                      sptr *element) {
+  const Node &m = r.mapping;
+  uptr offset = r.addr - m.interval.left_end;
+  *element = r.size ? offset / r.size : -1;
+  if (r.dmi_typ == BUFFER_OVERFLOW_MAPPING) {
+    // The mapping is the device one and the address is the host start.
+    *host = r.addr;
+    *target = m.interval.left_end;
+    *element = -1;
+  } else if (!r.on_target && r.dmi_typ != BUFFER_OVERFLOW_ACCESS) {
+    // Host checks find the mapping in h_to_t.
+    *host = r.addr;
+    *target = m.info.start + offset;
+  } else {
+    *host = m.info.start + offset;
+    *target = r.addr;
+  }
+}
+
+static void AppendEscaped(InternalScopedString *s, const char *str) {
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\')
+      s->append("\\%c", *str);
+    else if (static_cast<u8>(*str) < 0x20)
+      s->append("\\u%04x", *str);
+    else
+      s->append("%c", *str);
+  }
+}
+
+static void WriteJsonl(const ArbalestPendingReport &r, StackTrace trace,
+                       uptr host, uptr target, sptr element) {
+  InternalScopedString s;
+  s.append("{\"type\":\"%s\",\"tid\":%d,\"host\":\"0x%zx\","
+           "\"target\":\"0x%zx\",\"size\":%zu,\"element\":%zd",
+           kTypeNames[r.dmi_typ], static_cast<int>(r.tid), host, target,
+           r.size, element);
+  ArbalestVarDesc var;
+  if (ArbalestGetVarDesc(&r.mapping, &var)) {
+    s.append(",\"var\":\"");
+    AppendEscaped(&s, var.name);
+    s.append("\",\"file\":\"");
+    AppendEscaped(&s, var.file);
+    s.append("\",\"line\":%d,\"col\":%d", var.line, var.col);
+  }
+  s.append(",\"stack\":[");
+  Symbolizer *symbolizer = Symbolizer::GetOrInit();
+  for (uptr i = 0; i < trace.size; i++) {
+    uptr pc = StackTrace::GetPreviousInstructionPc(trace.trace[i]);
+    const char *module;
+    uptr offset;
+    s.append(i ? ",\"" : "\"");
+    if (symbolizer->GetModuleNameAndOffsetForPC(pc, &module, &offset)) {
+      AppendEscaped(&s, module);
+      s.append("+0x%zx\"", offset);
+    } else {
+      s.append("0x%zx\"", pc);
+    }
+  }
+  s.append("]}\n");
+  Append(s.data(), s.length());
+}
+
+static u32 ModuleId(const char *module) {
+  for (uptr i = 0; i < sink_modules->Size(); i++) {
+    if ((*sink_modules)[i] == module)
+      return i;
+  }
+  u32 id = sink_modules->Size();
+  sink_modules->PushBack(module);
+  ArbalestReportModule m = {};
+  m.kind = ArbalestReportRecordModule;
+  m.name_len = internal_strlen(module);
+  m.id = id;
+  Append(&m, sizeof(m));
+  Append(module, m.name_len);
+  return id;
+}
+
+static void WriteVar(u32 id, const ArbalestVarDesc &var) {
+  if (id < sink_vars->Size() && (*sink_vars)[id])
+    return;
+  if (id >= sink_vars->Size())
+    sink_vars->Resize(id + 1);
+  (*sink_vars)[id] = true;
+  ArbalestReportVar v = {};
+  v.kind = ArbalestReportRecordVar;
+  v.is_array = var.is_array;
+  v.name_len = internal_strlen(var.name);
+  v.file_len = internal_strlen(var.file);
+  v.id = id;
+  v.line = var.line;
+  v.col = var.col;
+  Append(&v, sizeof(v));
+  Append(var.name, v.name_len);
+  Append(var.file, v.file_len);
+}
+
+static void WriteBinary(const ArbalestPendingReport &r, StackTrace trace,
+                        uptr host, uptr target, sptr element) {
+  ArbalestReportDMI d = {};
+  ArbalestVarDesc var;
+  u32 var_id = ArbalestVarIdOf(&r.mapping);
+  if (ctx->var_descs.Get(var_id, &var)) {
+    WriteVar(var_id, var);
+    d.var_id = var_id;
+  }
+  // Module records have to precede the report.
+  Symbolizer *symbolizer = Symbolizer::GetOrInit();
+  uptr nframes = Min<uptr>(trace.size, kStackTraceMax);
+  ArbalestReportFrame frames[kStackTraceMax];
+  for (uptr i = 0; i < nframes; i++) {
+    uptr pc = StackTrace::GetPreviousInstructionPc(trace.trace[i]);
+    const char *module;
+    uptr offset;
+    frames[i] = {kNoModule, 0, pc};
+    if (symbolizer->GetModuleNameAndOffsetForPC(pc, &module, &offset))
+      frames[i] = {ModuleId(module), 0, offset};
+  }
+  d.kind = ArbalestReportRecordDMI;
+  d.type = static_cast<u8>(r.dmi_typ);
+  d.nframes = nframes;
+  d.tid = static_cast<u32>(r.tid);
+  d.host_addr = host;
+  d.target_addr = target;
+  d.size = r.size;
+  d.element = element;
+  Append(&d, sizeof(d));
+  Append(frames, nframes * sizeof(frames[0]));
+}
+
+bool ArbalestWriteReport(const ArbalestPendingReport &r, StackTrace trace) {
+  if (sink_format == kSinkText)
+    return false;
+  uptr host, target;
+  sptr element;
+  Addresses(r, &host, &target, &element);
+  Lock lock(&sink_mtx);
+  // The report is printed as text if it can't be written.
+  if (!OpenSink())
+    return false;
+  if (sink_format == kSinkJsonl)
+    WriteJsonl(r, trace, host, target, element);
+  else
+    WriteBinary(r, trace, host, target, element);
+  if (sink_finalized)
+    FlushSink();
+  return true;
+}
+
+}  // namespace __tsan
@@ -0,0 +1,108 @@
+//===-- tsan_arbalest_report_sink.h -----------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+// Structured output of data inconsistency reports. With
+// arbalest_report_format=jsonl or binary, the reports are not symbolized nor
+// printed but appended to a per process file through a buffer. Stack frames
+// are written as module offsets for offline symbolization.
+//
+// The jsonl format has one object per report:
+//   {"type":"stale","tid":1,"host":"0x...","target":"0x...","size":8,
+//    "element":3,"var":"a","file":"t.c","line":12,"col":3,
+//    "stack":["/path/a.out+0x1234",...]}
+// The binary format is an ArbalestReportFileHeader followed by records, see
+// below. Variables and modules are written once, before the first report
+// referring to them.
+//===----------------------------------------------------------------------===//
+#ifndef TSAN_ARBALEST_REPORT_SINK_H
+#define TSAN_ARBALEST_REPORT_SINK_H
+
+#include "sanitizer_common/sanitizer_stacktrace.h"
+#include "tsan_defs.h"
+
+namespace __tsan {
+
+struct ArbalestPendingReport;
+
+const u64 kArbalestReportMagic = 0x54504552534c4241ull;  // "ABLSREPT"
+const u32 kArbalestReportVersion = 1;
+
+struct ArbalestReportFileHeader {
+  u64 magic;
+  u32 version;
+  u32 pid;
+};
+
+enum ArbalestReportRecordKind : u8 {
+  // ArbalestReportVar, then name_len bytes of name and file_len bytes of file.
+  ArbalestReportRecordVar = 1,
+  // ArbalestReportModule, then name_len bytes of name.
+  ArbalestReportRecordModule,
+  // ArbalestReportDMI, then nframes ArbalestReportFrame.
+  ArbalestReportRecordDMI,
+};
+
+// Same values as DMIType.
+enum ArbalestReportType : u8 {
+  ArbalestReportUninitialized = 0,
+  ArbalestReportStale,
+  ArbalestReportOverflowAccess,
+  ArbalestReportOverflowMapping,
+};
+
+struct ArbalestReportVar {
+  u8 kind;
+  u8 is_array;
+  u16 name_len;
+  u16 file_len;
+  u16 reserved;
+  u32 id;
+  u32 line;
+  u32 col;
+  u32 reserved2;
+};
+
+struct ArbalestReportModule {
+  u8 kind;
+  u8 reserved;
+  u16 name_len;
+  u32 id;
+};
+
+struct ArbalestReportDMI {
+  u8 kind;
+  u8 type;
+  u16 nframes;
+  u32 tid;
+  u32 var_id;  // 0 if the mapping has no variable
+  u32 reserved;
+  u64 host_addr;
+  u64 target_addr;
+  u64 size;
+  s64 element;  // -1 if it does not apply
+};
+
+struct ArbalestReportFrame {
+  u32 module_id;  // ~0 if the pc is not in a module, offset is the pc then
+  u32 reserved;
+  u64 offset;
+};
+
+void ArbalestReportSinkInit();
+void ArbalestReportSinkFinalize();
+
+// Writes r with stack trace to the report file. Returns false if the reports
+// are printed as text or the file can't be opened, the caller prints r as
+// text then.
+bool ArbalestWriteReport(const ArbalestPendingReport &r, StackTrace trace);
+
+}  // namespace __tsan
+
+#endif  // TSAN_ARBALEST_REPORT_SINK_H
@@ -1,3 +1,8 @@
+#include "sanitizer_common/sanitizer_symbolizer.h"
+#include "tsan_arbalest_clean.h"
+#include "tsan_arbalest_lazy_reset.h"
+#include "tsan_arbalest_mapping_index.h"
+#include "tsan_arbalest_parallel.h"
 #include "tsan_rtl.h"
 
 typedef __m64 m64;
@@ -190,7 +195,7 @@ void VsmSetZero(uptr addr, uptr size) {
     return;
   }
   // The region is big, reset only beginning and end.
-  const uptr kPageSize = GetPageSizeCached();
+  const uptr kPageSize = VsmPageSize();
   // Set at least first kPageSize/2 to page boundary.
   RawVsm* mid1 =
       Min(end, reinterpret_cast<RawVsm*>(RoundUp(
@@ -199,7 +204,7 @@ void VsmSetZero(uptr addr, uptr size) {
   // Reset middle part.
   RawVsm* mid2 = RoundDown(end, kPageSize);
   if (mid2 > mid1) {
-    if (!MmapFixedSuperNoReserve((uptr)mid1, (uptr)mid2 - (uptr)mid1))
+    if (!RemapVsmRange((uptr)mid1, (uptr)mid2 - (uptr)mid1))
       Die();
   }
   // Set the ending.
@@ -212,6 +217,7 @@ void VsmRangeSet(uptr addr, uptr size, RawVsm val) {
 
   if (!IsAppMem(addr) || !IsAppMem(addr + size - 1))
     return;
+  ArbalestStatIncCur(ArbalestStatVsmRangeBytes, size);
 
   uptr first_aligned_cell = RoundUp(addr, kVsmCell);
   uptr end_aligned_cell = RoundDown(addr + size, kVsmCell);
@@ -232,13 +238,7 @@ void VsmRangeSet(uptr addr, uptr size, RawVsm val) {
   }
 }
 
-void VsmRangeUpdateMapTo(uptr addr, uptr size) {
-  if (size == 0)
-    return;
-
-  if (!IsAppMem(addr) || !IsAppMem(addr + size - 1))
-    return;
-
+static void VsmRangeUpdateMapToImpl(uptr addr, uptr size) {
   uptr first_aligned_cell = RoundUp(addr, kVsmCell);
   uptr end_aligned_cell = RoundDown(addr + size, kVsmCell);
   if (first_aligned_cell > addr) {
@@ -254,13 +254,19 @@ void VsmRangeUpdateMapTo(uptr addr, uptr size) {
   }
 }
 
-void VsmRangeUpdateMapFrom(uptr addr, uptr size) {
+void VsmRangeUpdateMapTo(uptr addr, uptr size) {
   if (size == 0)
     return;
 
   if (!IsAppMem(addr) || !IsAppMem(addr + size - 1))
     return;
+  ArbalestStatIncCur(ArbalestStatVsmRangeBytes, size);
 
+  if (!ArbalestParallelRange(addr, size, &VsmRangeUpdateMapToImpl))
+    VsmRangeUpdateMapToImpl(addr, size);
+}
+
+static void VsmRangeUpdateMapFromImpl(uptr addr, uptr size) {
   uptr first_aligned_cell = RoundUp(addr, kVsmCell);
   uptr end_aligned_cell = RoundDown(addr + size, kVsmCell);
   if (first_aligned_cell > addr) {
@@ -276,13 +282,19 @@ void VsmRangeUpdateMapFrom(uptr addr, uptr size) {
   }
 }
 
-void VsmRangeDeviceReset(uptr addr, uptr size) {
+void VsmRangeUpdateMapFrom(uptr addr, uptr size) {
   if (size == 0)
     return;
 
   if (!IsAppMem(addr) || !IsAppMem(addr + size - 1))
     return;
+  ArbalestStatIncCur(ArbalestStatVsmRangeBytes, size);
+
+  if (!ArbalestParallelRange(addr, size, &VsmRangeUpdateMapFromImpl))
+    VsmRangeUpdateMapFromImpl(addr, size);
+}
 
+static void VsmRangeDeviceResetImpl(uptr addr, uptr size) {
   uptr first_aligned_cell = RoundUp(addr, kVsmCell);
   uptr end_aligned_cell = RoundDown(addr + size, kVsmCell);
   if (first_aligned_cell > addr) {
@@ -298,6 +310,88 @@ void VsmRangeDeviceReset(uptr addr, uptr size) {
   }
 }
 
+void VsmRangeDeviceReset(uptr addr, uptr size) {
+  if (size == 0)
+    return;
+
+  if (!IsAppMem(addr) || !IsAppMem(addr + size - 1))
+    return;
+  ArbalestStatIncCur(ArbalestStatVsmRangeBytes, size);
+
+  if (!ArbalestParallelRange(addr, size, &VsmRangeDeviceResetImpl))
+    VsmRangeDeviceResetImpl(addr, size);
+}
+
+atomic_uint64_t vsm_released_bytes;
+
+// Whole VSM pages of the application range [addr, addr + size), the VSM of
+// a page-aligned application range is contiguous.
+static bool VsmPagesOf(uptr addr, uptr size, uptr *beg, uptr *end) {
+  const uptr page = VsmPageSize();
+  uptr app_beg = RoundUpTo(addr, page);
+  uptr app_end = RoundDownTo(addr + size, page);
+  if (app_beg >= app_end || !IsAppMem(app_beg) || !IsAppMem(app_end - 1))
+    return false;
+  *beg = reinterpret_cast<uptr>(MemToVsm(app_beg));
+  *end = *beg + (app_end - app_beg) * kMemToVsmRatio;
+  return true;
+}
+
+static void VsmReleasePages(uptr beg, uptr end) {
+  ReleaseMemoryPagesToOS(beg, end);
+  atomic_fetch_add(&vsm_released_bytes, end - beg, memory_order_relaxed);
+}
+
+void VsmReleaseRange(uptr addr, uptr size) {
+  uptr beg, end;
+  if (flags()->arbalest_release_vsm && VsmPagesOf(addr, size, &beg, &end))
+    VsmReleasePages(beg, end);
+  ArbalestInvalidateHostClean({addr, addr + size});
+}
+
+static bool HasHostBits(uptr page_beg, uptr page_end) {
+  const u64 *w = reinterpret_cast<const u64 *>(page_beg);
+  const u64 *w_end = reinterpret_cast<const u64 *>(page_end);
+  for (; w < w_end; w++) {
+    if (*w & VariableStateMachine::kHostMask8)
+      return true;
+  }
+  return false;
+}
+
+void VsmReleaseEmptyPages(uptr addr, uptr size) {
+  uptr beg, end;
+  if (!flags()->arbalest_release_vsm || !VsmPagesOf(addr, size, &beg, &end))
+    return;
+  // The pages are scanned first and released afterwards, there is no way to
+  // release a page only if it is still empty. A concurrent host write would
+  // be dropped, the caller guarantees there is none.
+  // Only resident pages are scanned and released. Reading a page that was
+  // never touched would fault it in, a huge one under hugetlbfs. The
+  // residency is queried for up to kChunk base pages at a time.
+  const uptr kChunk = 4096;
+  u8 resident[kChunk];
+  const uptr page = VsmPageSize();
+  const uptr base_page = GetPageSizeCached();
+  const uptr chunk_size = kChunk * base_page;  // a multiple of page
+  uptr run = beg;  // start of the resident empty pages to be released
+  for (uptr chunk = beg; chunk < end; chunk += chunk_size) {
+    uptr chunk_end = Min(end, chunk + chunk_size);
+    bool known = VsmPagesResident(chunk, chunk_end - chunk, resident);
+    for (uptr p = chunk; p < chunk_end; p += page) {
+      bool absent = known && !resident[(p - chunk) / base_page];
+      if (!absent && !HasHostBits(p, p + page))
+        continue;
+      // p ends the run, it is either kept or not resident.
+      if (run < p)
+        VsmReleasePages(run, p);
+      run = p + page;
+    }
+  }
+  if (run < end)
+    VsmReleasePages(run, end);
+}
+
 ALWAYS_INLINE USED RawVsm* CheckVsmUtil(uptr addr, uptr size, u64 vmask) {
   int range_mask = kVsmCellBitMap >> (kVsmCell - size);
   uptr cell_start = RoundDown(addr, kVsmCell);
@@ -342,15 +436,46 @@ ALWAYS_INLINE USED RawVsm* CheckVsmUtil16(uptr addr, u8 vmask) {
   }
 }
 
+// Mapping of the device range i, looked up in the mapping indices of
+// libomptarget once they are attached and in ctx->t_to_h before. An entry of
+// an index is copied into *tmp.
+static ALWAYS_INLINE Node *FindTargetMapping(ThreadState *thr,
+                                             const Interval &i, Node *tmp) {
+  if (!ArbalestHasMappingIndex())
+    return ArbalestTreeFind(thr->arbalest_stats, ctx->t_to_h, i);
+  Node *n = ArbalestMappingIndexFind(i, tmp) ? tmp : nullptr;
+  ArbalestStatInc(thr->arbalest_stats, ArbalestStatTreeLookup);
+  if (!n)
+    ArbalestStatInc(thr->arbalest_stats, ArbalestStatTreeLookupMiss);
+  return n;
+}
+
+// Carries out the pending device reset of the host range [addr, addr + size)
+// before the device accesses its VSM.
+static ALWAYS_INLINE void MaterializeDeviceReset(ThreadState *thr, uptr addr,
+                                                 uptr size) {
+  if (LIKELY(!ArbalestHasLazyReset()))
+    return;
+  ArbalestMaterializeDeviceReset(&thr->arbalest_lazy_reset,
+                                 thr->arbalest_stats, addr, size);
+}
+
 // [addr, addr + size) should fall into the same VSM
 ALWAYS_INLINE USED bool CheckVsm(ThreadState *thr, uptr pc, uptr addr,
                                          uptr size) {
+  if (UNLIKELY(ArbalestRecording())) {
+    ArbalestRecordAccess(thr, pc, addr, size, false);
+    return false;
+  }
   if (thr->is_on_target) {
-    Node *n = ctx->t_to_h.find({addr, addr + size});
+    ArbalestStatInc(thr->arbalest_stats, ArbalestStatDeviceCheck);
+    Node tmp;
+    Node *n = FindTargetMapping(thr, {addr, addr + size}, &tmp);
     if (!n) {
       return false;
     }
     uptr corr_host_addr = n->info.start + (addr - n->interval.left_end);
+    MaterializeDeviceReset(thr, corr_host_addr, size);
     RawVsm *error_vsm_ptr = CheckVsmUtil(corr_host_addr, size, VariableStateMachine::kDeviceMask8);
     if (UNLIKELY(error_vsm_ptr)) {
       VariableStateMachine v{*error_vsm_ptr};
@@ -364,10 +489,16 @@ ALWAYS_INLINE USED bool CheckVsm(ThreadState *thr, uptr pc, uptr addr,
       return false;
     }
   } else {
-    Node *n = ctx->h_to_t.find({addr, addr + size});
+    ArbalestStatInc(thr->arbalest_stats, ArbalestStatHostCheck);
+    Node *n = ArbalestTreeFind(thr->arbalest_stats, ctx->h_to_t,
+                               {addr, addr + size});
     if (!n) {
       return false;
     }
+    if (ArbalestIsHostClean(n)) {
+      ArbalestStatInc(thr->arbalest_stats, ArbalestStatHostClean);
+      return false;
+    }
     RawVsm *error_vsm_ptr = CheckVsmUtil(addr, size, VariableStateMachine::kHostMask8);
     if (UNLIKELY(error_vsm_ptr)) {
       VariableStateMachine v{*error_vsm_ptr};
@@ -378,6 +509,7 @@ ALWAYS_INLINE USED bool CheckVsm(ThreadState *thr, uptr pc, uptr addr,
       ReportDMI(thr, addr, size, n, kAccessRead, v.IsHostInit() ? USE_OF_STALE_DATA : USE_OF_UNINITIALIZED_MEMORY);
       return true;
     } else {
+      ArbalestNoteHostCheck(&thr->arbalest_clean, n);
       return false;
     }
   }
@@ -385,12 +517,19 @@ ALWAYS_INLINE USED bool CheckVsm(ThreadState *thr, uptr pc, uptr addr,
 
 ALWAYS_INLINE USED bool CheckVsm16(ThreadState *thr, uptr pc, uptr addr) {
   constexpr uptr size = 16;
+  if (UNLIKELY(ArbalestRecording())) {
+    ArbalestRecordAccess(thr, pc, addr, size, false);
+    return false;
+  }
   if (thr->is_on_target) {
-    Node *n = ctx->t_to_h.find({addr, addr + size});
+    ArbalestStatInc(thr->arbalest_stats, ArbalestStatDeviceCheck);
+    Node tmp;
+    Node *n = FindTargetMapping(thr, {addr, addr + size}, &tmp);
     if (!n) {
       return false;
     }
     uptr corr_host_addr = n->info.start + (addr - n->interval.left_end);
+    MaterializeDeviceReset(thr, corr_host_addr, size);
     RawVsm *error_vsm_ptr = CheckVsmUtil16(corr_host_addr, static_cast<u8>(VariableStateMachine::kDeviceMask));
     if (UNLIKELY(error_vsm_ptr)) {
       VariableStateMachine v{*error_vsm_ptr};
@@ -404,10 +543,16 @@ ALWAYS_INLINE USED bool CheckVsm16(ThreadState *thr, uptr pc, uptr addr) {
       return false;
     }
   } else {
-    Node *n = ctx->h_to_t.find({addr, addr + size});
+    ArbalestStatInc(thr->arbalest_stats, ArbalestStatHostCheck);
+    Node *n = ArbalestTreeFind(thr->arbalest_stats, ctx->h_to_t,
+                               {addr, addr + size});
     if (!n) {
       return false;
     }
+    if (ArbalestIsHostClean(n)) {
+      ArbalestStatInc(thr->arbalest_stats, ArbalestStatHostClean);
+      return false;
+    }
     RawVsm *error_vsm_ptr = CheckVsmUtil16(addr, static_cast<u8>(VariableStateMachine::kHostMask));
     if (UNLIKELY(error_vsm_ptr)) {
       VariableStateMachine v{*error_vsm_ptr};
@@ -418,6 +563,7 @@ ALWAYS_INLINE USED bool CheckVsm16(ThreadState *thr, uptr pc, uptr addr) {
       ReportDMI(thr, addr, size, n, kAccessRead, v.IsHostInit() ? USE_OF_STALE_DATA : USE_OF_UNINITIALIZED_MEMORY);
       return true;
     } else {
+      ArbalestNoteHostCheck(&thr->arbalest_clean, n);
       return false;
     }
   }  
@@ -501,28 +647,50 @@ ALWAYS_INLINE USED void UpdateVsmUtil16(uptr addr, u8 value_bitmap, u8 set_mask)
 }
 
 ALWAYS_INLINE USED void UpdateVsm(ThreadState *thr, uptr addr, uptr size) {
+  if (UNLIKELY(ArbalestRecording())) {
+    ArbalestRecordAccess(thr, 0, addr, size, true);
+    return;
+  }
   if (thr->is_on_target) {
-    Node *n = ctx->t_to_h.find({addr, addr + size});
+    ArbalestStatInc(thr->arbalest_stats, ArbalestStatDeviceUpdate);
+    Node tmp;
+    Node *n = FindTargetMapping(thr, {addr, addr + size}, &tmp);
     if (!n) {
       return;
     }
     uptr corr_host_addr = n->info.start + (addr - n->interval.left_end);
+    MaterializeDeviceReset(thr, corr_host_addr, size);
+    bool ends_clean = ArbalestDeviceWriteEndsClean(corr_host_addr, size);
     UpdateVsmUtil(corr_host_addr, size, VariableStateMachine::kDeviceValueBitMap8, VariableStateMachine::kDeviceMask8);
+    if (UNLIKELY(ends_clean))
+      ArbalestInvalidateHostClean({corr_host_addr, corr_host_addr + size});
   } else {
+    ArbalestStatInc(thr->arbalest_stats, ArbalestStatHostUpdate);
     UpdateVsmUtil(addr, size, VariableStateMachine::kHostValueBitMap8, VariableStateMachine::kHostMask8);
   }                         
 }
 
 ALWAYS_INLINE USED void UpdateVsm16(ThreadState *thr, uptr addr) {
   constexpr uptr size = 16;
+  if (UNLIKELY(ArbalestRecording())) {
+    ArbalestRecordAccess(thr, 0, addr, size, true);
+    return;
+  }
   if (thr->is_on_target) {
-    Node *n = ctx->t_to_h.find({addr, addr + size});
+    ArbalestStatInc(thr->arbalest_stats, ArbalestStatDeviceUpdate);
+    Node tmp;
+    Node *n = FindTargetMapping(thr, {addr, addr + size}, &tmp);
     if (!n) {
       return;
     }
     uptr corr_host_addr = n->info.start + (addr - n->interval.left_end);
+    MaterializeDeviceReset(thr, corr_host_addr, size);
+    bool ends_clean = ArbalestDeviceWriteEndsClean(corr_host_addr, size);
     UpdateVsmUtil16(corr_host_addr, static_cast<u8>(VariableStateMachine::kDeviceValueBitMap), static_cast<u8>(VariableStateMachine::kDeviceMask));
+    if (UNLIKELY(ends_clean))
+      ArbalestInvalidateHostClean({corr_host_addr, corr_host_addr + size});
   } else {
+    ArbalestStatInc(thr->arbalest_stats, ArbalestStatHostUpdate);
     UpdateVsmUtil16(addr, static_cast<u8>(VariableStateMachine::kHostValueBitMap), static_cast<u8>(VariableStateMachine::kHostMask));
   }                         
 }
@@ -559,26 +727,102 @@ ALWAYS_INLINE USED void UpdateVsmForMemoryRange(ThreadState *thr, uptr addr,
 }
 
 ALWAYS_INLINE USED void CheckBound(ThreadState *thr, uptr pc, uptr base, uptr start, uptr size) {
-  if (ctx->t_to_h.isOverflow(base, start)) {
+  bool overflow = ArbalestHasMappingIndex()
+                      ? ArbalestMappingIndexIsOverflow(base, start)
+                      : ctx->t_to_h.isOverflow(base, start);
+  if (overflow) {
     if (UNLIKELY(!TryTraceMemoryAccess(thr, pc, start, size, kAccessRead))) {
       TraceSwitchPart(thr);
       UNUSED bool res = TryTraceMemoryAccess(thr, pc, start, size, kAccessRead);
     }
-    Node *n = ctx->t_to_h.find({base, base + size});
+    Node tmp;
+    Node *n = FindTargetMapping(thr, {base, base + size}, &tmp);
     ReportDMI(thr, start, size, n, kAccessRead, BUFFER_OVERFLOW_ACCESS);
   }
 }
 
+// mb is the heap block of the mapping n, if it has one. The block is marked
+// so that only its free looks for the nodes to clear, other frees don't
+// touch h_to_t.
+static void SetBoundsChecked(Node *n, MBlock *mb) {
+  if (mb)
+    mb->SetArbalestFlag(kMBlockBoundsChecked);
+  atomic_store_relaxed(&n->info.bounds_checked, 1);
+}
+
+void MappingBoundsFreed(uptr p, uptr size) {
+  Vector<Interval> result;
+  ctx->h_to_t.searchRange(result, {p, p + size});
+  for (uptr i = 0; i < result.Size(); i++) {
+    if (Node *n = ctx->h_to_t.find(result[i]))
+      atomic_store_relaxed(&n->info.bounds_checked, 0);
+  }
+}
+
+// Guards ctx->globals once the program runs, globals that are not registered
+// by __arbalest_init are added when they are first mapped.
+static StaticSpinMutex globals_mtx;
+
+static Node *FindGlobal(uptr addr) {
+  SpinMutexLock l(&globals_mtx);
+  return ctx->globals.find({addr, addr + 1});
+}
+
+// Module addresses the symbolizer has no data symbol for, e.g. in stripped
+// modules, direct mapped by address. Their mappings are associated again on
+// every target region.
+static const uptr kUnsymbolizedGlobals = 256;
+static atomic_uintptr_t unsymbolized_globals[kUnsymbolizedGlobals];
+
+static atomic_uintptr_t *UnsymbolizedSlot(uptr addr) {
+  return &unsymbolized_globals[(addr >> 3) % kUnsymbolizedGlobals];
+}
+
+void ArbalestRegisterGlobal(uptr addr) {
+  if (allocator()->PointerIsMine(reinterpret_cast<void *>(addr)) ||
+      atomic_load_relaxed(UnsymbolizedSlot(addr)) == addr || FindGlobal(addr))
+    return;
+  // The symbolizer makes intercepted calls. SymbolizeData fails outside of
+  // the modules (stacks and mmaps), and refreshes the module list under the
+  // symbolizer lock after dlopen.
+  ScopedIgnoreInterceptors ignore;
+  DataInfo info;
+  if (!Symbolizer::GetOrInit()->SymbolizeData(addr, &info))
+    return;
+  uptr start = info.start, size = info.size;
+  info.Clear();
+  if (!size) {
+    atomic_store_relaxed(UnsymbolizedSlot(addr), addr);
+    return;
+  }
+  {
+    SpinMutexLock l(&globals_mtx);
+    if (!ctx->globals.insert({start, start + size},
+                             {start, size, kArbalestNoVar}))
+      return;
+  }
+  // Same state as the globals of __arbalest_init, the device bits are still
+  // clear since this is the first mapping of the global.
+  VsmRangeSet(start, size, VariableStateMachine::kHostMask);
+}
+
 // mapping: target -> host
 ALWAYS_INLINE USED void CheckMappingBound(ThreadState *thr, uptr pc, Node *mapping) {
     // check if the mapping range is larger than the host variable
   uptr host_start = mapping->info.start;
   uptr size = mapping->info.size;
+  // Transfers of a mapping that was checked as a whole need no allocator
+  // queries until its block is freed.
+  Node *h = ArbalestTreeFind(thr->arbalest_stats, ctx->h_to_t,
+                             {host_start, host_start + size});
+  if (h && atomic_load_relaxed(&h->info.bounds_checked))
+    return;
   Allocator *mem_alloc = allocator();
   void *host_start_addr = reinterpret_cast<void *>(host_start);
   bool report_error = false;
-  if (mem_alloc->PointerIsMine(host_start_addr)) {
-    MBlock *mb = nullptr;
+  bool is_heap = mem_alloc->PointerIsMine(host_start_addr);
+  MBlock *mb = nullptr;
+  if (is_heap) {
     uptr block_begin = reinterpret_cast<uptr>(mem_alloc->GetBlockBegin(host_start_addr));
     if (block_begin) {
       mb = ctx->metamap.GetBlock(block_begin);
@@ -588,7 +832,7 @@ ALWAYS_INLINE USED void CheckMappingBound(ThreadState *thr, uptr pc, Node *mappi
       report_error = true;
     }
   } else {
-    Node *global_info = ctx->globals.find({host_start, host_start + 1});
+    Node *global_info = FindGlobal(host_start);
     if (global_info) {
       uptr bound = global_info->info.start + global_info->info.size;
       if (host_start + size > bound) {
@@ -604,6 +848,10 @@ ALWAYS_INLINE USED void CheckMappingBound(ThreadState *thr, uptr pc, Node *mappi
       UNUSED bool res = TryTraceMemoryAccess(thr, pc, host_start, size, kAccessRead);
     }
     ReportDMI(thr, host_start, size, mapping, kAccessRead, BUFFER_OVERFLOW_MAPPING);
+  } else if (h && h->interval == Interval{host_start, host_start + size} &&
+             (mb || !is_heap)) {
+    // A heap mapping without a block can't be invalidated, don't cache it.
+    SetBoundsChecked(h, mb);
   }
 }
 
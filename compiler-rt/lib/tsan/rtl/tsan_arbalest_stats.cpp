@@ -0,0 +1,91 @@
+//===-- tsan_arbalest_stats.cpp -------------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+//===----------------------------------------------------------------------===//
+#include "tsan_arbalest_stats.h"
+
+#include "tsan_flags.h"
+#include "tsan_interface.h"
+#include "tsan_rtl.h"
+
+namespace __tsan {
+
+bool arbalest_stats_enabled;
+
+// Counters of finished threads, protected by the thread registry mutex.
+static ArbalestStats finished_stats;
+
+static const char *const kStatNames[ArbalestStatCnt] = {
+    "host_checks",        "device_checks",    "host_updates",
+    "device_updates",     "tree_lookups",     "tree_lookup_depth",
+    "tree_lookup_misses", "map_to",           "map_from",
+    "map_alloc",          "map_release",      "map_associate",
+    "map_disassociate",   "vsm_range_bytes",  "reports_suppressed",
+    "mapping_ns",         "lazy_reset_bytes", "sampled_out",
+    "host_clean",
+};
+
+void ArbalestStatsInit() { arbalest_stats_enabled = flags()->arbalest_stats; }
+
+void ArbalestStatIncCur(ArbalestStatType typ, u64 n) {
+  if (UNLIKELY(arbalest_stats_enabled))
+    cur_thread()->arbalest_stats.val[typ] += n;
+}
+
+void ArbalestStatsMerge(const ArbalestStats &s) {
+  for (uptr i = 0; i < ArbalestStatCnt; i++) finished_stats.val[i] += s.val[i];
+}
+
+static void AddThreadStats(ThreadContextBase *tctx_base, void *arg) {
+  ThreadContext *tctx = static_cast<ThreadContext *>(tctx_base);
+  ArbalestStats *s = static_cast<ArbalestStats *>(arg);
+  if (tctx->status != ThreadStatusRunning || !tctx->thr)
+    return;
+  // Other threads keep counting, the snapshot is not exact.
+  for (uptr i = 0; i < ArbalestStatCnt; i++)
+    s->val[i] += tctx->thr->arbalest_stats.val[i];
+}
+
+void ArbalestGetStats(ArbalestStats *s) {
+  ThreadRegistryLock l(&ctx->thread_registry);
+  *s = finished_stats;
+  ctx->thread_registry.RunCallbackForEachThreadLocked(AddThreadStats, s);
+}
+
+const char *ArbalestStatName(uptr typ) {
+  return typ < ArbalestStatCnt ? kStatNames[typ] : nullptr;
+}
+
+void ArbalestPrintStats() {
+  ArbalestStats s;
+  ArbalestGetStats(&s);
+  Printf("Arbalest statistics:\n");
+  for (uptr i = 0; i < ArbalestStatCnt; i++)
+    Printf("  %-20s %llu\n", kStatNames[i], s.val[i]);
+  if (u64 lookups = s.val[ArbalestStatTreeLookup]) {
+    // Printf has no floating point support.
+    u64 avg100 = s.val[ArbalestStatTreeLookupDepth] * 100 / lookups;
+    Printf("  %-20s %llu.%02llu\n", "avg_lookup_depth", avg100 / 100,
+           avg100 % 100);
+  }
+}
+
+}  // namespace __tsan
+
+using namespace __tsan;
+
+uptr __arbalest_get_stats(u64 *stats, uptr n) {
+  ArbalestStats s;
+  ArbalestGetStats(&s);
+  for (uptr i = 0; i < n && i < ArbalestStatCnt; i++) stats[i] = s.val[i];
+  return ArbalestStatCnt;
+}
+
+const char *__arbalest_get_stat_name(uptr idx) { return ArbalestStatName(idx); }
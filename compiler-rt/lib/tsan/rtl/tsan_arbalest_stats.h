@@ -0,0 +1,86 @@
+//===-- tsan_arbalest_stats.h -----------------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+// Runtime statistics of Arbalest, enabled with arbalest_stats=1. Counters are
+// per thread and are merged into a global total when the thread finishes.
+//===----------------------------------------------------------------------===//
+#ifndef TSAN_ARBALEST_STATS_H
+#define TSAN_ARBALEST_STATS_H
+
+#include "tsan_avltree.h"
+#include "tsan_defs.h"
+
+namespace __tsan {
+
+// Keep in sync with the names in tsan_arbalest_stats.cpp.
+enum ArbalestStatType {
+  ArbalestStatHostCheck,
+  ArbalestStatDeviceCheck,
+  ArbalestStatHostUpdate,
+  ArbalestStatDeviceUpdate,
+  ArbalestStatTreeLookup,
+  ArbalestStatTreeLookupDepth,  // sum of the nodes visited by lookups
+  ArbalestStatTreeLookupMiss,
+  ArbalestStatMapTo,
+  ArbalestStatMapFrom,
+  ArbalestStatMapAlloc,
+  ArbalestStatMapRelease,
+  ArbalestStatMapAssociate,
+  ArbalestStatMapDisassociate,
+  ArbalestStatVsmRangeBytes,  // bytes transitioned by VsmRange*
+  ArbalestStatReportSuppressed,
+  ArbalestStatMappingNs,  // time spent in AnnotateMapping
+  ArbalestStatLazyResetBytes,  // bytes of deferred device resets carried out
+  ArbalestStatSampledOut,  // reads not checked, see arbalest_check_sample
+  ArbalestStatHostClean,  // host reads of clean mappings, not checked
+  ArbalestStatCnt
+};
+
+struct ArbalestStats {
+  u64 val[ArbalestStatCnt];
+};
+
+extern bool arbalest_stats_enabled;
+
+ALWAYS_INLINE void ArbalestStatInc(ArbalestStats &s, ArbalestStatType typ,
+                                   u64 n = 1) {
+  if (UNLIKELY(arbalest_stats_enabled))
+    s.val[typ] += n;
+}
+
+// Same as ArbalestStatInc for callers that do not have the ThreadState.
+void ArbalestStatIncCur(ArbalestStatType typ, u64 n);
+
+// tree.find(i), accounted as a mapping tree lookup of the thread.
+ALWAYS_INLINE Node *ArbalestTreeFind(ArbalestStats &s, IntervalTree &tree,
+                                     const Interval &i) {
+  if (LIKELY(!arbalest_stats_enabled))
+    return tree.find(i);
+  u64 depth = 0;
+  Node *n = tree.find(i, &depth);
+  s.val[ArbalestStatTreeLookup]++;
+  s.val[ArbalestStatTreeLookupDepth] += depth;
+  if (!n)
+    s.val[ArbalestStatTreeLookupMiss]++;
+  return n;
+}
+
+void ArbalestStatsInit();
+// Adds the counters of a finishing thread to the global total. Must be called
+// with the thread registry locked.
+void ArbalestStatsMerge(const ArbalestStats &s);
+// Fills in the global total plus the counters of all running threads.
+void ArbalestGetStats(ArbalestStats *s);
+const char *ArbalestStatName(uptr typ);
+void ArbalestPrintStats();
+
+}  // namespace __tsan
+
+#endif  // TSAN_ARBALEST_STATS_H
@@ -0,0 +1,89 @@
+//===-- tsan_arbalest_var_desc.cpp ----------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+//===----------------------------------------------------------------------===//
+#include "tsan_arbalest_var_desc.h"
+
+#include "sanitizer_common/sanitizer_libc.h"
+#include "tsan_rtl.h"
+
+namespace __tsan {
+
+// Copy of [beg, end) with a terminating zero.
+static const char *CopyString(const char *beg, const char *end) {
+  char *s = static_cast<char *>(InternalAlloc(end - beg + 1));
+  internal_memcpy(s, beg, end - beg);
+  s[end - beg] = 0;
+  return s;
+}
+
+// Next field of a ";"-separated string, *pos is left at the separator.
+static const char *NextField(const char **pos) {
+  const char *beg = *pos + (**pos == ';');
+  *pos = internal_strchrnul(beg, ';');
+  return beg;
+}
+
+static ArbalestVarDesc ParseVarInfo(const char *var_info) {
+  ArbalestVarDesc desc = {};
+  const char *pos = var_info;
+  const char *name = NextField(&pos);
+  const char *name_end = pos;
+  for (const char *p = name; p < name_end; p++) {
+    if (*p == '[') {
+      desc.is_array = true;
+      name_end = p;
+      break;
+    }
+  }
+  desc.name = CopyString(name, name_end);
+  const char *file = NextField(&pos);
+  desc.file = CopyString(file, pos);
+  desc.line = internal_simple_strtoll(NextField(&pos), nullptr, 10);
+  desc.col = internal_simple_strtoll(NextField(&pos), nullptr, 10);
+  return desc;
+}
+
+u32 ArbalestVarDescs::Intern(const char *var_info) {
+  if (!var_info)
+    return kArbalestNoVar;
+  IdMap::Handle h(&ids_, reinterpret_cast<uptr>(var_info));
+  if (h.created()) {
+    ArbalestVarDesc desc = ParseVarInfo(var_info);
+    Lock lock(&mtx_);
+    descs_.PushBack(desc);
+    *h = descs_.Size();
+  }
+  return *h;
+}
+
+bool ArbalestVarDescs::Get(u32 id, ArbalestVarDesc *desc) {
+  if (id == kArbalestNoVar || id == kArbalestVarUnresolved)
+    return false;
+  Lock lock(&mtx_);
+  CHECK_LE(id, descs_.Size());
+  *desc = descs_[id - 1];
+  return true;
+}
+
+u32 ArbalestVarIdOf(const Node *mapping) {
+  u32 id = mapping->info.var_id;
+  if (id != kArbalestVarUnresolved)
+    return id;
+  uptr host = mapping->info.start;
+  Node *n = ctx->h_to_t.find({host, host + 1});
+  return n ? n->info.var_id : kArbalestNoVar;
+}
+
+bool ArbalestGetVarDesc(const Node *mapping, ArbalestVarDesc *desc) {
+  return ctx->var_descs.Get(ArbalestVarIdOf(mapping), desc);
+}
+
+}  // namespace __tsan
@@ -0,0 +1,69 @@
+//===-- tsan_arbalest_var_desc.h --------------------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+// Interned descriptors of mapped variables. Clang describes a mapped variable
+// with a ";name;file;row;col;;" string in the name table of libomptarget; the
+// string is parsed once when the mapping is annotated and the mapping keeps
+// the 32-bit id of its descriptor. Descriptors are never freed, so reports
+// can refer to them at any time.
+//===----------------------------------------------------------------------===//
+#ifndef TSAN_ARBALEST_VAR_DESC_H
+#define TSAN_ARBALEST_VAR_DESC_H
+
+#include "sanitizer_common/sanitizer_addrhashmap.h"
+#include "sanitizer_common/sanitizer_mutex.h"
+#include "sanitizer_common/sanitizer_vector.h"
+#include "tsan_avltree.h"
+#include "tsan_defs.h"
+
+namespace __tsan {
+
+// Mapping without a variable description.
+const u32 kArbalestNoVar = 0;
+// Mapping copied from a mapping index of libomptarget, the descriptor is the
+// one of the node of ctx->h_to_t at the host address of the mapping.
+const u32 kArbalestVarUnresolved = ~0u;
+
+struct ArbalestVarDesc {
+  const char *name;  // without the array section
+  const char *file;
+  int line;
+  int col;
+  bool is_array;  // the mapping is an array section
+};
+
+class ArbalestVarDescs {
+ public:
+  // Id of the descriptor of var_info, which is either null or points to
+  // a string of the name table of libomptarget.
+  u32 Intern(const char *var_info);
+
+  // Copies descriptor id to *desc, false for kArbalestNoVar.
+  bool Get(u32 id, ArbalestVarDesc *desc);
+
+ private:
+  typedef AddrHashMap<u32, 1021> IdMap;
+
+  IdMap ids_;  // by var_info pointer
+  Mutex mtx_;
+  Vector<ArbalestVarDesc> descs_;  // descriptor id is at index id - 1
+};
+
+// Descriptor id of the variable of mapping, which may be a copy of an entry
+// of a mapping index.
+u32 ArbalestVarIdOf(const Node *mapping);
+
+// Copies the descriptor of the variable of mapping to *desc, false if it has
+// none.
+bool ArbalestGetVarDesc(const Node *mapping, ArbalestVarDesc *desc);
+
+}  // namespace __tsan
+
+#endif  // TSAN_ARBALEST_VAR_DESC_H
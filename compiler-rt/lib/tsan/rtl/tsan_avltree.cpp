@@ -167,6 +167,16 @@ Node *IntervalTree::searchUtil(Node *head, const Interval &i) {
   }
 }
 
+Node *IntervalTree::find(const Interval &i, u64 *depth) {
+  for (Node *head = root; head;) {
+    (*depth)++;
+    if (head->interval.contains(i))
+      return head;
+    head = (head->interval > i) ? head->left_child : head->right_child;
+  }
+  return nullptr;
+}
+
 Node *IntervalTree::removeUtil(Node *head, const Interval &i) {
   if (head == nullptr)
     return nullptr;
@@ -309,19 +319,19 @@ void IntervalTree::removeAllNodesWithinRange(const Interval &range) {
   searchRange(result, range);
 
   if (result.Size()) {
-    const char *var_info_first = searchUtil(root, result[0])->info.var_info;
-    const char *var_info_last = searchUtil(root, result.Back())->info.var_info;
+    u32 var_id_first = searchUtil(root, result[0])->info.var_id;
+    u32 var_id_last = searchUtil(root, result.Back())->info.var_id;
     for (uptr i = 0; i < result.Size(); i++) {
       remove(result[i]);
     }
     if (result[0].left_end < range.left_end) {
       insert({result[0].left_end, range.left_end},
-             {result[0].left_end, range.left_end - result[0].left_end, var_info_first});
+             {result[0].left_end, range.left_end - result[0].left_end, var_id_first});
     }
     Interval &last = result.Back();
     if (last.right_end > range.right_end) {
       insert({range.right_end, last.right_end},
-             {range.right_end, last.right_end - range.right_end, var_info_last});
+             {range.right_end, last.right_end - range.right_end, var_id_last});
     }
   }
 }
@@ -1,6 +1,7 @@
 #ifndef TSAN_AVLTREE_H
 #define TSAN_AVLTREE_H
 
+#include "sanitizer_common/sanitizer_atomic.h"
 #include "sanitizer_common/sanitizer_common.h"
 #include "sanitizer_common/sanitizer_vector.h"
 
@@ -57,10 +58,20 @@ struct Interval {
 
 };
 
+struct ArbalestLazyReset;
+
 struct MapInfo {
   uptr start;
   uptr size;
-  const char *var_info;
+  u32 var_id;  // descriptor of the mapped variable, see ArbalestVarDescs
+  // Whether the host side of the mapping is known to be valid, see
+  // tsan_arbalest_clean.h. Only used in the nodes of h_to_t.
+  atomic_uint32_t host_clean = {};
+  // Pending device reset of the mapping, only set in the nodes of h_to_t.
+  ArbalestLazyReset *lazy_reset = nullptr;
+  // Whether the whole host range fits into its heap block or global, see
+  // CheckMappingBound. Only used in the nodes of h_to_t.
+  atomic_uint8_t bounds_checked = {};
 };
 
 struct Node {
@@ -72,6 +83,8 @@ struct Node {
   int height;
   int index;
 
+  Node() = default;
+
   Node(const Interval &interval, const MapInfo &info)
       : interval(interval),
         info(info),
@@ -128,6 +141,9 @@ class IntervalTree {
 
   Node *find(const Interval &i) { return searchUtil(root, i); }
 
+  // Same as find(i), also adds the number of visited nodes to *depth.
+  Node *find(const Interval &i, u64 *depth);
+
   bool insert(const Interval &interval, const MapInfo &info) {
     // Printf("try to insert interval: %p %p \n", interval.left_end,
     // interval.right_end);
@@ -13,6 +13,7 @@
 #ifndef TSAN_DEFS_H
 #define TSAN_DEFS_H
 
+#include "sanitizer_common/sanitizer_atomic.h"
 #include "sanitizer_common/sanitizer_internal_defs.h"
 #include "sanitizer_common/sanitizer_libc.h"
 #include "sanitizer_common/sanitizer_mutex.h"
@@ -198,12 +199,31 @@ enum : AccessType {
   kAccessSlotLocked = 1 << 7,  // memory access with TidSlot locked
 };
 
+// Flags of MBlock::arbalest_flags.
+enum : u8 {
+  // A mapping of the block passed CheckMappingBound, see MappingBoundsFreed.
+  kMBlockBoundsChecked = 1 << 0,
+  // The block holds a barrier annotated with BarrierArrive, see BarriersFreed.
+  kMBlockBarrier = 1 << 1,
+};
+
 // Descriptor of user's memory block.
 struct MBlock {
-  u64  siz : 48;
-  u64  tag : 16;
+  u64  siz : 41;  // up to kMaxAllowedMallocSize
+  u64  tag : 15;
+  // Set by any thread while the block is alive, a memory location of its own
+  // so that the flags and the bitfields above don't overwrite each other.
+  atomic_uint8_t arbalest_flags;
   StackID stk;
   Tid tid;
+
+  void SetArbalestFlag(u8 flag) {
+    u8 cmp = atomic_load_relaxed(&arbalest_flags);
+    while (!(cmp & flag) &&
+           !atomic_compare_exchange_weak(&arbalest_flags, &cmp, cmp | flag,
+                                         memory_order_relaxed)) {
+    }
+  }
 };
 
 COMPILER_CHECK(sizeof(MBlock) == 16);
@@ -213,8 +233,8 @@ enum ExternalTag : uptr {
   kExternalTagSwiftModifyingAccess = 1,
   kExternalTagFirstUserAvailable = 2,
   kExternalTagMax = 1024,
-  // Don't set kExternalTagMax over 65,536, since MBlock only stores tags
-  // as 16-bit values, see tsan_defs.h.
+  // Don't set kExternalTagMax over 32,768, since MBlock only stores tags
+  // as 15-bit values, see tsan_defs.h.
 };
 
 enum {
@@ -53,8 +53,19 @@ SANITIZER_INTERFACE_ATTRIBUTE void __arbalest_unaligned_write4(void *addr);
 SANITIZER_INTERFACE_ATTRIBUTE void __arbalest_unaligned_write8(void *addr);
 SANITIZER_INTERFACE_ATTRIBUTE void __arbalest_unaligned_write16(void *addr);
 
+// Checks only one of every n reads of the calling thread until the next call,
+// 0 restores arbalest_check_sample. Returns the previous value.
+SANITIZER_INTERFACE_ATTRIBUTE int __arbalest_set_check_sample(int n);
+
 SANITIZER_INTERFACE_ATTRIBUTE void __arbalest_check_bound(void *base, void *start, unsigned size);
 
+// Copies up to n Arbalest statistics counters (see arbalest_stats) into stats
+// and returns the number of counters the runtime has.
+SANITIZER_INTERFACE_ATTRIBUTE uptr __arbalest_get_stats(__sanitizer::u64 *stats,
+                                                        uptr n);
+// Returns the name of counter idx, or null if there is no such counter.
+SANITIZER_INTERFACE_ATTRIBUTE const char *__arbalest_get_stat_name(uptr idx);
+
 // This function should be called at the very beginning of the process,
 // before any instrumented code is executed and before any call to malloc.
 SANITIZER_INTERFACE_ATTRIBUTE void __tsan_init();
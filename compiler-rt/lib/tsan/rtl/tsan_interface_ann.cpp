@@ -14,6 +14,9 @@
 #include "sanitizer_common/sanitizer_placement_new.h"
 #include "sanitizer_common/sanitizer_stacktrace.h"
 #include "sanitizer_common/sanitizer_vector.h"
+#include "tsan_arbalest_clean.h"
+#include "tsan_arbalest_lazy_reset.h"
+#include "tsan_arbalest_mapping_index.h"
 #include "tsan_interface_ann.h"
 #include "tsan_report.h"
 #include "tsan_rtl.h"
@@ -63,6 +66,35 @@ class ScopedAnnotation {
 
 #define SCOPED_ANNOTATION(typ) SCOPED_ANNOTATION_RET(typ, )
 
+// Accounts a mapping event and the time spent on it (arbalest_stats).
+class ScopedMappingStats {
+ public:
+  ScopedMappingStats(ThreadState *thr, u8 optype) : thr_(thr), start_ns_(0) {
+    if (LIKELY(!arbalest_stats_enabled))
+      return;
+    start_ns_ = MonotonicNanoTime();
+    ArbalestStats &s = thr->arbalest_stats;
+    s.val[ArbalestStatMapTo] += !!(optype & ompt_device_mem_flag_to);
+    s.val[ArbalestStatMapFrom] += !!(optype & ompt_device_mem_flag_from);
+    s.val[ArbalestStatMapAlloc] += !!(optype & ompt_device_mem_flag_alloc);
+    s.val[ArbalestStatMapRelease] += !!(optype & ompt_device_mem_flag_release);
+    s.val[ArbalestStatMapAssociate] +=
+        !!(optype & ompt_device_mem_flag_associate);
+    s.val[ArbalestStatMapDisassociate] +=
+        !!(optype & ompt_device_mem_flag_disassociate);
+  }
+
+  ~ScopedMappingStats() {
+    if (start_ns_)
+      thr_->arbalest_stats.val[ArbalestStatMappingNs] +=
+          MonotonicNanoTime() - start_ns_;
+  }
+
+ private:
+  ThreadState *const thr_;
+  u64 start_ns_;
+};
+
 static const int kMaxDescLen = 128;
 
 struct ExpectRace {
@@ -166,6 +198,38 @@ void INTERFACE_ATTRIBUTE AnnotateHappensAfter(char *f, int l, uptr addr) {
   Acquire(thr, pc, addr);
 }
 
+// All threads arriving at the barrier happen before all threads departing it.
+void INTERFACE_ATTRIBUTE AnnotateBarrierArrive(char *f, int l, uptr addr) {
+  SCOPED_ANNOTATION(AnnotateBarrierArrive);
+  BarrierArrive(thr, pc, addr);
+}
+
+void INTERFACE_ATTRIBUTE AnnotateBarrierDepart(char *f, int l, uptr addr) {
+  SCOPED_ANNOTATION(AnnotateBarrierDepart);
+  BarrierDepart(thr, pc, addr);
+}
+
+// Explicit sync objects, see SyncHandle.
+u32 INTERFACE_ATTRIBUTE AnnotateSyncCreate(char *f, int l) {
+  SCOPED_ANNOTATION_RET(AnnotateSyncCreate, 0);
+  return SyncHandleCreate(thr);
+}
+
+void INTERFACE_ATTRIBUTE AnnotateSyncDestroy(char *f, int l, u32 handle) {
+  SCOPED_ANNOTATION(AnnotateSyncDestroy);
+  SyncHandleDestroy(thr, handle);
+}
+
+void INTERFACE_ATTRIBUTE AnnotateSyncRelease(char *f, int l, u32 handle) {
+  SCOPED_ANNOTATION(AnnotateSyncRelease);
+  SyncHandleRelease(thr, pc, handle);
+}
+
+void INTERFACE_ATTRIBUTE AnnotateSyncAcquire(char *f, int l, u32 handle) {
+  SCOPED_ANNOTATION(AnnotateSyncAcquire);
+  SyncHandleAcquire(thr, pc, handle);
+}
+
 void INTERFACE_ATTRIBUTE AnnotateCondVarSignal(char *f, int l, uptr cv) {
 }
 
@@ -360,11 +424,20 @@ void INTERFACE_ATTRIBUTE AnnotateMapping(const void *host_addr,
                                          const char *var_name) {
   SCOPED_ANNOTATION(AnnotateMapping);
 
+  if (ArbalestRecording()) {
+    ArbalestRecordMapping(thr, reinterpret_cast<uptr>(codeptr),
+                          reinterpret_cast<uptr>(host_addr),
+                          reinterpret_cast<uptr>(target_addr), bytes, optype);
+    return;
+  }
+  ScopedMappingStats mapping_stats(thr, optype);
+
   // FIXME: Shall we always assume src is host?
   const Interval host = {reinterpret_cast<uptr>(host_addr), reinterpret_cast<uptr>(host_addr) + bytes};
   const Interval target = {reinterpret_cast<uptr>(target_addr), reinterpret_cast<uptr>(target_addr) + bytes};
-  const MapInfo mh = {reinterpret_cast<uptr>(host_addr), bytes, var_name};
-  const MapInfo mt = {reinterpret_cast<uptr>(target_addr), bytes, var_name};
+  const u32 var_id = ctx->var_descs.Intern(var_name);
+  const MapInfo mh = {reinterpret_cast<uptr>(host_addr), bytes, var_id};
+  const MapInfo mt = {reinterpret_cast<uptr>(target_addr), bytes, var_id};
   ASSERT(IsAppMem(host.left_end) && IsAppMem(host.right_end - 1),
          "[%p, %p] does not fall into app mem section \n",
          reinterpret_cast<char *>(host.left_end),
@@ -373,13 +446,21 @@ void INTERFACE_ATTRIBUTE AnnotateMapping(const void *host_addr,
   
   }
 
+  // Device addresses are translated with the mapping indices of libomptarget
+  // once they are attached, t_to_h is left alone then.
+  bool use_t_to_h = !ArbalestHasMappingIndex();
+
   if (optype & ompt_device_mem_flag_associate) {
     bool a = ctx->h_to_t.insert(host, mt);
-    bool b = ctx->t_to_h.insert(target, mh);
+    if (a)
+      ArbalestRegisterGlobal(host.left_end);
+    bool b = !use_t_to_h || ctx->t_to_h.insert(target, mh);
 
     // check if already exists, if exists, delete all nodes 
     // within range and add new nodes.
     if (!a) {
+      ArbalestDropDeviceResets(host);
+      ArbalestInvalidateHostClean(host);
       ctx->h_to_t.removeAllNodesWithinRange(host);
       ctx->h_to_t.insert(host, mt);
     }
@@ -388,8 +469,9 @@ void INTERFACE_ATTRIBUTE AnnotateMapping(const void *host_addr,
     // the mapping info update-to-date
     ASSERT(b, "[associate] Device address %p is already involved in a mapping \n",
            target_addr);
+    BindVsmToAppNode(host.left_end, bytes);
     if (!(optype & ompt_device_mem_flag_to)) {
-      VsmRangeDeviceReset(host.left_end, bytes);
+      ArbalestDeviceReset(host.left_end, bytes);
     }
   }
 
@@ -397,29 +479,41 @@ void INTERFACE_ATTRIBUTE AnnotateMapping(const void *host_addr,
     Node mapping = {target, mh};
     CheckMappingBound(thr, reinterpret_cast<uptr>(codeptr), &mapping);
 
-    Node *n = ctx->t_to_h.find(target);
+    Node *n = use_t_to_h ? ctx->t_to_h.find(target) : &mapping;
     ASSERT(n,
            "[to] Device address [%p, %p] does not involve in any "
            "mapping \n",
            reinterpret_cast<char *>(target.left_end),
            reinterpret_cast<char *>(target.right_end));
-    VsmRangeUpdateMapTo(host.left_end, bytes);
+    ArbalestMapTo(host.left_end, bytes);
   }
 
   if (optype & ompt_device_mem_flag_from) {
     Node mapping = {target, mh};
     CheckMappingBound(thr, reinterpret_cast<uptr>(codeptr), &mapping);
 
-    Node *n = ctx->t_to_h.find(target);
+    Node *n = use_t_to_h ? ctx->t_to_h.find(target) : &mapping;
     ASSERT(n,
            "[from] Device address [%p, %p] does not involve in any "
            "mapping \n",
            reinterpret_cast<char *>(target.left_end),
            reinterpret_cast<char *>(target.right_end));
-    VsmRangeUpdateMapFrom(host.left_end, bytes);
+    ArbalestMapFrom(host.left_end, bytes);
+    ArbalestInvalidateHostClean(host);
   }
 
+  // A pending device reset is dropped with its mapping, the device bits of
+  // host memory that is not mapped are never checked. The host memory of the
+  // mapping must not be written while it is disassociated. Such a write
+  // races with the end of the mapping, whose copy back writes the same
+  // memory; the runtime orders neither of them. A write lost by the release
+  // would at worst report a later read of it as uninitialized.
   if (optype & ompt_device_mem_flag_disassociate) {
+    ArbalestDropDeviceResets(host);
+    VsmReleaseEmptyPages(host.left_end, bytes);
+  }
+
+  if ((optype & ompt_device_mem_flag_disassociate) && use_t_to_h) {
     Node *n = ctx->t_to_h.find(target);
     ASSERT(n,
            "[disassociate] Device address [%p, %p] does not involve in any "
@@ -493,6 +587,11 @@ AnnotateArbalestVerboseMode(bool is_verbose) {
   ctx->arbalest_verbose = is_verbose;
 }
 
+void INTERFACE_ATTRIBUTE
+AnnotateArbalestIgnoreTarget(bool ignore) {
+  ctx->arbalest_ignore_target = ignore;
+}
+
 void INTERFACE_ATTRIBUTE
 AnnotatePrintf(const char *str) {
   Printf("%s\n", str);
@@ -502,13 +601,34 @@ void INTERFACE_ATTRIBUTE
 AnnotateEnterTargetRegion() {
   SCOPED_ANNOTATION(AnnotateEnterTargetRegion);
   thr->is_on_target = true;
+  // Archer also calls this when it switches to a task of a target region, so
+  // the ignore is entered only once.
+  if (ctx->arbalest_ignore_target && !thr->target_ignored) {
+    ThreadIgnoreBegin(thr, pc);
+    thr->target_ignored = true;
+  }
+  if (ArbalestRecording())
+    ArbalestRecordBreakRun(thr);
 }
 
 
+void INTERFACE_ATTRIBUTE
+AnnotateTargetMappingIndex(int device_num, void *index) {
+  if (index)
+    ArbalestAttachMappingIndex(device_num,
+                               static_cast<ArbalestMappingIndex *>(index));
+}
+
 void INTERFACE_ATTRIBUTE
 AnnotateExitTargetRegion() {
   SCOPED_ANNOTATION(AnnotateExitTargetRegion)
   thr->is_on_target = false;
+  if (thr->target_ignored) {
+    ThreadIgnoreEnd(thr);
+    thr->target_ignored = false;
+  }
+  if (ArbalestRecording())
+    ArbalestRecordBreakRun(thr);
 }
 
 void INTERFACE_ATTRIBUTE AnnotateEnterRuntime() {
@@ -28,6 +28,7 @@ struct MapUnmapCallback {
     // We are about to unmap a chunk of user memory.
     // Mark the corresponding shadow memory as not needed.
     DontNeedShadowFor(p, size);
+    VsmReleaseRange(p, size);
     // Mark the corresponding meta shadow memory as not needed.
     // Note the block does not contain any meta info at this point
     // (this happens after free).
@@ -272,13 +273,25 @@ void OnUserFree(ThreadState *thr, uptr pc, uptr p, bool write) {
   CHECK_NE(p, (void*)0);
   if (!thr->slot) {
     // Very early/late in thread lifetime, or during fork.
-    UNUSED uptr sz = ctx->metamap.FreeBlock(thr->proc(), p, false);
+    bool bounds_checked = false, barrier = false;
+    uptr sz = ctx->metamap.FreeBlock(thr->proc(), p, false, &bounds_checked,
+                                     &barrier);
     DPrintf("#%d: free(0x%zx, %zu) (no slot)\n", thr->tid, p, sz);
+    if (UNLIKELY(bounds_checked))
+      MappingBoundsFreed(p, sz);
+    if (UNLIKELY(barrier))
+      BarriersFreed(p, sz);
     return;
   }
   SlotLocker locker(thr);
-  uptr sz = ctx->metamap.FreeBlock(thr->proc(), p, true);
+  bool bounds_checked = false, barrier = false;
+  uptr sz = ctx->metamap.FreeBlock(thr->proc(), p, true, &bounds_checked,
+                                   &barrier);
   DPrintf("#%d: free(0x%zx, %zu)\n", thr->tid, p, sz);
+  if (UNLIKELY(bounds_checked))
+    MappingBoundsFreed(p, sz);
+  if (UNLIKELY(barrier))
+    BarriersFreed(p, sz);
   if (write && thr->ignore_reads_and_writes == 0)
     MemoryRangeFreed(thr, pc, (uptr)p, sz);
 }
@@ -916,6 +916,17 @@ void InitializePlatform();
 void InitializePlatformEarly();
 void CheckAndProtect();
 void InitializeShadowMemoryPlatform();
+// Maps [addr, addr + size) of the VSM region again (which zeroes it) with the
+// page size and NUMA policy selected by the arbalest_vsm_* flags. addr and
+// size must be aligned with VsmPageSize().
+bool RemapVsmRange(uptr addr, uptr size);
+uptr VsmPageSize();
+// With arbalest_vsm_numa=2, moves the VSM of [addr, addr + size) to the NUMA
+// node of the application page at addr for the pages faulted from now on.
+void BindVsmToAppNode(uptr addr, uptr size);
+// Sets vec[i] to non-zero if the base page at addr + i * GetPageSizeCached()
+// of the VSM is resident, see mincore(2). Returns false if that is unknown.
+bool VsmPagesResident(uptr addr, uptr size, u8 *vec);
 void WriteMemoryProfile(char *buf, uptr buf_size, u64 uptime_ns);
 int ExtractResolvFDs(void *state, int *fds, int nfd);
 int ExtractRecvmsgFDs(void *msg, int *fds, int nfd);
@@ -92,6 +92,7 @@ enum {
   MemTotal,
   MemShadow,
   MemMeta,
+  MemVsm,
   MemFile,
   MemMmap,
   MemHeap,
@@ -105,6 +106,8 @@ void FillProfileCallback(uptr p, uptr rss, bool file, uptr *mem) {
     mem[MemShadow] += rss;
   else if (p >= MetaShadowBeg() && p < MetaShadowEnd())
     mem[MemMeta] += rss;
+  else if (p >= VsmBeg() && p < VsmEnd())
+    mem[MemVsm] += rss;
   else if ((p >= LoAppMemBeg() && p < LoAppMemEnd()) ||
            (p >= MidAppMemBeg() && p < MidAppMemEnd()) ||
            (p >= HiAppMemBeg() && p < HiAppMemEnd()))
@@ -131,21 +134,25 @@ void WriteMemoryProfile(char *buf, uptr buf_size, u64 uptime_ns) {
   uptr internal_stats[AllocatorStatCount];
   internal_allocator()->GetStats(internal_stats);
   // All these are allocated from the common mmap region.
-  mem[MemMmap] -= meta.mem_block + meta.sync_obj + trace_mem +
-                  stacks.allocated + internal_stats[AllocatorStatMapped];
+  mem[MemMmap] -= meta.mem_block + meta.sync_obj + meta.sync_handle +
+                  trace_mem + stacks.allocated +
+                  internal_stats[AllocatorStatMapped];
   if (s64(mem[MemMmap]) < 0)
     mem[MemMmap] = 0;
   internal_snprintf(
       buf, buf_size,
-      "==%zu== %llus [%zu]: RSS %zd MB: shadow:%zd meta:%zd file:%zd"
+      "==%zu== %llus [%zu]: RSS %zd MB: shadow:%zd meta:%zd vsm:%zd file:%zd"
       " mmap:%zd heap:%zd other:%zd intalloc:%zd memblocks:%zd syncobj:%zu"
-      " trace:%zu stacks=%zd threads=%zu/%zu\n",
+      " synchandle:%zu trace:%zu stacks=%zd threads=%zu/%zu vsm_released:%llu"
+      " mappings=%u/%u/%u\n",
       internal_getpid(), uptime_ns / (1000 * 1000 * 1000), ctx->global_epoch,
       mem[MemTotal] >> 20, mem[MemShadow] >> 20, mem[MemMeta] >> 20,
-      mem[MemFile] >> 20, mem[MemMmap] >> 20, mem[MemHeap] >> 20,
-      mem[MemOther] >> 20, internal_stats[AllocatorStatMapped] >> 20,
-      meta.mem_block >> 20, meta.sync_obj >> 20, trace_mem >> 20,
-      stacks.allocated >> 20, nlive, nthread);
+      mem[MemVsm] >> 20, mem[MemFile] >> 20, mem[MemMmap] >> 20,
+      mem[MemHeap] >> 20, mem[MemOther] >> 20,
+      internal_stats[AllocatorStatMapped] >> 20, meta.mem_block >> 20,
+      meta.sync_obj >> 20, meta.sync_handle >> 20, trace_mem >> 20, stacks.allocated >> 20, nlive,
+      nthread, atomic_load_relaxed(&vsm_released_bytes) >> 20,
+      ctx->h_to_t.size, ctx->t_to_h.size, ctx->globals.size);
 }
 
 
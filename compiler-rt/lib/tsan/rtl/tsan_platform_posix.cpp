@@ -15,11 +15,17 @@
 #if SANITIZER_POSIX
 
 #  include <dlfcn.h>
+#  include <sys/mman.h>
+
+#  if SANITIZER_LINUX
+#    include "sanitizer_common/sanitizer_linux.h"
+#  endif
 
 #  include "sanitizer_common/sanitizer_common.h"
 #  include "sanitizer_common/sanitizer_errno.h"
 #  include "sanitizer_common/sanitizer_libc.h"
 #  include "sanitizer_common/sanitizer_procmaps.h"
+#  include "tsan_flags.h"
 #  include "tsan_platform.h"
 #  include "tsan_rtl.h"
 
@@ -42,6 +48,183 @@ static void DontDumpShadow(uptr addr, uptr size) {
     }
 }
 
+enum VsmHugePages { kVsmShadowPages, kVsmTransparentHuge, kVsmHugeTlb };
+enum VsmNuma { kVsmFirstTouch, kVsmInterleave, kVsmFollowApp };
+
+// Huge pages of hugetlbfs, the default size on x86_64 and aarch64.
+static const uptr kVsmHugeTlbPageSize = 2 << 20;
+
+static int vsm_huge_pages;
+static uptr vsm_page_size;
+
+uptr VsmPageSize() { return vsm_page_size; }
+
+static bool MapVsm(uptr addr, uptr size, const char *name) {
+  switch (vsm_huge_pages) {
+#    if defined(MAP_HUGETLB)
+    case kVsmHugeTlb: {
+      uptr p = internal_mmap(
+          reinterpret_cast<void *>(addr), size, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANON | MAP_FIXED | MAP_NORESERVE | MAP_HUGETLB,
+          -1, 0);
+      int err;
+      if (internal_iserror(p, &err)) {
+        Report("ThreadSanitizer: can not map the VSM with hugetlbfs pages "
+               "(errno: %d)\n", err);
+        return false;
+      }
+      IncreaseTotalMmap(size);
+      return true;
+    }
+#    endif
+#    if defined(MADV_HUGEPAGE)
+    case kVsmTransparentHuge:
+      if (!MmapFixedNoReserve(addr, size, name))
+        return false;
+      internal_madvise(addr, size, MADV_HUGEPAGE);
+      return true;
+#    endif
+    default:
+      return MmapFixedSuperNoReserve(addr, size, name);
+  }
+}
+
+#    if defined(MAP_HUGETLB)
+// A MAP_NORESERVE mapping of hugetlbfs pages succeeds even if the pool is
+// empty and raises SIGBUS on the first touch. Reserve and touch a page
+// without MAP_NORESERVE to find out whether the pool has any.
+static bool CanMapHugeTlbPage() {
+  uptr p = internal_mmap(nullptr, kVsmHugeTlbPageSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, -1, 0);
+  if (internal_iserror(p))
+    return false;
+  *reinterpret_cast<volatile u8 *>(p) = 1;
+  internal_munmap(reinterpret_cast<void *>(p), kVsmHugeTlbPageSize);
+  return true;
+}
+#    else
+static bool CanMapHugeTlbPage() { return false; }
+#    endif
+
+#    if SANITIZER_LINUX
+// Memory policies of mbind(2).
+static const int kMpolPreferred = 1;
+static const int kMpolInterleave = 3;
+static const unsigned kMpolFNode = 1;
+static const unsigned kMpolFAddr = 2;
+static const unsigned kMpolFMemsAllowed = 4;
+static const uptr kMaxNumaNodes = 64;
+
+// Reported once, the placement is lost for the rest of the VSM as well.
+static void ReportNumaPolicyError(uptr addr, uptr size, int err) {
+  static atomic_uint8_t reported;
+  if (!atomic_exchange(&reported, 1, memory_order_relaxed))
+    Report("ThreadSanitizer: can not set the NUMA policy of the VSM [%zx, %zx) "
+           "(errno: %d), arbalest_vsm_numa has no effect\n",
+           addr, addr + size, err);
+}
+
+// nodes must only hold nodes that exist. maxnode counts one more than the
+// bits of the mask that the kernel reads, see mbind(2).
+static void SetVsmNumaPolicy(uptr addr, uptr size, int mode, u64 nodes) {
+  uptr mask = nodes;
+  uptr maxnode = MostSignificantSetBitIndex(nodes) + 2;
+  int err;
+  if (internal_iserror(internal_mbind(addr, size, mode, &mask, maxnode, 0),
+                       &err))
+    ReportNumaPolicyError(addr, size, err);
+}
+
+// Interleaves the VSM range over the nodes the process may allocate on.
+static void InterleaveVsm(uptr addr, uptr size) {
+  uptr nodes = 0;
+  int mode, err;
+  if (internal_iserror(internal_get_mempolicy(&mode, &nodes, kMaxNumaNodes + 1,
+                                              0, kMpolFMemsAllowed),
+                       &err)) {
+    ReportNumaPolicyError(addr, size, err);
+    return;
+  }
+  if (nodes)
+    SetVsmNumaPolicy(addr, size, kMpolInterleave, nodes);
+}
+
+// Prefers the node of the application page at app for the VSM range.
+static void FollowAppNode(uptr addr, uptr size, uptr app) {
+  int node;
+  if (internal_iserror(internal_get_mempolicy(&node, nullptr, 0, app,
+                                              kMpolFNode | kMpolFAddr)) ||
+      node < 0 || static_cast<uptr>(node) >= kMaxNumaNodes)
+    return;
+  SetVsmNumaPolicy(addr, size, kMpolPreferred, 1ull << node);
+}
+#    endif
+
+bool RemapVsmRange(uptr addr, uptr size) {
+  if (!MapVsm(addr, size, "variable state machine"))
+    return false;
+#    if SANITIZER_LINUX
+  // A new mapping does not inherit the policy of the old one.
+  if (flags()->arbalest_vsm_numa == kVsmInterleave)
+    InterleaveVsm(addr, size);
+  else if (flags()->arbalest_vsm_numa == kVsmFollowApp)
+    FollowAppNode(addr, size, VsmToMem(reinterpret_cast<RawVsm *>(addr)));
+#    endif
+  return true;
+}
+
+void BindVsmToAppNode(uptr addr, uptr size) {
+#    if SANITIZER_LINUX
+  if (flags()->arbalest_vsm_numa != kVsmFollowApp || !size)
+    return;
+  // Only the VSM pages inside the range, the pages at its ends may hold the
+  // state of neighbouring memory.
+  uptr beg = RoundUpTo(reinterpret_cast<uptr>(MemToVsm(addr)), vsm_page_size);
+  uptr end = RoundDownTo(reinterpret_cast<uptr>(MemToVsm(addr + size - 1)) + 1,
+                         vsm_page_size);
+  if (beg < end)
+    FollowAppNode(beg, end - beg, addr);
+#    endif
+}
+
+bool VsmPagesResident(uptr addr, uptr size, u8 *vec) {
+#    if SANITIZER_LINUX
+  return !internal_iserror(internal_mincore(addr, size, vec));
+#    else
+  return false;
+#    endif
+}
+
+static void InitializeVsmMemory() {
+  vsm_huge_pages = flags()->arbalest_vsm_huge_pages;
+  vsm_page_size = vsm_huge_pages == kVsmHugeTlb ? kVsmHugeTlbPageSize
+                                                 : GetPageSizeCached();
+  bool mapped = false;
+  if (vsm_huge_pages == kVsmHugeTlb && !CanMapHugeTlbPage())
+    Report("ThreadSanitizer: no free hugetlbfs pages for the VSM\n");
+  else
+    mapped = MapVsm(VsmBeg(), VsmEnd() - VsmBeg(), "variable state machine");
+  if (!mapped && vsm_huge_pages == kVsmHugeTlb) {
+    Report("ThreadSanitizer: falling back to transparent huge pages for the "
+           "VSM\n");
+    vsm_huge_pages = kVsmTransparentHuge;
+    vsm_page_size = GetPageSizeCached();
+    mapped = MapVsm(VsmBeg(), VsmEnd() - VsmBeg(), "variable state machine");
+  }
+  if (!mapped) {
+    Printf("FATAL: ThreadSanitizer can not mmap the variable state machine \n");
+    Printf("FATAL: Make sure to compile with -fPIE and to link with -pie.\n");
+    Die();
+  }
+  DontDumpShadow(VsmBeg(), VsmEnd() - VsmBeg());
+#    if SANITIZER_LINUX
+  // Following the application pages happens per mapping, see
+  // BindVsmToAppNode.
+  if (flags()->arbalest_vsm_numa == kVsmInterleave)
+    SetVsmNumaPolicy(VsmBeg(), VsmEnd() - VsmBeg(), kMpolInterleave, ~0ull);
+#    endif
+}
+
 void InitializeShadowMemory() {
   // Map memory shadow.
   if (!MmapFixedSuperNoReserve(ShadowBeg(), ShadowEnd() - ShadowBeg(),
@@ -72,12 +255,7 @@ void InitializeShadowMemory() {
       meta, meta + meta_size, meta_size >> 30);
 
   Printf("Reserve additional space for Arbalest\n");
-  if (!MmapFixedSuperNoReserve(VsmBeg(), VsmEnd() - VsmBeg(), "variable state machine")) {
-    Printf("FATAL: ThreadSanitizer can not mmap the variable state machine \n");
-    Printf("FATAL: Make sure to compile with -fPIE and to link with -pie.\n");
-    Die();
-  }
-  DontDumpShadow(VsmBeg(), VsmEnd() - VsmBeg());
+  InitializeVsmMemory();
   
   InitializeShadowMemoryPlatform();
 
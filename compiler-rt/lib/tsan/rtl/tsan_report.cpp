@@ -311,7 +311,7 @@ void PrintReport(const ThreadState *thr, const ReportDesc *rep) {
   Printf("%s", d.Warning());
   Printf("WARNING: ThreadSanitizer: %s (pid=%d) %s \n", rep_typ_str,
          (int)internal_getpid(),
-         thr->is_on_target ? "on the target" : "on the host");
+         rep->on_target ? "on the target" : "on the host");
   Printf("%s", d.Default());
 
   if (rep->typ == ReportTypeErrnoInSignal)
@@ -371,6 +371,10 @@ void PrintReport(const ThreadState *thr, const ReportDesc *rep) {
       Printf("  Variable/array involved in data inconsistency: %s\n\n", rep->loc_desc);
       Printf("%s", d.Default());
     }
+    if (rep->arbalest_sample > 1)
+      Printf("  Note: only 1 of every %d reads was checked (sampling), "
+             "other inconsistent reads may be unreported.\n\n",
+             rep->arbalest_sample);
   }
 
   if (rep->typ != ReportTypeDeadlock) {
@@ -381,6 +385,10 @@ void PrintReport(const ThreadState *thr, const ReportDesc *rep) {
   for (uptr i = 0; i < rep->threads.Size(); i++)
     PrintThread(rep->threads[i]);
 
+  if (rep->omitted_threads)
+    Printf("  And %d more threads, not recorded for the report thread.\n\n",
+           rep->omitted_threads);
+
   if (rep->typ == ReportTypeThreadLeak && rep->count > 1)
     Printf("  And %d more similar thread leaks.\n\n", rep->count - 1);
 
@@ -113,6 +113,9 @@ class ReportDesc {
   ReportStack *sleep;
   int count;
   int signum = 0;
+  int arbalest_sample = 0;  // read check sampling active for the report
+  bool on_target = false;   // the reporting access ran in a target region
+  int omitted_threads = 0;  // threads that did not fit into a queued report
 
   ReportDesc();
   ~ReportDesc();
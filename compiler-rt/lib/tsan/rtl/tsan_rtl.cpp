@@ -21,6 +21,8 @@
 #include "sanitizer_common/sanitizer_placement_new.h"
 #include "sanitizer_common/sanitizer_stackdepot.h"
 #include "sanitizer_common/sanitizer_symbolizer.h"
+#include "tsan_arbalest_async_report.h"
+#include "tsan_arbalest_report_sink.h"
 #include "tsan_defs.h"
 #include "tsan_interface.h"
 #include "tsan_mman.h"
@@ -232,6 +234,7 @@ static void DoResetImpl(uptr epoch) {
   }
   DPrintf("Resetting meta shadow...\n");
   ctx->metamap.ResetClocks();
+  ResetBarrierClocks();
   StoreShadow(&ctx->last_spurious_race, Shadow::kEmpty);
   ctx->resetting = false;
 }
@@ -404,7 +407,8 @@ Context::Context()
       resetting(), 
       t_to_h(),
       h_to_t(),
-      arbalest_verbose(false) {
+      arbalest_verbose(false),
+      arbalest_ignore_target(false) {
   fired_suppressions.reserve(8);
   for (uptr i = 0; i < ARRAY_SIZE(slots); i++) {
     TidSlot* slot = &slots[i];
@@ -583,6 +587,7 @@ void UnmapShadow(ThreadState *thr, uptr addr, uptr size) {
   if (size == 0 || !IsValidMmapRange(addr, size))
     return;
   DontNeedShadowFor(addr, size);
+  VsmReleaseRange(addr, size);
   ScopedGlobalProcessor sgp;
   SlotLocker locker(thr, true);
   ctx->metamap.ResetRange(thr->proc(), addr, size, true);
@@ -693,6 +698,8 @@ bool is_initialized;
 
 bool arbalest_enabled;
 
+int arbalest_check_sample;
+
 void Initialize(ThreadState *thr) {
   // Thread safe because done before all threads exist.
   if (is_initialized)
@@ -753,6 +760,11 @@ void Initialize(ThreadState *thr) {
   Symbolizer::LateInitialize();
   if (InitializeMemoryProfiler() || flags()->force_background_thread)
     MaybeSpawnBackgroundThread();
+  ArbalestRecordInit();
+  ArbalestReportSinkInit();
+  ArbalestStatsInit();
+  ctx->arbalest_ignore_target = flags()->arbalest_ignore_target;
+  arbalest_check_sample = flags()->arbalest_check_sample;
 #endif
   ctx->initialized = true;
 
@@ -791,11 +803,19 @@ int Finalize(ThreadState *thr) {
   if (flags()->atexit_sleep_ms > 0 && ThreadCount(thr) > 1)
     internal_usleep(u64(flags()->atexit_sleep_ms) * 1000);
 
+  // Wait for pending reports.
+  ArbalestFlushReports();
   {
-    // Wait for pending reports.
     ScopedErrorReportLock lock;
   }
 
+#if !SANITIZER_GO
+  ArbalestRecordFinalize();
+  ArbalestReportSinkFinalize();
+  if (arbalest_stats_enabled)
+    ArbalestPrintStats();
+#endif
+
 #if !SANITIZER_GO
   if (Verbosity()) AllocatorPrintStats();
 #endif
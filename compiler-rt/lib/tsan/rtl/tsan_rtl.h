@@ -48,6 +48,11 @@
 #include "tsan_trace.h"
 #include "tsan_vector_clock.h"
 #include "tsan_avltree.h"
+#include "tsan_arbalest_clean.h"
+#include "tsan_arbalest_lazy_reset.h"
+#include "tsan_arbalest_record.h"
+#include "tsan_arbalest_stats.h"
+#include "tsan_arbalest_var_desc.h"
 
 #if SANITIZER_WORDSIZE != 64
 # error "ThreadSanitizer is supported only on 64-bit platforms"
@@ -118,6 +123,7 @@ struct Processor {
 #endif
   DenseSlabAllocCache block_cache;
   DenseSlabAllocCache sync_cache;
+  DenseSlabAllocCache handle_cache;
   DDPhysicalThread *dd_pt;
 };
 
@@ -233,9 +239,23 @@ struct ThreadState {
   const ReportDesc *current_report;
 
   bool is_on_target;
+  // Memory accesses are ignored while on target, see arbalest_ignore_target.
+  bool target_ignored;
 
   bool is_in_runtime;
 
+  ArbalestRecordState arbalest_record;
+
+  ArbalestStats arbalest_stats;
+
+  // Read check sampling, see ArbalestSkipCheck. 0 uses arbalest_check_sample.
+  int arbalest_sample;
+  int arbalest_sample_countdown;
+
+  ArbalestCleanCache arbalest_clean;
+
+  ArbalestLazyResetCache arbalest_lazy_reset;
+
   char str_buffer[kStrBufferSize];
 
   explicit ThreadState(Tid tid);
@@ -316,6 +336,7 @@ struct Context {
 #endif
 
   MetaMap metamap;
+  BarrierMap barriers;
 
   Mutex report_mtx;
   int nreported;
@@ -392,8 +413,10 @@ struct Context {
   IntervalTree t_to_h;
   IntervalTree h_to_t;
   IntervalTree globals;
+  ArbalestVarDescs var_descs;
   //TODO: use verbose to control output? maybe we don't need this variable
   bool arbalest_verbose;
+  bool arbalest_ignore_target;
 };
 
 extern Context *ctx;  // The one and the only global runtime context.
@@ -420,6 +443,9 @@ const char *GetObjectTypeFromTag(uptr tag);
 const char *GetReportHeaderFromTag(uptr tag);
 uptr TagFromShadowStackFrame(uptr pc);
 
+struct ArbalestReportThread;
+struct ArbalestReportLocation;
+
 class ScopedReportBase {
  public:
   void AddMemoryAccess(uptr addr, uptr external_tag, Shadow s, Tid tid,
@@ -432,13 +458,21 @@ class ScopedReportBase {
   void AddLocation(uptr addr, uptr size);
   void AddSleep(StackID stack_id);
   void AddLocationDesc(char *desc_str);
+  // Same as AddThread and AddLocation, from data copied out of the thread
+  // registry before, the registry lock is not needed.
+  void AddThread(const ArbalestReportThread &t);
+  void AddLocation(const ArbalestReportLocation &l, uptr addr);
   void SetCount(int count);
   void SetSigNum(int sig);
+  void SetArbalestSample(int rate);
+  // Reports printed by the report thread carry the state of the access.
+  void SetOnTarget(bool on_target);
+  void SetOmittedThreads(int n);
 
   const ReportDesc *GetReport() const;
 
  protected:
-  ScopedReportBase(ReportType typ, uptr tag);
+  ScopedReportBase(ReportType typ, uptr tag, bool registry_locked);
   ~ScopedReportBase();
 
  private:
@@ -453,7 +487,8 @@ class ScopedReportBase {
 
 class ScopedReport : public ScopedReportBase {
  public:
-  explicit ScopedReport(ReportType typ, uptr tag = kExternalTagNone);
+  explicit ScopedReport(ReportType typ, uptr tag = kExternalTagNone,
+                        bool registry_locked = true);
   ~ScopedReport();
 
  private:
@@ -624,6 +659,19 @@ void AcquireGlobal(ThreadState *thr);
 void Release(ThreadState *thr, uptr pc, uptr addr);
 void ReleaseStoreAcquire(ThreadState *thr, uptr pc, uptr addr);
 void ReleaseStore(ThreadState *thr, uptr pc, uptr addr);
+// Release and acquire on the barrier at addr, see BarrierSync.
+void BarrierArrive(ThreadState *thr, uptr pc, uptr addr);
+void BarrierDepart(ThreadState *thr, uptr pc, uptr addr);
+void ResetBarrierClocks();
+// Removes the barriers in the freed heap block [p, p + size), only called for
+// blocks with kMBlockBarrier set.
+void BarriersFreed(uptr p, uptr size);
+// Create, destroy, release and acquire an explicit sync handle, see
+// SyncHandle. Handle 0 is ignored.
+u32 SyncHandleCreate(ThreadState *thr);
+void SyncHandleDestroy(ThreadState *thr, u32 handle);
+void SyncHandleRelease(ThreadState *thr, uptr pc, u32 handle);
+void SyncHandleAcquire(ThreadState *thr, uptr pc, u32 handle);
 void AfterSleep(ThreadState *thr, uptr pc);
 void IncrementEpoch(ThreadState *thr);
 
@@ -694,6 +742,26 @@ ALWAYS_INLINE void ProcessPendingSignals(ThreadState *thr) {
 
 extern bool is_initialized;
 extern bool arbalest_enabled;
+// Value of the arbalest_check_sample flag.
+extern int arbalest_check_sample;
+
+ALWAYS_INLINE int ArbalestSampleRate(const ThreadState *thr) {
+  return thr->arbalest_sample ? thr->arbalest_sample : arbalest_check_sample;
+}
+
+// Whether to skip the VSM check of the current read, one of every
+// ArbalestSampleRate reads is checked.
+ALWAYS_INLINE bool ArbalestSkipCheck(ThreadState *thr) {
+  int rate = ArbalestSampleRate(thr);
+  if (LIKELY(rate <= 1))
+    return false;
+  if (--thr->arbalest_sample_countdown > 0) {
+    ArbalestStatInc(thr->arbalest_stats, ArbalestStatSampledOut);
+    return true;
+  }
+  thr->arbalest_sample_countdown = rate;
+  return false;
+}
 
 ALWAYS_INLINE
 void LazyInitialize(ThreadState *thr) {
@@ -830,6 +898,14 @@ void VsmRangeSet(uptr addr, uptr size, RawVsm val);
 void VsmRangeDeviceReset(uptr addr, uptr size);
 void VsmRangeUpdateMapTo(uptr addr, uptr size);
 void VsmRangeUpdateMapFrom(uptr addr, uptr size);
+// Releases the whole VSM pages of [addr, addr + size) to the OS, for memory
+// that goes away. VsmReleaseEmptyPages only releases the pages without host
+// state, for mappings that go away. The caller must exclude host writes to
+// the range, a write between the scan of a page and its release is lost.
+// Both are counted in vsm_released_bytes.
+void VsmReleaseRange(uptr addr, uptr size);
+void VsmReleaseEmptyPages(uptr addr, uptr size);
+extern atomic_uint64_t vsm_released_bytes;
 bool CheckVsm(ThreadState *thr, uptr pc, uptr addr, uptr size);
 bool CheckVsm16(ThreadState *thr, uptr pc, uptr addr);
 void UnalignedCheckVsm(ThreadState *thr, uptr pc, uptr addr, uptr size);
@@ -842,6 +918,12 @@ void UnalignedUpdateVsm16(ThreadState *thr, uptr addr);
 void UpdateVsmForMemoryRange(ThreadState *thr, uptr addr, uptr size);
 void CheckBound(ThreadState *thr, uptr pc, uptr base, uptr start, uptr size);
 void CheckMappingBound(ThreadState *thr, uptr pc, Node *mapping);
+// Registers the global containing addr with its symbol if it was not
+// registered by __arbalest_init, called when a host range is first mapped.
+void ArbalestRegisterGlobal(uptr addr);
+// Forgets the mapping bounds checked against the heap block [p, p + size).
+// Only called for blocks with kMBlockBoundsChecked set.
+void MappingBoundsFreed(uptr p, uptr size);
 
 #if !SANITIZER_GO
 extern void (*on_initialize)(void);
@@ -703,7 +703,8 @@ void MemoryAccessRangeT(ThreadState* thr, uptr pc, uptr addr, uptr size) {
 
   if (arbalest_enabled && !thr->is_in_runtime) {
     if (is_read) {
-      CheckVsmForMemoryRange(thr, pc, addr, size);
+      if (!ArbalestSkipCheck(thr))
+        CheckVsmForMemoryRange(thr, pc, addr, size);
     } else {
       UpdateVsmForMemoryRange(thr, addr, size);
     }
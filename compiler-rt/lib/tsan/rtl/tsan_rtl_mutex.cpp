@@ -11,6 +11,7 @@
 //===----------------------------------------------------------------------===//
 
 #include <sanitizer_common/sanitizer_deadlock_detector_interface.h>
+#include <sanitizer_common/sanitizer_placement_new.h>
 #include <sanitizer_common/sanitizer_stackdepot.h>
 
 #include "tsan_rtl.h"
@@ -473,6 +474,135 @@ void Release(ThreadState *thr, uptr pc, uptr addr) {
   IncrementEpoch(thr);
 }
 
+// Marks the heap block of the barrier at addr, so that only its free looks
+// for barriers to remove.
+static void MarkBarrierBlock(uptr addr) {
+  void *p = reinterpret_cast<void *>(addr);
+  if (!allocator()->PointerIsMine(p))
+    return;
+  uptr begin = reinterpret_cast<uptr>(allocator()->GetBlockBegin(p));
+  if (MBlock *b = begin ? ctx->metamap.GetBlock(begin) : nullptr)
+    b->SetArbalestFlag(kMBlockBarrier);
+}
+
+static BarrierSync *GetBarrier(uptr addr, bool create) {
+  BarrierMap::Handle h(&ctx->barriers, addr, false, create);
+  if (h.created()) {
+    *h = New<BarrierSync>();
+    MarkBarrierBlock(addr);
+  }
+  return h.exists() ? *h : nullptr;
+}
+
+void BarrierArrive(ThreadState *thr, uptr pc, uptr addr) {
+  DPrintf("#%d: BarrierArrive %zx\n", thr->tid, addr);
+  if (thr->ignore_sync)
+    return;
+  SlotLocker locker(thr);
+  {
+    BarrierSync *b = GetBarrier(addr, true);
+    if (atomic_load(&b->departed, memory_order_acquire)) {
+      // The first arrival of a new episode.
+      Lock lock(&b->mtx);
+      if (atomic_load_relaxed(&b->departed)) {
+        b->Reset();
+        atomic_store(&b->departed, 0, memory_order_release);
+      }
+    }
+    auto g = &b->groups[static_cast<u8>(thr->fast_state.sid()) %
+                        BarrierSync::kGroups];
+    Lock lock(&g->mtx);
+    g->clock.Acquire(&thr->clock);
+  }
+  IncrementEpoch(thr);
+}
+
+void BarrierDepart(ThreadState *thr, uptr pc, uptr addr) {
+  DPrintf("#%d: BarrierDepart %zx\n", thr->tid, addr);
+  if (thr->ignore_sync)
+    return;
+  SlotLocker locker(thr);
+  BarrierSync *b = GetBarrier(addr, false);
+  if (!b)
+    return;
+  if (!atomic_load(&b->departed, memory_order_acquire)) {
+    // The first departure of the episode combines the arrivals.
+    Lock lock(&b->mtx);
+    if (!atomic_load_relaxed(&b->departed)) {
+      b->combined.Reset();
+      for (auto &g : b->groups) {
+        Lock lock(&g.mtx);
+        b->combined.Acquire(&g.clock);
+      }
+      atomic_store(&b->departed, 1, memory_order_release);
+    }
+  }
+  thr->clock.Acquire(&b->combined);
+}
+
+void ResetBarrierClocks() {
+  ctx->barriers.ForEach(
+      [](const uptr addr, BarrierSync *const &b, void *arg) {
+        b->Reset();
+        b->combined.Reset();
+        atomic_store_relaxed(&b->departed, 0);
+      },
+      nullptr);
+}
+
+void BarriersFreed(uptr p, uptr size) {
+  struct Range {
+    uptr beg, end;
+    Vector<uptr> addrs;
+  } r = {p, p + size, {}};
+  // Handles can't be taken while ForEach holds the bucket locks.
+  ctx->barriers.ForEach(
+      [](const uptr addr, BarrierSync *const &b, void *arg) {
+        Range *r = static_cast<Range *>(arg);
+        if (addr >= r->beg && addr < r->end)
+          r->addrs.PushBack(addr);
+      },
+      &r);
+  for (uptr i = 0; i < r.addrs.Size(); i++) {
+    BarrierMap::Handle h(&ctx->barriers, r.addrs[i], true);
+    if (h.exists())
+      DestroyAndFree(*h);
+  }
+}
+
+u32 SyncHandleCreate(ThreadState *thr) {
+  SlotLocker locker(thr);
+  return ctx->metamap.CreateSyncHandle(thr);
+}
+
+void SyncHandleDestroy(ThreadState *thr, u32 handle) {
+  if (handle)
+    ctx->metamap.DestroySyncHandle(thr->proc(), handle);
+}
+
+void SyncHandleRelease(ThreadState *thr, uptr pc, u32 handle) {
+  DPrintf("#%d: SyncHandleRelease %u\n", thr->tid, handle);
+  if (thr->ignore_sync || !handle)
+    return;
+  SlotLocker locker(thr);
+  {
+    SyncHandle *h = ctx->metamap.GetSyncHandle(handle);
+    Lock lock(&h->mtx);
+    h->clock.Acquire(&thr->clock);
+  }
+  IncrementEpoch(thr);
+}
+
+void SyncHandleAcquire(ThreadState *thr, uptr pc, u32 handle) {
+  DPrintf("#%d: SyncHandleAcquire %u\n", thr->tid, handle);
+  if (thr->ignore_sync || !handle)
+    return;
+  SlotLocker locker(thr);
+  SyncHandle *h = ctx->metamap.GetSyncHandle(handle);
+  ReadLock lock(&h->mtx);
+  thr->clock.Acquire(&h->clock);
+}
+
 void ReleaseStore(ThreadState *thr, uptr pc, uptr addr) {
   DPrintf("#%d: ReleaseStore %zx\n", thr->tid, addr);
   if (thr->ignore_sync)
@@ -15,6 +15,8 @@
 #include "sanitizer_common/sanitizer_stackdepot.h"
 #include "sanitizer_common/sanitizer_common.h"
 #include "sanitizer_common/sanitizer_stacktrace.h"
+#include "tsan_arbalest_async_report.h"
+#include "tsan_arbalest_report_sink.h"
 #include "tsan_platform.h"
 #include "tsan_rtl.h"
 #include "tsan_suppressions.h"
@@ -31,19 +33,6 @@ using namespace __sanitizer;
 
 static ReportStack *SymbolizeStack(StackTrace trace);
 
-static void AnalyzeVarInfo(const char *var_info, const char **var_name_end, bool *is_array) {
-  char sep = ';';
-  char array_sym = '[';
-  const char *pos = var_info;
-  while (*pos != sep) {
-    if (*pos == array_sym) {
-      *is_array = true;
-      break;
-    }
-    pos++;
-  }
-  *var_name_end = pos;
-}
 
 // Can be overriden by an application/test to intercept reports.
 #ifdef TSAN_EXTERNAL_HOOKS
@@ -169,11 +158,14 @@ bool ShouldReport(ThreadState *thr, ReportType typ) {
   }
 }
 
-ScopedReportBase::ScopedReportBase(ReportType typ, uptr tag) {
-  ctx->thread_registry.CheckLocked();
+ScopedReportBase::ScopedReportBase(ReportType typ, uptr tag,
+                                   bool registry_locked) {
+  if (registry_locked)
+    ctx->thread_registry.CheckLocked();
   rep_ = New<ReportDesc>();
   rep_->typ = typ;
   rep_->tag = tag;
+  rep_->on_target = cur_thread()->is_on_target;
   ctx->report_mtx.Lock();
 }
 
@@ -288,24 +280,18 @@ int ScopedReportBase::AddMutex(uptr addr, StackID creation_stack_id) {
   return rm->id;
 }
 
-void ScopedReportBase::AddLocation(uptr addr, uptr size) {
-  if (addr == 0)
-    return;
+// Finds the FD, heap block or thread stack/TLS that addr belongs to. Returns
+// false if there is none, the location of addr is symbolized then.
+static bool LookupLocation(uptr addr, ArbalestReportLocation *l) {
+  internal_memset(l, 0, sizeof(*l));
+  l->type = ReportLocationGlobal;
+  l->tid = kInvalidTid;
 #if !SANITIZER_GO
-  int fd = -1;
-  Tid creat_tid = kInvalidTid;
-  StackID creat_stack = 0;
-  if (FdLocation(addr, &fd, &creat_tid, &creat_stack)) {
-    auto *loc = New<ReportLocation>();
-    loc->type = ReportLocationFD;
-    loc->fd = fd;
-    loc->tid = creat_tid;
-    loc->stack = SymbolizeStackId(creat_stack);
-    rep_->locs.PushBack(loc);
-    ThreadContext *tctx = FindThreadByTidLocked(creat_tid);
-    if (tctx)
-      AddThread(tctx);
-    return;
+  if (!addr)
+    return false;
+  if (FdLocation(addr, &l->fd, &l->tid, &l->stack)) {
+    l->type = ReportLocationFD;
+    return true;
   }
   MBlock *b = 0;
   uptr block_begin = 0;
@@ -318,31 +304,88 @@ void ScopedReportBase::AddLocation(uptr addr, uptr size) {
   if (!b)
     b = JavaHeapBlock(addr, &block_begin);
   if (b != 0) {
-    auto *loc = New<ReportLocation>();
-    loc->type = ReportLocationHeap;
-    loc->heap_chunk_start = block_begin;
-    loc->heap_chunk_size = b->siz;
-    loc->external_tag = b->tag;
-    loc->tid = b->tid;
-    loc->stack = SymbolizeStackId(b->stk);
-    rep_->locs.PushBack(loc);
-    if (ThreadContext *tctx = FindThreadByTidLocked(b->tid))
-      AddThread(tctx);
-    return;
+    l->type = ReportLocationHeap;
+    l->heap_chunk_start = block_begin;
+    l->heap_chunk_size = b->siz;
+    l->external_tag = b->tag;
+    l->tid = b->tid;
+    l->stack = b->stk;
+    return true;
   }
   bool is_stack = false;
   if (ThreadContext *tctx = IsThreadStackOrTls(addr, &is_stack)) {
+    l->type = is_stack ? ReportLocationStack : ReportLocationTLS;
+    l->tid = tctx->tid;
+    return true;
+  }
+#endif
+  return false;
+}
+
+void ScopedReportBase::AddLocation(uptr addr, uptr size) {
+  if (addr == 0)
+    return;
+  ArbalestReportLocation l;
+  if (LookupLocation(addr, &l)) {
+    if (ThreadContext *tctx = FindThreadByTidLocked(l.tid))
+      AddThread(tctx);
+  }
+  AddLocation(l, addr);
+}
+
+// With print_full_thread_history, adds the parents of the threads of a
+// report, including the parents of the added threads. The report has
+// nthreads() threads, parent_tid(i) is the parent of the i-th.
+template <typename NThreads, typename ParentTid, typename Add>
+static void AddParentThreads(NThreads nthreads, ParentTid parent_tid,
+                             Add add) {
+  if (!flags()->print_full_thread_history)
+    return;
+  for (uptr i = 0; i < nthreads(); i++) {
+    Tid tid = parent_tid(i);
+    if (tid == kMainTid || tid == kInvalidTid)
+      continue;
+    add(FindThreadByTidLocked(tid));
+  }
+}
+
+void ScopedReportBase::AddThread(const ArbalestReportThread &t) {
+  for (uptr i = 0; i < rep_->threads.Size(); i++) {
+    if (rep_->threads[i]->id == t.id)
+      return;
+  }
+  auto *rt = New<ReportThread>();
+  rep_->threads.PushBack(rt);
+  rt->id = t.id;
+  rt->os_id = t.os_id;
+  rt->running = t.running;
+  rt->name = internal_strdup(t.name);
+  rt->parent_tid = t.parent_tid;
+  rt->thread_type = t.thread_type;
+  rt->stack = SymbolizeStackId(t.creation_stack);
+}
+
+void ScopedReportBase::AddLocation(const ArbalestReportLocation &l,
+                                   uptr addr) {
+  if (addr == 0)
+    return;
+  if (l.type != ReportLocationGlobal) {
     auto *loc = New<ReportLocation>();
-    loc->type = is_stack ? ReportLocationStack : ReportLocationTLS;
-    loc->tid = tctx->tid;
+    loc->type = l.type;
+    loc->heap_chunk_start = l.heap_chunk_start;
+    loc->heap_chunk_size = l.heap_chunk_size;
+    loc->external_tag = l.external_tag;
+    loc->tid = l.tid;
+    loc->fd = l.fd;
+    loc->stack = SymbolizeStackId(l.stack);
     rep_->locs.PushBack(loc);
-    AddThread(tctx);
+    // Stack and TLS locations can also be symbolized, e.g. a thread_local.
+    if (l.type != ReportLocationStack && l.type != ReportLocationTLS)
+      return;
   }
-#endif
   if (ReportLocation *loc = SymbolizeData(addr)) {
     loc->suppressable = true;
     rep_->locs.PushBack(loc);
-    return;
   }
 }
 
@@ -360,10 +403,20 @@ void ScopedReportBase::SetCount(int count) { rep_->count = count; }
 
 void ScopedReportBase::SetSigNum(int sig) { rep_->signum = sig; }
 
+void ScopedReportBase::SetArbalestSample(int rate) {
+  rep_->arbalest_sample = rate;
+}
+
+void ScopedReportBase::SetOnTarget(bool on_target) {
+  rep_->on_target = on_target;
+}
+
+void ScopedReportBase::SetOmittedThreads(int n) { rep_->omitted_threads = n; }
+
 const ReportDesc *ScopedReportBase::GetReport() const { return rep_; }
 
-ScopedReport::ScopedReport(ReportType typ, uptr tag)
-    : ScopedReportBase(typ, tag) {}
+ScopedReport::ScopedReport(ReportType typ, uptr tag, bool registry_locked)
+    : ScopedReportBase(typ, tag, registry_locked) {}
 
 ScopedReport::~ScopedReport() {}
 
@@ -852,17 +905,11 @@ void ReportRace(ThreadState *thr, RawShadow *shadow_mem, Shadow cur, Shadow old,
 
   rep.AddLocation(addr_min, addr_max - addr_min);
 
-  if (flags()->print_full_thread_history) {
-    const ReportDesc *rep_desc = rep.GetReport();
-    for (uptr i = 0; i < rep_desc->threads.Size(); i++) {
-      Tid parent_tid = rep_desc->threads[i]->parent_tid;
-      if (parent_tid == kMainTid || parent_tid == kInvalidTid)
-        continue;
-      ThreadContext *parent_tctx = static_cast<ThreadContext *>(
-          ctx->thread_registry.GetThreadLocked(parent_tid));
-      rep.AddThread(parent_tctx);
-    }
-  }
+  const ReportDesc *rep_desc = rep.GetReport();
+  AddParentThreads(
+      [&]() { return rep_desc->threads.Size(); },
+      [&](uptr i) { return rep_desc->threads[i]->parent_tid; },
+      [&](ThreadContext *tctx) { rep.AddThread(tctx); });
 
 #if !SANITIZER_GO
   if (!((typ0 | typ1) & kAccessFree) &&
@@ -872,6 +919,43 @@ void ReportRace(ThreadState *thr, RawShadow *shadow_mem, Shadow cur, Shadow old,
   OutputReport(thr, rep);
 }
 
+static void SnapshotThread(ArbalestPendingReport *r, ThreadContext *tctx) {
+  if (!tctx)
+    return;
+  for (uptr i = 0; i < r->nthreads; i++) {
+    if (r->threads[i].id == tctx->tid)
+      return;
+  }
+  if (r->nthreads == kArbalestReportMaxThreads) {
+    r->nthreads_omitted++;
+    return;
+  }
+  ArbalestReportThread &t = r->threads[r->nthreads++];
+  t.id = tctx->tid;
+  t.os_id = tctx->os_id;
+  t.running = tctx->status == ThreadStatusRunning;
+  t.thread_type = tctx->thread_type;
+  t.parent_tid = tctx->parent_tid;
+  t.creation_stack = tctx->creation_stack_id;
+  internal_strlcpy(t.name, tctx->name, sizeof(t.name));
+}
+
+// Copies what the report of r needs from the thread registry and the heap,
+// so that it can be built without the registry lock. Finds the same threads
+// and location as AddThread and AddLocation.
+static void SnapshotDMIReport(ArbalestPendingReport *r) {
+  ctx->thread_registry.CheckLocked();
+  r->nthreads = 0;
+  r->nthreads_omitted = 0;
+  SnapshotThread(r, FindThreadByTidLocked(r->tid));
+  if (LookupLocation(r->addr, &r->loc))
+    SnapshotThread(r, FindThreadByTidLocked(r->loc.tid));
+  AddParentThreads(
+      [&]() { return r->nthreads; },
+      [&](uptr i) { return r->threads[i].parent_tid; },
+      [&](ThreadContext *tctx) { SnapshotThread(r, tctx); });
+}
+
 void ReportDMI(ThreadState *thr, uptr addr, uptr size, Node *mapping, AccessType typ, DMIType dmi_typ) {
   CheckedMutex::CheckNoLocks();
 
@@ -905,8 +989,10 @@ void ReportDMI(ThreadState *thr, uptr addr, uptr size, Node *mapping, AccessType
   if (!ShouldReport(thr, rep_typ))
     return;
 
-  if (IsFiredSuppression(ctx, rep_typ, addr))
+  if (IsFiredSuppression(ctx, rep_typ, addr)) {
+    ArbalestStatInc(thr->arbalest_stats, ArbalestStatReportSuppressed);
     return;
+  }
 
   VarSizeStackTrace trace;
   Tid tid = thr->tid;
@@ -914,34 +1000,69 @@ void ReportDMI(ThreadState *thr, uptr addr, uptr size, Node *mapping, AccessType
 
   ObtainCurrentStack(thr, thr->trace_prev_pc, &trace, &tag);
   ThreadRegistryLock l(&ctx->thread_registry);
-  if (IsFiredSuppression(ctx, rep_typ, trace))
+  if (IsFiredSuppression(ctx, rep_typ, trace)) {
+    ArbalestStatInc(thr->arbalest_stats, ArbalestStatReportSuppressed);
     return;
+  }
 
-  MutexSet *mset = &thr->mset;
-
+  if (HandleDMIStack(thr, trace)) {
+    ArbalestStatInc(thr->arbalest_stats, ArbalestStatReportSuppressed);
+    return;
+  }
 
-  if (HandleDMIStack(thr, trace))
+  ArbalestPendingReport r;
+  r.typ = rep_typ;
+  r.dmi_typ = dmi_typ;
+  r.access = typ;
+  r.tid = tid;
+  r.tag = tag;
+  r.addr = addr;
+  r.size = size;
+  r.on_target = thr->is_on_target;
+  r.sample = dmi_typ == USE_OF_UNINITIALIZED_MEMORY ||
+                     dmi_typ == USE_OF_STALE_DATA
+                 ? ArbalestSampleRate(thr)
+                 : 0;
+  r.stack = kInvalidStackID;
+  r.mapping = *mapping;
+  // The mapping trees may change before a queued report is printed.
+  r.mapping.info.var_id = ArbalestVarIdOf(mapping);
+  r.mset = thr->mset;
+  SnapshotDMIReport(&r);
+  if (ArbalestQueueReport(&r, trace))
     return;
+  OutputDMIReport(thr, r, trace);
+}
 
-  ScopedReport rep(rep_typ, tag);
+void OutputDMIReport(ThreadState *thr, const ArbalestPendingReport &r,
+                     StackTrace trace) {
+  if (ArbalestWriteReport(r, trace)) {
+    ctx->nreported++;
+    if (flags()->halt_on_error)
+      Die();
+    return;
+  }
+  const Node *mapping = &r.mapping;
+  uptr addr = r.addr;
+  uptr size = r.size;
+  DMIType dmi_typ = r.dmi_typ;
+  ScopedReport rep(r.typ, r.tag, /*registry_locked=*/false);
 
-  Shadow dummy_shadow(FastState{}, addr, size, typ);
+  Shadow dummy_shadow(FastState{}, addr, size, r.access);
   
-  rep.AddMemoryAccess(addr, tag, dummy_shadow, tid, trace, mset);
+  rep.AddMemoryAccess(addr, r.tag, dummy_shadow, r.tid, trace, &r.mset);
 
-  ThreadContext *tctx = static_cast<ThreadContext *>(ctx->thread_registry.GetThreadLocked(tid));
-  rep.AddThread(tctx);
+  for (uptr i = 0; i < r.nthreads; i++)
+    rep.AddThread(r.threads[i]);
+  rep.SetOmittedThreads(r.nthreads_omitted);
 
-  rep.AddLocation(addr, size);
+  rep.AddLocation(r.loc, addr);
 
-  // data layout ";name;filename;row;col;;\0" from clang.
-  if (mapping->info.var_info) {
-    const char *var_name_start = mapping->info.var_info + 1;
-    const char *var_name_end;
-    bool is_array = false;
-    AnalyzeVarInfo(var_name_start, &var_name_end, &is_array);
-    uptr var_name_size = var_name_end - var_name_start;
-    internal_memcpy(thr->str_buffer, var_name_start, var_name_size);
+  ArbalestVarDesc var;
+  if (ArbalestGetVarDesc(mapping, &var)) {
+    uptr var_name_size = Min(
+        internal_strlcpy(thr->str_buffer, var.name, kStrBufferSize),
+        kStrBufferSize - 1);
     char *next_start = thr->str_buffer + var_name_size;
     if (dmi_typ == BUFFER_OVERFLOW_ACCESS) {
       int max_len = mapping->info.size / size;
@@ -959,7 +1080,7 @@ void ReportDMI(ThreadState *thr, uptr addr, uptr size, Node *mapping, AccessType
           "variable size: %lu, mapped section size: %lu",
           mapping->info.size, mapped_section);
     } else {
-      if (is_array) {
+      if (var.is_array) {
         int offset = (addr - mapping->interval.left_end) / size;
         internal_snprintf(next_start, kStrBufferSize - var_name_size, "[%d] (%lu-byte element)", offset, size);
       }
@@ -967,18 +1088,9 @@ void ReportDMI(ThreadState *thr, uptr addr, uptr size, Node *mapping, AccessType
     rep.AddLocationDesc(thr->str_buffer);
   }
 
-  
-  if (flags()->print_full_thread_history) {
-    const ReportDesc *rep_desc = rep.GetReport();
-    for (uptr i = 0; i < rep_desc->threads.Size(); i++) {
-      Tid parent_tid = rep_desc->threads[i]->parent_tid;
-      if (parent_tid == kMainTid || parent_tid == kInvalidTid)
-        continue;
-      ThreadContext *parent_tctx = static_cast<ThreadContext *>(
-          ctx->thread_registry.GetThreadLocked(parent_tid));
-      rep.AddThread(parent_tctx);
-    }
-  }
+  if (r.sample)
+    rep.SetArbalestSample(r.sample);
+  rep.SetOnTarget(r.on_target);
 
   OutputReport(thr, rep);
 }
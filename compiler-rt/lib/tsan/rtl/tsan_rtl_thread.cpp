@@ -272,6 +272,10 @@ void ThreadContext::OnFinished() {
   // From now on replay will use trace->final_pos.
   trace.final_pos = (Event *)atomic_load_relaxed(&thr->trace_pos);
   atomic_store_relaxed(&thr->trace_pos, 0);
+#if !SANITIZER_GO
+  ArbalestStatsMerge(thr->arbalest_stats);
+  ArbalestLazyResetCacheRelease(&thr->arbalest_lazy_reset);
+#endif
   thr->tctx = nullptr;
   thr = nullptr;
 }
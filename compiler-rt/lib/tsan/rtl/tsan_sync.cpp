@@ -41,14 +41,24 @@ void SyncVar::Reset() {
   Free(read_clock);
 }
 
+void BarrierSync::Reset() {
+  for (auto &g : groups) {
+    Lock lock(&g.mtx);
+    g.clock.Reset();
+  }
+}
+
 MetaMap::MetaMap()
-    : block_alloc_("heap block allocator"), sync_alloc_("sync allocator") {}
+    : block_alloc_("heap block allocator"),
+      sync_alloc_("sync allocator"),
+      handle_alloc_("sync handle allocator") {}
 
 void MetaMap::AllocBlock(ThreadState *thr, uptr pc, uptr p, uptr sz) {
   u32 idx = block_alloc_.Alloc(&thr->proc()->block_cache);
   MBlock *b = block_alloc_.Map(idx);
   b->siz = sz;
   b->tag = 0;
+  atomic_store_relaxed(&b->arbalest_flags, 0);
   b->tid = thr->tid;
   b->stk = CurrentStackId(thr, pc);
   u32 *meta = MemToMeta(p);
@@ -56,10 +66,16 @@ void MetaMap::AllocBlock(ThreadState *thr, uptr pc, uptr p, uptr sz) {
   *meta = idx | kFlagBlock;
 }
 
-uptr MetaMap::FreeBlock(Processor *proc, uptr p, bool reset) {
+uptr MetaMap::FreeBlock(Processor *proc, uptr p, bool reset,
+                        bool *arbalest_checked, bool *barrier) {
   MBlock* b = GetBlock(p);
   if (b == 0)
     return 0;
+  u8 bits = atomic_load_relaxed(&b->arbalest_flags);
+  if (arbalest_checked)
+    *arbalest_checked = bits & kMBlockBoundsChecked;
+  if (barrier)
+    *barrier = bits & kMBlockBarrier;
   uptr sz = RoundUpTo(b->siz, kMetaShadowCell);
   FreeRange(proc, p, sz, reset);
   return sz;
@@ -185,6 +201,8 @@ void MetaMap::ResetClocks() {
     s->last_lock.Reset();
   });
   internal_allocator()->DestroyCache(&cache);
+  // Free handles are reset too, that doesn't touch the free list links.
+  handle_alloc_.ForEach([](SyncHandle *h) { h->clock.Reset(); });
 }
 
 MBlock* MetaMap::GetBlock(uptr p) {
@@ -274,15 +292,27 @@ void MetaMap::MoveMemory(uptr src, uptr dst, uptr sz) {
   }
 }
 
+u32 MetaMap::CreateSyncHandle(ThreadState *thr) {
+  u32 idx = handle_alloc_.Alloc(&thr->proc()->handle_cache);
+  handle_alloc_.Map(idx)->clock.Reset();
+  return idx;
+}
+
+void MetaMap::DestroySyncHandle(Processor *proc, u32 handle) {
+  handle_alloc_.Free(&proc->handle_cache, handle);
+}
+
 void MetaMap::OnProcIdle(Processor *proc) {
   block_alloc_.FlushCache(&proc->block_cache);
   sync_alloc_.FlushCache(&proc->sync_cache);
+  handle_alloc_.FlushCache(&proc->handle_cache);
 }
 
 MetaMap::MemoryStats MetaMap::GetMemoryStats() const {
   MemoryStats stats;
   stats.mem_block = block_alloc_.AllocatedMemory();
   stats.sync_obj = sync_alloc_.AllocatedMemory();
+  stats.sync_handle = handle_alloc_.AllocatedMemory();
   return stats;
 }
 
@@ -12,6 +12,7 @@
 #ifndef TSAN_SYNC_H
 #define TSAN_SYNC_H
 
+#include "sanitizer_common/sanitizer_addrhashmap.h"
 #include "sanitizer_common/sanitizer_atomic.h"
 #include "sanitizer_common/sanitizer_common.h"
 #include "sanitizer_common/sanitizer_deadlock_detector_interface.h"
@@ -88,6 +89,43 @@ struct SyncVar {
   }
 };
 
+// BarrierSync is a descriptor of a barrier annotated with BarrierArrive and
+// BarrierDepart. An episode of the barrier lasts from the first arrival to
+// the departures. Arrivals release into one of kGroups clocks picked by slot,
+// so concurrent arrivals rarely share a mutex. The first departure joins the
+// group clocks into combined once, the other departures acquire it without
+// locking. The next arrival after a departure starts a new episode, callers
+// must not arrive before all departures of the previous episode are done
+// (Archer alternates between two barrier addresses for that reason).
+struct BarrierSync {
+  static const uptr kGroups = 8;
+
+  struct Group {
+    Mutex mtx;
+    VectorClock clock;
+  };
+
+  Mutex mtx;  // serializes starting and combining episodes
+  atomic_uint32_t departed;  // combined holds the clock of the episode
+  VectorClock combined;
+  Group groups[kGroups];
+
+  void Reset();
+};
+
+typedef AddrHashMap<BarrierSync *, 1021> BarrierMap;
+
+// SyncHandle is a sync object created and destroyed explicitly by a tool and
+// referenced by its index rather than by an address, so releasing and
+// acquiring it does not go through the meta shadow. Archer uses it for the
+// happens-before edges of tasks, which are short-lived and very numerous.
+struct SyncHandle {
+  // Overwritten by the free list of the allocator while the handle is free.
+  u64 reserved;
+  Mutex mtx;
+  VectorClock clock;
+};
+
 // MetaMap maps app addresses to heap block (MBlock) and sync var (SyncVar)
 // descriptors. It uses 1/2 direct shadow, see tsan_platform.h for the mapping.
 class MetaMap {
@@ -103,7 +141,9 @@ class MetaMap {
   // Go/Java callbacks) or the slot is not locked, then reset must be set to
   // false. In such case sync object clocks will be reset later (when it's
   // reused or during the next ResetClocks).
-  uptr FreeBlock(Processor *proc, uptr p, bool reset);
+  // *arbalest_checked and *barrier are set to the flags of the block.
+  uptr FreeBlock(Processor *proc, uptr p, bool reset,
+                 bool *arbalest_checked = nullptr, bool *barrier = nullptr);
   bool FreeRange(Processor *proc, uptr p, uptr sz, bool reset);
   void ResetRange(Processor *proc, uptr p, uptr sz, bool reset);
   // Reset vector clocks of all sync objects.
@@ -121,11 +161,17 @@ class MetaMap {
 
   void MoveMemory(uptr src, uptr dst, uptr sz);
 
+  // Explicitly managed sync objects, 0 is never a valid handle.
+  u32 CreateSyncHandle(ThreadState *thr);
+  void DestroySyncHandle(Processor *proc, u32 handle);
+  SyncHandle *GetSyncHandle(u32 handle) { return handle_alloc_.Map(handle); }
+
   void OnProcIdle(Processor *proc);
 
   struct MemoryStats {
     uptr mem_block;
     uptr sync_obj;
+    uptr sync_handle;
   };
 
   MemoryStats GetMemoryStats() const;
@@ -136,8 +182,10 @@ class MetaMap {
   static const u32 kFlagSync  = 2u << 30;
   typedef DenseSlabAlloc<MBlock, 1 << 18, 1 << 12, kFlagMask> BlockAlloc;
   typedef DenseSlabAlloc<SyncVar, 1 << 20, 1 << 10, kFlagMask> SyncAlloc;
+  typedef DenseSlabAlloc<SyncHandle, 1 << 16, 1 << 10> HandleAlloc;
   BlockAlloc block_alloc_;
   SyncAlloc sync_alloc_;
+  HandleAlloc handle_alloc_;
 
   SyncVar *GetSync(ThreadState *thr, uptr pc, uptr addr, bool create,
                    bool save_stack);
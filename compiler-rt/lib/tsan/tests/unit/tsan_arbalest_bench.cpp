@@ -0,0 +1,236 @@
+//===-- tsan_arbalest_bench.cpp -------------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file is a part of ThreadSanitizer (TSan), a race detector.
+//
+// Microbenchmarks for the Arbalest VSM primitives and the mapping tree.
+// They are disabled by default, run them with --gtest_also_run_disabled_tests
+// --gtest_filter='DISABLED_BENCH.Arbalest*'.
+// Each measurement is printed as a single JSON object on a line starting with
+// "ARBALEST_BENCH ", so results of different commits can be grepped and
+// compared. The process pins itself to the CPU in ARBALEST_BENCH_CPU
+// (default 0) and every number is the best of kTrials runs.
+//===----------------------------------------------------------------------===//
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "tsan_arbalest_var_desc.h"
+#include "tsan_avltree.h"
+#include "tsan_shadow.h"
+
+namespace __tsan {
+
+RawVsm *CheckVsmUtil(uptr addr, uptr size, u64 vmask);
+RawVsm *CheckVsmUtil16(uptr addr, u8 vmask);
+void UpdateVsmUtil(uptr addr, uptr size, u64 value_bitmap, u64 set_mask);
+void UpdateVsmUtil16(uptr addr, u8 value_bitmap, u8 set_mask);
+void VsmRangeSet(uptr addr, uptr size, RawVsm val);
+void VsmRangeUpdateMapTo(uptr addr, uptr size);
+void VsmRangeUpdateMapFrom(uptr addr, uptr size);
+void VsmRangeDeviceReset(uptr addr, uptr size);
+
+namespace {
+
+const int kTrials = 5;
+const uptr kBufSize = 1 << 16;
+
+void PinCpu() {
+  static bool pinned;
+  if (pinned)
+    return;
+  pinned = true;
+  const char *env = getenv("ARBALEST_BENCH_CPU");
+  int cpu = env ? atoi(env) : 0;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set))
+    fprintf(stderr, "ARBALEST_BENCH: failed to pin to cpu %d\n", cpu);
+}
+
+// Runs fn kTrials times, fn returns the number of operations it performed.
+template <typename Fn>
+void Measure(const char *name, uptr size, uptr align, uptr mappings, Fn fn) {
+  PinCpu();
+  double best = 0;
+  for (int t = 0; t < kTrials; t++) {
+    u64 start = MonotonicNanoTime();
+    u64 ops = fn();
+    u64 ns = MonotonicNanoTime() - start;
+    double per_op = static_cast<double>(ns) / (ops ? ops : 1);
+    if (t == 0 || per_op < best)
+      best = per_op;
+  }
+  printf("ARBALEST_BENCH {\"bench\": \"%s\", \"size\": %zu, \"align\": %zu, "
+         "\"mappings\": %zu, \"ns_per_op\": %.3f}\n",
+         name, (size_t)size, (size_t)align, (size_t)mappings, best);
+}
+
+// Application memory whose VSM is fully initialized on the host.
+uptr HostValidBuffer() {
+  static char *buf;
+  if (!buf) {
+    buf = new char[kBufSize + 64];
+    VsmRangeSet(reinterpret_cast<uptr>(buf), kBufSize + 64,
+                VariableStateMachine::kHostMask);
+  }
+  return RoundUpTo(reinterpret_cast<uptr>(buf), 64);
+}
+
+// Consumes a result so the compiler cannot drop the call.
+void Sink(void *p) { __asm__ __volatile__("" : : "r"(p) : "memory"); }
+
+}  // namespace
+
+TEST(DISABLED_BENCH, ArbalestCheckVsm) {
+  uptr buf = HostValidBuffer();
+  for (uptr size : {1, 2, 4, 8}) {
+    for (uptr align : {0, 1, 3}) {
+      if (align + size > kVsmCell)
+        continue;
+      Measure("CheckVsmUtil", size, align, 0, [&] {
+        for (int r = 0; r < 64; r++)
+          for (uptr a = buf; a < buf + kBufSize; a += kVsmCell)
+            Sink(CheckVsmUtil(a + align, size,
+                              VariableStateMachine::kHostMask8));
+        return 64 * kBufSize / kVsmCell;
+      });
+    }
+  }
+  for (uptr align : {0, 8}) {
+    Measure("CheckVsmUtil16", 16, align, 0, [&] {
+      for (int r = 0; r < 64; r++)
+        for (uptr a = buf; a < buf + kBufSize - 16; a += 16)
+          Sink(CheckVsmUtil16(a + align,
+                              static_cast<u8>(VariableStateMachine::kHostMask)));
+      return 64 * (kBufSize / 16 - 1);
+    });
+  }
+}
+
+TEST(DISABLED_BENCH, ArbalestUpdateVsm) {
+  uptr buf = HostValidBuffer();
+  for (uptr size : {1, 2, 4, 8}) {
+    for (uptr align : {0, 1, 3}) {
+      if (align + size > kVsmCell)
+        continue;
+      Measure("UpdateVsmUtil", size, align, 0, [&] {
+        for (int r = 0; r < 64; r++)
+          for (uptr a = buf; a < buf + kBufSize; a += kVsmCell)
+            UpdateVsmUtil(a + align, size,
+                          VariableStateMachine::kHostValueBitMap8,
+                          VariableStateMachine::kHostMask8);
+        return 64 * kBufSize / kVsmCell;
+      });
+    }
+  }
+  for (uptr align : {0, 8}) {
+    Measure("UpdateVsmUtil16", 16, align, 0, [&] {
+      for (int r = 0; r < 64; r++)
+        for (uptr a = buf; a < buf + kBufSize - 16; a += 16)
+          UpdateVsmUtil16(
+              a + align,
+              static_cast<u8>(VariableStateMachine::kHostValueBitMap),
+              static_cast<u8>(VariableStateMachine::kHostMask));
+      return 64 * (kBufSize / 16 - 1);
+    });
+  }
+}
+
+TEST(DISABLED_BENCH, ArbalestVsmRange) {
+  const uptr kMaxSize = 16 << 20;
+  std::vector<char> mem(kMaxSize + 64);
+  uptr base = RoundUpTo(reinterpret_cast<uptr>(mem.data()), 64);
+  for (uptr size : {64ul, 4096ul, 256ul << 10, kMaxSize}) {
+    for (uptr align : {0, 3}) {
+      // Keep the amount of touched VSM roughly constant across sizes.
+      uptr reps = Max<uptr>(1, (64ul << 20) / size);
+      uptr a = base + align;
+      uptr n = size - align;
+      Measure("VsmRangeSet", n, align, 0, [&] {
+        for (uptr r = 0; r < reps; r++)
+          VsmRangeSet(a, n, VariableStateMachine::kHostMask);
+        return reps;
+      });
+      Measure("VsmRangeUpdateMapTo", n, align, 0, [&] {
+        for (uptr r = 0; r < reps; r++)
+          VsmRangeUpdateMapTo(a, n);
+        return reps;
+      });
+      Measure("VsmRangeUpdateMapFrom", n, align, 0, [&] {
+        for (uptr r = 0; r < reps; r++)
+          VsmRangeUpdateMapFrom(a, n);
+        return reps;
+      });
+      Measure("VsmRangeDeviceReset", n, align, 0, [&] {
+        for (uptr r = 0; r < reps; r++)
+          VsmRangeDeviceReset(a, n);
+        return reps;
+      });
+    }
+  }
+}
+
+TEST(DISABLED_BENCH, ArbalestIntervalTree) {
+  const uptr kStep = 4096;
+  std::mt19937 g(42);
+  for (uptr mappings : {16, 256, 4096, 65536}) {
+    std::vector<Interval> iv;
+    for (uptr i = 0; i < mappings; i++)
+      iv.push_back({(i + 1) * kStep, (i + 1) * kStep + kStep / 2});
+    std::shuffle(iv.begin(), iv.end(), g);
+    std::vector<Interval> probes;
+    for (uptr i = 0; i < 1 << 16; i++) {
+      const Interval &m = iv[g() % mappings];
+      probes.push_back({m.left_end + 8, m.left_end + 16});
+    }
+    auto fill = [&](IntervalTree &tree) {
+      for (auto &i : iv)
+        tree.insert(i,
+                    {i.left_end, i.right_end - i.left_end, kArbalestNoVar});
+    };
+    {
+      // Every trial gets its own tree, they are freed after the measurement.
+      IntervalTree trees[kTrials];
+      int trial = 0;
+      Measure("IntervalTree::insert", 0, 0, mappings, [&] {
+        fill(trees[trial++]);
+        return mappings;
+      });
+    }
+    {
+      IntervalTree tree{};
+      fill(tree);
+      Measure("IntervalTree::find", 0, 0, mappings, [&] {
+        for (auto &p : probes)
+          Sink(tree.find(p));
+        return probes.size();
+      });
+    }
+    {
+      IntervalTree trees[kTrials];
+      for (auto &t : trees)
+        fill(t);
+      int trial = 0;
+      Measure("IntervalTree::remove", 0, 0, mappings, [&] {
+        IntervalTree &t = trees[trial++];
+        for (auto &i : iv)
+          t.remove(i);
+        return mappings;
+      });
+    }
+  }
+}
+
+}  // namespace __tsan
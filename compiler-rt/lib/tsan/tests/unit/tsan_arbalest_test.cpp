@@ -1,9 +1,21 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include <algorithm>
 #include <random>
 #include <vector>
 
 #include "gtest/gtest.h"
+#include "tsan_arbalest_clean.h"
+#include "tsan_arbalest_lazy_reset.h"
+#include "tsan_arbalest_mapping_index.h"
+#include "tsan_arbalest_parallel.h"
+#include "tsan_arbalest_record.h"
+#include "tsan_arbalest_var_desc.h"
 #include "tsan_avltree.h"
+#include "tsan_flags.h"
+#include "tsan_interface.h"
+#include "tsan_rtl.h"
 #include "tsan_shadow.h"
 using namespace std;
 
@@ -17,7 +29,7 @@ void VsmUpdateMapFrom(RawVsm* p, RawVsm* end);
 
 void init(IntervalTree &tree, vector<Interval> &iv) {
   for (auto &i : iv) {
-    tree.insert(i, {i.left_end, i.right_end - i.left_end, nullptr});
+    tree.insert(i, {i.left_end, i.right_end - i.left_end, kArbalestNoVar});
   }
 }
 
@@ -75,6 +87,25 @@ TEST(Arbalest, AvlSearch) {
   }
 }
 
+TEST(Arbalest, AvlSearchDepth) {
+  IntervalTree tree{};
+  vector<Interval> iv{};
+  int nodes = 100;
+  for (int i = 0; i < nodes; i++)
+    iv.push_back({uptr(i * 8), uptr(i * 8 + 5)});
+  init(tree, iv);
+  for (auto &it : iv) {
+    u64 depth = 0;
+    Node *n = tree.find({it.left_end + 1, it.right_end - 1}, &depth);
+    EXPECT_EQ(n, tree.find(it));
+    EXPECT_GE(depth, 1u);
+    EXPECT_LE(depth, u64(tree.height(tree.getRoot())));
+  }
+  u64 depth = 0;
+  EXPECT_EQ(tree.find({6, 7}, &depth), nullptr);
+  EXPECT_GE(depth, 1u);
+}
+
 TEST(Arbalest, AvlRangeSearch) {
   IntervalTree tree{};
   vector<Interval> iv{};
@@ -162,6 +193,395 @@ TEST(Arbalest, AvlIsOverflow) {
   }
 }
 
+TEST(Arbalest, MappingIndex) {
+  // Same layout as the index libomptarget publishes, sorted by target_begin.
+  vector<ArbalestMappingEntry> entries;
+  ArbalestMappingIndex index = {};
+  // The other tests expect ctx->t_to_h to be used.
+  struct ScopedDetach {
+    ~ScopedDetach() { ArbalestDetachMappingIndicesForTesting(); }
+  } detach;
+  uptr stepSize = 5;
+  uptr gap = 3;
+  for (uptr i = 1; i <= 10; i++)
+    entries.push_back({i * (stepSize + gap), i * (stepSize + gap) + stepSize,
+                       i * 1000, nullptr});
+  atomic_store_relaxed(&index.entries, reinterpret_cast<uptr>(entries.data()));
+  atomic_store_relaxed(&index.size, entries.size());
+  ArbalestAttachMappingIndex(0, &index);
+  ArbalestAttachMappingIndex(0, &index);
+  EXPECT_EQ(atomic_load_relaxed(&arbalest_num_mapping_indices), 1u);
+  EXPECT_TRUE(ArbalestHasMappingIndex());
+
+  for (auto &e : entries) {
+    Node n;
+    ASSERT_TRUE(ArbalestMappingIndexFind({e.target_begin + 1, e.target_end}, &n));
+    EXPECT_EQ(n.interval.left_end, e.target_begin);
+    EXPECT_EQ(n.interval.right_end, e.target_end);
+    EXPECT_EQ(n.info.start, e.host_begin);
+    EXPECT_EQ(n.info.size, stepSize);
+    EXPECT_EQ(n.info.var_id, kArbalestVarUnresolved);
+    EXPECT_FALSE(ArbalestMappingIndexFind({e.target_begin, e.target_end + 1}, &n));
+    EXPECT_FALSE(ArbalestMappingIndexFind({e.target_end, e.target_end + 1}, &n));
+
+    uptr addr = e.target_begin;
+    for (; addr < e.target_end; addr++)
+      EXPECT_FALSE(ArbalestMappingIndexIsOverflow(e.target_begin, addr));
+    EXPECT_TRUE(ArbalestMappingIndexIsOverflow(e.target_begin, addr));
+    EXPECT_TRUE(ArbalestMappingIndexIsOverflow(e.target_begin, addr + gap));
+  }
+  Node n;
+  EXPECT_FALSE(ArbalestMappingIndexFind({0, 1}, &n));
+  EXPECT_FALSE(ArbalestMappingIndexIsOverflow(0, 100));
+
+  // A removal as done by libomptarget, under an odd version.
+  atomic_store_relaxed(&index.version, 1);
+  entries.erase(entries.begin());
+  atomic_store_relaxed(&index.size, entries.size());
+  atomic_store_relaxed(&index.version, 2);
+  EXPECT_FALSE(ArbalestMappingIndexFind({stepSize + gap, stepSize + gap + 1}, &n));
+
+  ArbalestDetachMappingIndicesForTesting();
+  EXPECT_FALSE(ArbalestHasMappingIndex());
+}
+
+static bool IsDeviceInit(uptr addr) {
+  return VariableStateMachine(LoadVsm(MemToVsm(addr))).IsDeviceInit();
+}
+
+static bool IsHostInit(uptr addr) {
+  return VariableStateMachine(LoadVsm(MemToVsm(addr))).IsHostInit();
+}
+
+TEST(Arbalest, LazyDeviceReset) {
+  const uptr g = kArbalestLazyResetGranule;
+  const uptr size = kArbalestLazyResetMinSize;
+  char *buf = static_cast<char *>(aligned_alloc(g, size));
+  uptr a = reinterpret_cast<uptr>(buf);
+  u8 val = static_cast<u8>(VariableStateMachine::kDeviceMask) |
+           static_cast<u8>(VariableStateMachine::kHostMask);
+  VsmRangeSet(a, size, static_cast<RawVsm>(val));
+  ctx->h_to_t.insert({a, a + size}, {a, size, kArbalestNoVar});
+
+  ArbalestDeviceReset(a, size);
+  Node *n = ctx->h_to_t.find({a, a + size});
+  ASSERT_NE(n->info.lazy_reset, nullptr);
+  EXPECT_TRUE(ArbalestHasLazyReset());
+  EXPECT_TRUE(IsDeviceInit(a));
+
+  // Only the touched granule is reset.
+  ArbalestLazyResetTouch(n->info.lazy_reset, a + 8, 8);
+  EXPECT_FALSE(IsDeviceInit(a));
+  EXPECT_FALSE(IsDeviceInit(a + g - 8));
+  EXPECT_TRUE(IsHostInit(a));
+  EXPECT_TRUE(IsDeviceInit(a + g));
+
+  // Copying pending granules back yields uninitialized host memory.
+  ArbalestMapFrom(a + g, 2 * g);
+  EXPECT_FALSE(IsHostInit(a + g));
+  EXPECT_FALSE(IsHostInit(a + 3 * g - 8));
+  EXPECT_TRUE(IsHostInit(a + 3 * g));
+
+  // A copy to the device replaces the pending reset, except for the bytes of
+  // a partially copied granule.
+  ArbalestMapTo(a + 3 * g, g + 8);
+  EXPECT_TRUE(IsDeviceInit(a + 3 * g));
+  EXPECT_TRUE(IsDeviceInit(a + 4 * g));
+  EXPECT_FALSE(IsDeviceInit(a + 4 * g + 8));
+  EXPECT_TRUE(IsDeviceInit(a + 5 * g));
+
+  ArbalestDropDeviceResets({a, a + size});
+  EXPECT_EQ(n->info.lazy_reset, nullptr);
+  EXPECT_FALSE(ArbalestHasLazyReset());
+  EXPECT_TRUE(IsDeviceInit(a + 5 * g));
+
+  // A mapping replaced in part keeps the reset of its remaining fragments.
+  ArbalestDeviceReset(a, size);
+  ArbalestDropDeviceResets({a + 6 * g + 8, a + 7 * g});
+  EXPECT_EQ(n->info.lazy_reset, nullptr);
+  EXPECT_FALSE(IsDeviceInit(a + 5 * g));
+  EXPECT_FALSE(IsDeviceInit(a + 6 * g));
+  EXPECT_TRUE(IsDeviceInit(a + 6 * g + 8));
+  EXPECT_FALSE(IsDeviceInit(a + 7 * g));
+
+  // A reset referenced by a thread outlives its mapping, but stops resetting
+  // granules that may belong to a new mapping.
+  VsmRangeSet(a, size, static_cast<RawVsm>(val));
+  ArbalestDeviceReset(a, size);
+  ArbalestLazyResetCache c = {};
+  ArbalestStats s = {};
+  ArbalestMaterializeDeviceReset(&c, s, a, 8);
+  ASSERT_NE(c.r, nullptr);
+  EXPECT_FALSE(IsDeviceInit(a));
+  ArbalestDropDeviceResets({a, a + size});
+  ArbalestMaterializeDeviceReset(&c, s, a + g, 8);
+  EXPECT_EQ(c.r, nullptr);
+  EXPECT_TRUE(IsDeviceInit(a + g));
+  ArbalestLazyResetCacheRelease(&c);
+  ctx->h_to_t.remove({a, a + size});
+  free(buf);
+}
+
+TEST(Arbalest, VsmReleaseEmptyPages) {
+  const uptr page = VsmPageSize();
+  char *buf = static_cast<char *>(aligned_alloc(page, 3 * page));
+  uptr a = reinterpret_cast<uptr>(buf);
+  // Device state only, host state in the middle page and device state only.
+  VsmRangeSet(a, 3 * page,
+              static_cast<RawVsm>(VariableStateMachine::kDeviceMask));
+  VsmRangeSet(a + page + 8, 8,
+              static_cast<RawVsm>(VariableStateMachine::kHostMask));
+  u64 released = atomic_load_relaxed(&vsm_released_bytes);
+
+  VsmReleaseEmptyPages(a, 3 * page);
+  EXPECT_EQ(atomic_load_relaxed(&vsm_released_bytes), released + 2 * page);
+  EXPECT_FALSE(IsDeviceInit(a));
+  EXPECT_TRUE(IsDeviceInit(a + page));
+  EXPECT_TRUE(IsHostInit(a + page + 8));
+  EXPECT_FALSE(IsDeviceInit(a + 2 * page));
+  free(buf);
+}
+
+// Chunks run by BumpChunk, the workers can't allocate user memory.
+static const uptr kMaxChunks = 16;
+static uptr chunk_begs[kMaxChunks], chunk_sizes[kMaxChunks];
+static atomic_uint32_t nchunks;
+static atomic_uint32_t nested_parallel;
+
+static void BumpBytes(uptr addr, uptr size) {
+  for (u8 *p = reinterpret_cast<u8 *>(addr); size; size--) (*p++)++;
+}
+
+static void BumpChunk(uptr addr, uptr size) {
+  BumpBytes(addr, size);
+  u32 i = atomic_fetch_add(&nchunks, 1, __sanitizer::memory_order_relaxed);
+  if (i < kMaxChunks) {
+    chunk_begs[i] = addr;
+    chunk_sizes[i] = size;
+  }
+  // The pool is busy with this range, a nested one is run by the caller.
+  if (ArbalestParallelRange(addr, size, &BumpBytes))
+    atomic_store_relaxed(&nested_parallel, 1);
+}
+
+TEST(Arbalest, ParallelRange) {
+  int mb = flags()->arbalest_parallel_vsm_mb;
+  int workers = flags()->arbalest_parallel_vsm_workers;
+  flags()->arbalest_parallel_vsm_mb = 1;
+  flags()->arbalest_parallel_vsm_workers = 4;
+  // Neither end is chunk aligned, the first and the last chunk are partial.
+  const uptr size = 3 * kArbalestParallelChunk + 12345;
+  vector<u8> parallel(size + 200), serial(size + 200);
+  uptr a = reinterpret_cast<uptr>(parallel.data()) + 100;
+  atomic_store_relaxed(&nchunks, 0);
+  atomic_store_relaxed(&nested_parallel, 0);
+
+  EXPECT_TRUE(ArbalestParallelRange(a, size, &BumpChunk));
+  BumpBytes(reinterpret_cast<uptr>(serial.data()) + 100, size);
+  EXPECT_EQ(memcmp(parallel.data(), serial.data(), parallel.size()), 0);
+  EXPECT_EQ(atomic_load_relaxed(&nested_parallel), 0u);
+
+  u32 n = atomic_load_relaxed(&nchunks);
+  uptr first_end = RoundUpTo(a + 1, kArbalestParallelChunk);
+  ASSERT_EQ(n, 1 + (RoundUpTo(a + size, kArbalestParallelChunk) - first_end) /
+                       kArbalestParallelChunk);
+  vector<pair<uptr, uptr>> chunks;
+  for (u32 i = 0; i < n; i++) chunks.push_back({chunk_begs[i], chunk_sizes[i]});
+  sort(chunks.begin(), chunks.end());
+  uptr next = a;
+  for (auto &c : chunks) {
+    EXPECT_EQ(c.first, next);
+    if (c.first != a) {
+      EXPECT_EQ(c.first % kArbalestParallelChunk, 0u);
+    }
+    EXPECT_LE(c.second, kArbalestParallelChunk);
+    next = c.first + c.second;
+  }
+  EXPECT_EQ(next, a + size);
+
+  // Ranges below arbalest_parallel_vsm_mb are left to the caller.
+  EXPECT_FALSE(ArbalestParallelRange(a, (1 << 20) - 1, &BumpBytes));
+  EXPECT_EQ(parallel[100], 1);
+
+  // A forked child starts its own workers.
+  pid_t pid = fork();
+  if (pid == 0) {
+    bool ok = ArbalestParallelRange(a, size, &BumpBytes);
+    for (uptr i = 0; ok && i < size; i++) ok = parallel[100 + i] == 2;
+    _exit(ok ? 0 : 1);
+  }
+  int status = 0;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  flags()->arbalest_parallel_vsm_mb = mb;
+  flags()->arbalest_parallel_vsm_workers = workers;
+}
+
+TEST(Arbalest, RecordLog) {
+  ThreadState *thr = cur_thread();
+  const char *record = flags()->arbalest_record;
+  int max_mb = flags()->arbalest_record_max_mb;
+  int read_sample = flags()->arbalest_record_read_sample;
+  static const char kPath[] = "/tmp/tsan_arbalest_record_test";
+  flags()->arbalest_record = kPath;
+  flags()->arbalest_record_max_mb = 1;
+  flags()->arbalest_record_read_sample = 1;
+  ArbalestRecordInit();
+  ASSERT_TRUE(ArbalestRecording());
+  ArbalestRecordBreakRun(thr);
+  thr->arbalest_record.read_countdown = 0;
+
+  const uptr a = 0x1000, t = 0x2000;
+  ArbalestRecordMapping(thr, 1, a, t, 64, 3);
+  // Contiguous writes are coalesced, a read and a gap start new records.
+  ArbalestRecordAccess(thr, 2, a, 4, true);
+  ArbalestRecordAccess(thr, 3, a + 4, 4, true);
+  ArbalestRecordAccess(thr, 4, a + 8, 4, false);
+  thr->is_on_target = true;
+  ArbalestRecordAccess(thr, 5, t + 12, 4, false);
+  thr->is_on_target = false;
+  ArbalestRecordAccess(thr, 6, a + 32, 8, true);
+  ArbalestRecordFinalize();
+  atomic_store_relaxed(&arbalest_recording, 0);
+  ArbalestRecordBreakRun(thr);
+  flags()->arbalest_record = record;
+  flags()->arbalest_record_max_mb = max_mb;
+  flags()->arbalest_record_read_sample = read_sample;
+
+  char fname[96];
+  snprintf(fname, sizeof(fname), "%s.%d", kPath, (int)getpid());
+  FILE *f = fopen(fname, "rb");
+  ASSERT_NE(f, nullptr);
+  ArbalestLogHeader h;
+  ArbalestRecord r[6];
+  ASSERT_EQ(fread(&h, sizeof(h), 1, f), 1u);
+  // The log is truncated after the last record.
+  EXPECT_EQ(fread(r, sizeof(r[0]), 6, f), 5u);
+  fclose(f);
+  unlink(fname);
+  EXPECT_EQ(h.magic, kArbalestLogMagic);
+  EXPECT_EQ(h.version, kArbalestLogVersion);
+  EXPECT_EQ(h.record_size, sizeof(ArbalestRecord));
+  EXPECT_EQ(h.pid, (u64)getpid());
+  EXPECT_EQ(atomic_load_relaxed(&h.nrecords), 5u);
+
+  EXPECT_EQ(r[0].kind, ArbalestEventMapping);
+  EXPECT_EQ(r[0].flags, 3);
+  EXPECT_EQ(r[0].addr, a);
+  EXPECT_EQ(r[0].target_addr, t);
+  EXPECT_EQ(r[0].size, 64u);
+  EXPECT_EQ(r[0].tid, (u32)thr->tid);
+  EXPECT_EQ(r[1].kind, ArbalestEventWrite);
+  EXPECT_EQ(r[1].addr, a);
+  EXPECT_EQ(r[1].size, 8u);
+  EXPECT_EQ(r[1].pc, 2u);
+  EXPECT_EQ(r[2].kind, ArbalestEventRead);
+  EXPECT_EQ(r[2].flags, 0);
+  EXPECT_EQ(r[2].addr, a + 8);
+  EXPECT_EQ(r[3].kind, ArbalestEventRead);
+  EXPECT_EQ(r[3].flags, kArbalestAccessOnTarget);
+  EXPECT_EQ(r[3].addr, t + 12);
+  EXPECT_EQ(r[4].kind, ArbalestEventWrite);
+  EXPECT_EQ(r[4].addr, a + 32);
+  EXPECT_EQ(r[4].size, 8u);
+}
+
+TEST(Arbalest, VarDesc) {
+  static const char kArray[] = ";a[0:n];main.c;12;3;;";
+  static const char kScalar[] = ";x;main.c;14;5;;";
+  ArbalestVarDescs *descs = new ArbalestVarDescs();
+  u32 a = descs->Intern(kArray);
+  u32 x = descs->Intern(kScalar);
+  EXPECT_EQ(descs->Intern(nullptr), kArbalestNoVar);
+  EXPECT_EQ(descs->Intern(kArray), a);
+  EXPECT_NE(a, x);
+
+  ArbalestVarDesc d;
+  ASSERT_TRUE(descs->Get(a, &d));
+  EXPECT_STREQ(d.name, "a");
+  EXPECT_STREQ(d.file, "main.c");
+  EXPECT_EQ(d.line, 12);
+  EXPECT_EQ(d.col, 3);
+  EXPECT_TRUE(d.is_array);
+  ASSERT_TRUE(descs->Get(x, &d));
+  EXPECT_STREQ(d.name, "x");
+  EXPECT_EQ(d.line, 14);
+  EXPECT_FALSE(d.is_array);
+  EXPECT_FALSE(descs->Get(kArbalestNoVar, &d));
+  EXPECT_FALSE(descs->Get(kArbalestVarUnresolved, &d));
+  delete descs;
+}
+
+TEST(Arbalest, MappingBoundsCache) {
+  ThreadState *thr = cur_thread();
+  const uptr size = 64;
+  char *buf = static_cast<char *>(malloc(size));
+  uptr a = reinterpret_cast<uptr>(buf);
+  ctx->h_to_t.insert({a, a + size}, {a, size, kArbalestNoVar});
+  Node *n = ctx->h_to_t.find({a, a + size});
+
+  // Only a transfer of the whole mapping is cached.
+  Node part = {{0x1000, 0x1000 + size / 2}, {a, size / 2, kArbalestNoVar}};
+  CheckMappingBound(thr, 0, &part);
+  EXPECT_FALSE(atomic_load_relaxed(&n->info.bounds_checked));
+  Node whole = {{0x1000, 0x1000 + size}, {a, size, kArbalestNoVar}};
+  CheckMappingBound(thr, 0, &whole);
+  EXPECT_TRUE(atomic_load_relaxed(&n->info.bounds_checked));
+
+  free(buf);
+  EXPECT_FALSE(atomic_load_relaxed(&n->info.bounds_checked));
+  ctx->h_to_t.remove({a, a + size});
+}
+
+TEST(Arbalest, CheckSample) {
+  ThreadState *thr = cur_thread();
+  int prev = __arbalest_set_check_sample(4);
+  int checked = 0;
+  for (int i = 0; i < 16; i++) checked += !ArbalestSkipCheck(thr);
+  EXPECT_EQ(checked, 4);
+  EXPECT_EQ(__arbalest_set_check_sample(prev), 4);
+  EXPECT_EQ(ArbalestSampleRate(thr), arbalest_check_sample);
+}
+
+TEST(Arbalest, HostClean) {
+  const uptr size = 64;
+  char *buf = static_cast<char *>(aligned_alloc(kVsmCell, size));
+  uptr a = reinterpret_cast<uptr>(buf);
+  VsmRangeSet(a, size, static_cast<RawVsm>(VariableStateMachine::kHostMask));
+  StoreVsm(MemToVsm(a + 9), VariableStateMachine::kEmpty);
+  ctx->h_to_t.insert({a, a + size}, {a, size, kArbalestNoVar});
+  Node *n = ctx->h_to_t.find({a, a + size});
+
+  ArbalestVerifyHostClean(n);
+  EXPECT_FALSE(ArbalestIsHostClean(n));
+  StoreVsm(MemToVsm(a + 9),
+           static_cast<RawVsm>(VariableStateMachine::kHostMask));
+  ArbalestVerifyHostClean(n);
+  EXPECT_TRUE(ArbalestIsHostClean(n));
+  EXPECT_TRUE(ArbalestHasCleanMapping());
+
+  // Only a device write that ends the host latest state invalidates it.
+  EXPECT_TRUE(ArbalestIsHostLatest(a + 16, 8));
+  ArbalestInvalidateHostClean({a + 16, a + 24});
+  EXPECT_FALSE(ArbalestIsHostClean(n));
+  EXPECT_FALSE(ArbalestHasCleanMapping());
+
+  // A verification that started before the invalidation fails, even while
+  // no mapping is clean.
+  u32 gen = atomic_load_relaxed(&n->info.host_clean);
+  atomic_fetch_add(&arbalest_clean_mappings, 1,
+                   __sanitizer::memory_order_relaxed);
+  ArbalestInvalidateHostClean({a, a + size});
+  atomic_fetch_sub(&arbalest_clean_mappings, 1,
+                   __sanitizer::memory_order_relaxed);
+  EXPECT_NE(atomic_load_relaxed(&n->info.host_clean), gen);
+  EXPECT_FALSE(ArbalestIsHostClean(n));
+
+  ctx->h_to_t.remove({a, a + size});
+  free(buf);
+}
+
 TEST(Arbalest, AvlIterator) {
   IntervalTree tree{};
   EXPECT_EQ(tree.begin(), tree.end());
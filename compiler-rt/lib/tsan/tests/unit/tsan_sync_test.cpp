@@ -122,4 +122,42 @@ TEST(MetaMap, ResetSync) {
   CHECK_EQ(sz, 1 * sizeof(u64));
 }
 
+TEST(MetaMap, SyncHandle) {
+  ScopedIgnoreInterceptors ignore;
+  ThreadState *thr = cur_thread();
+  u32 h1 = SyncHandleCreate(thr);
+  u32 h2 = SyncHandleCreate(thr);
+  CHECK_NE(h1, 0);
+  CHECK_NE(h2, 0);
+  CHECK_NE(h1, h2);
+  SyncHandle *s1 = ctx->metamap.GetSyncHandle(h1);
+  Sid sid = thr->fast_state.sid();
+  Epoch epoch = thr->fast_state.epoch();
+  SyncHandleRelease(thr, 0, h1);
+  CHECK_EQ(s1->clock.Get(sid), epoch);
+  CHECK_EQ(ctx->metamap.GetSyncHandle(h2)->clock.Get(sid), kEpochZero);
+  SyncHandleDestroy(thr, h1);
+  SyncHandleDestroy(thr, h2);
+  // A handle is reset when it is reused.
+  u32 h3 = SyncHandleCreate(thr);
+  CHECK_EQ(ctx->metamap.GetSyncHandle(h3)->clock.Get(sid), kEpochZero);
+  SyncHandleDestroy(thr, h3);
+}
+
+TEST(Barrier, RemovedOnFree) {
+  ThreadState *thr = cur_thread();
+  uptr pc = 0;
+  u64 *block = static_cast<u64 *>(user_alloc(thr, pc, 4 * sizeof(u64)));
+  uptr addr = reinterpret_cast<uptr>(&block[1]);
+  BarrierArrive(thr, pc, addr);
+  BarrierDepart(thr, pc, addr);
+  {
+    BarrierMap::Handle h(&ctx->barriers, addr, false, false);
+    CHECK(h.exists());
+  }
+  user_free(thr, pc, block);
+  BarrierMap::Handle h(&ctx->barriers, addr, false, false);
+  CHECK(!h.exists());
+}
+
 }  // namespace __tsan
@@ -0,0 +1,54 @@
+// RUN: %clangxx_tsan -O1 %s -o %t && %run %t 2>&1 | FileCheck %s
+#include "test.h"
+
+// Tsan does not see synchronization in barrier_wait. AnnotateBarrierArrive/
+// AnnotateBarrierDepart communicate it, the arrivals of all threads happen
+// before the departures of all threads. Consecutive barriers use different
+// addresses, like the OpenMP runtime does.
+
+extern "C" {
+void AnnotateBarrierArrive(const char *f, int l, void *addr);
+void AnnotateBarrierDepart(const char *f, int l, void *addr);
+}
+
+const int kThreads = 4;
+const int kRounds = 8;
+int Data[kThreads];
+int Bar[2];
+
+void Barrier(int k) {
+  AnnotateBarrierArrive(__FILE__, __LINE__, &Bar[k % 2]);
+  barrier_wait(&barrier);
+  AnnotateBarrierDepart(__FILE__, __LINE__, &Bar[k % 2]);
+}
+
+void *Thread(void *x) {
+  long tid = (long)x;
+  int k = 0;
+  for (int r = 0; r < kRounds; r++) {
+    Data[tid] = r;
+    Barrier(k++);
+    int sum = 0;
+    for (int i = 0; i < kThreads; i++)
+      sum += Data[i];
+    if (sum != kThreads * r)
+      fprintf(stderr, "BAD SUM\n");
+    Barrier(k++);
+  }
+  return NULL;
+}
+
+int main() {
+  barrier_init(&barrier, kThreads);
+  pthread_t t[kThreads];
+  for (long i = 0; i < kThreads; i++)
+    pthread_create(&t[i], NULL, Thread, (void *)i);
+  for (int i = 0; i < kThreads; i++)
+    pthread_join(t[i], NULL);
+  fprintf(stderr, "DONE\n");
+  return 0;
+}
+
+// CHECK-NOT: WARNING: ThreadSanitizer: data race
+// CHECK-NOT: BAD SUM
+// CHECK: DONE
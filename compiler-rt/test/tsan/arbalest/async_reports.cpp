@@ -0,0 +1,23 @@
+// RUN: %clangxx_arbalest -O1 %s -o %t
+// RUN: %env_tsan_opts=arbalest_async_reports=1 not %run %t 2>&1 | FileCheck %s
+
+// Reports queued for the report thread are printed before exit and count
+// for the exit code. The read of a[i] runs on the device, which the report
+// keeps although the report thread prints it.
+
+#include <stdio.h>
+
+#define N 1000
+
+int main() {
+  int a[N];
+#pragma omp target teams distribute map(from : a[0:N])
+  for (int i = 0; i < N; i++)
+    a[i] += i;
+  printf("a[3] = %d\n", a[3]);
+  return 0;
+}
+
+// CHECK: WARNING: ThreadSanitizer: data inconsistency (uninitialized access) (pid={{[0-9]+}}) on the target
+// CHECK: Variable/array involved in data inconsistency: a[{{[0-9]+}}] (4-byte element)
+// CHECK: ThreadSanitizer: reported {{[1-9][0-9]*}} warnings
@@ -0,0 +1,30 @@
+// RUN: %clangxx -O1 -c -DGLOBAL_TU %s -o %t.global.o
+// RUN: %clangxx_arbalest -O1 %s %t.global.o -o %t
+// RUN: %env_tsan_opts= not %run %t 2>&1 | FileCheck %s
+
+// The global is defined in a module built without -farbalest, so it is not
+// registered by __arbalest_init. Its bounds come from the symbolizer when it
+// is first mapped.
+
+#define N 1000
+
+#ifdef GLOBAL_TU
+int g[N];
+#else
+#include <stdio.h>
+
+extern int g[];
+
+int main() {
+  int sum = 0;
+#pragma omp target map(to : g[0:2 * N]) map(tofrom : sum)
+  for (int i = 0; i < N; i++)
+    sum += g[i];
+  printf("sum = %d\n", sum);
+  return 0;
+}
+
+// CHECK: WARNING: ThreadSanitizer: data inconsistency (buffer overflow)
+// CHECK: the mapped memory section exceeds the host variable, host variable size: 4000, mapped section size: 8000
+// CHECK: ThreadSanitizer: reported {{[1-9][0-9]*}} warnings
+#endif
@@ -0,0 +1,28 @@
+// RUN: %clangxx_arbalest -O1 %s -o %t
+// RUN: %env_tsan_opts= not %run %t 2>&1 | FileCheck %s --check-prefixes=CHECK,RACE
+// RUN: %env_tsan_opts=arbalest_ignore_target=1 not %run %t 2>&1 \
+// RUN:   | FileCheck %s --implicit-check-not="data race"
+
+// With arbalest_ignore_target=1 races inside target regions are not
+// reported, the mapping checks of the same accesses still are.
+
+#include <stdio.h>
+
+#define N 1000
+
+int main() {
+  int a[N];
+  int racy = 0;
+#pragma omp target teams distribute parallel for num_teams(1) thread_limit(4) \
+    map(from : a[0:N]) map(tofrom : racy)
+  for (int i = 0; i < N; i++) {
+    racy++;
+    a[i] += i;
+  }
+  printf("a[3] = %d, racy = %d\n", a[3], racy);
+  return 0;
+}
+
+// RACE-DAG: WARNING: ThreadSanitizer: data race
+// CHECK-DAG: WARNING: ThreadSanitizer: data inconsistency (uninitialized access)
+// CHECK: ThreadSanitizer: reported {{[1-9][0-9]*}} warnings
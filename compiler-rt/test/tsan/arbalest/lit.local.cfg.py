@@ -0,0 +1,42 @@
+import os
+
+def getRoot(config):
+  if not config.parent:
+    return config
+  return getRoot(config.parent)
+
+root = getRoot(config)
+
+# Arbalest only supports x86_64 Linux, the tests offload to the host
+# plugin of libomptarget.
+if root.host_os not in ['Linux'] or root.target_arch != 'x86_64':
+  config.unsupported = True
+
+arbalest_cflags = ' -fopenmp -fopenmp-targets=x86_64-pc-linux-gnu -farbalest '
+for index, (template, replacement) in enumerate(config.substitutions):
+  if template == '%clangxx_tsan ':
+    config.substitutions.insert(
+        0, ('%clangxx_arbalest ', replacement + arbalest_cflags))
+    break
+# Accesses of the OpenMP runtimes are not instrumented, see README.md.
+for index, (template, replacement) in enumerate(config.substitutions):
+  if template == '%env_tsan_opts=':
+    config.substitutions[index] = (
+        template, replacement + 'ignore_noninstrumented_modules=1:')
+
+# Tests of arbalest_vsm_huge_pages=2 depend on the free hugetlbfs pages.
+try:
+  with open('/sys/kernel/mm/hugepages/hugepages-2048kB/free_hugepages') as f:
+    if int(f.read()) > 0:
+      config.available_features.add('hugetlb-pool')
+except (IOError, ValueError):
+  pass
+
+# arbalest-replay is a single source file of the openmp tools, the record
+# tests build it themselves.
+arbalest_replay_src = os.path.join(
+    getattr(root, 'compiler_rt_src_root', ''), '..', 'openmp', 'tools',
+    'arbalest-replay', 'arbalest-replay.cpp')
+if os.path.exists(arbalest_replay_src):
+  config.available_features.add('arbalest-replay')
+  config.substitutions.append(('%arbalest_replay_src', arbalest_replay_src))
@@ -0,0 +1,31 @@
+// REQUIRES: arbalest-replay
+// RUN: %clangxx_arbalest -O1 %s -o %t
+// RUN: %clangxx -O2 -pthread %arbalest_replay_src -o %t.replay
+// RUN: %env_tsan_opts= not %run %t 2>&1 | FileCheck %s
+// RUN: rm -f %t.log.*
+// RUN: %env_tsan_opts=arbalest_record=%t.log %run %t 2>&1 \
+// RUN:   | FileCheck %s --check-prefix=RECORD
+// RUN: not %t.replay %t.log.* | FileCheck %s --check-prefixes=CHECK,REPLAY
+
+// The uninitialized read on the device found live is found the same way by
+// arbalest-replay in the log of a recorded run.
+
+#include <stdio.h>
+
+#define N 1000
+
+int main() {
+  int a[N];
+#pragma omp target teams distribute map(from : a[0:N])
+  for (int i = 0; i < N; i++)
+    a[i] += i;
+  printf("a[3] = %d\n", a[3]);
+  return 0;
+}
+
+// RECORD-NOT: data inconsistency
+// RECORD: a[3] =
+
+// CHECK: data inconsistency (uninitialized access) (pid={{[0-9]+}}) on the target
+// CHECK: Read of size 4 at 0x{{[0-9a-f]+}} by thread T{{[0-9]+}}
+// REPLAY: arbalest-replay: {{[0-9]+}} records, {{[0-9]+}} operations, {{[1-9][0-9]*}} warnings
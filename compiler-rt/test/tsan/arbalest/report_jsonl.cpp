@@ -0,0 +1,26 @@
+// RUN: %clangxx_arbalest -O1 %s -o %t
+// RUN: rm -f %t.reports.*
+// RUN: %env_tsan_opts=arbalest_report_format=jsonl:arbalest_report_path=%t.reports not %run %t 2>&1 | FileCheck %s --check-prefix=STDERR
+// RUN: cat %t.reports.*.jsonl | FileCheck %s
+
+// With arbalest_report_format=jsonl the reports are written to
+// <arbalest_report_path>.<pid>.jsonl, one JSON object per line, instead of
+// being printed.
+
+#include <stdio.h>
+
+#define N 1000
+
+int main() {
+  int a[N];
+#pragma omp target teams distribute map(from : a[0:N])
+  for (int i = 0; i < N; i++)
+    a[i] += i;
+  printf("a[3] = %d\n", a[3]);
+  return 0;
+}
+
+// STDERR-NOT: WARNING: ThreadSanitizer: data inconsistency
+// STDERR: ThreadSanitizer: reported {{[1-9][0-9]*}} warnings
+
+// CHECK: {"type":"uninitialized","tid":{{[0-9]+}},"host":"0x{{[0-9a-f]+}}","target":"0x{{[0-9a-f]+}}","size":4,"element":{{[0-9]+}},"var":"a","file":"{{.*}}report_jsonl.cpp","line":{{[0-9]+}},"col":{{[0-9]+}},"stack":["{{.*}}+0x{{[0-9a-f]+}}"
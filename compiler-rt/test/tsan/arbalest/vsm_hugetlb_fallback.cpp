@@ -0,0 +1,24 @@
+// RUN: %clangxx_arbalest -O1 %s -o %t
+// RUN: %env_tsan_opts=arbalest_vsm_huge_pages=2 not %run %t 2>&1 | FileCheck %s
+// UNSUPPORTED: hugetlb-pool
+
+// Without free hugetlbfs pages the VSM falls back to transparent huge pages
+// instead of raising SIGBUS on its first update.
+
+#include <stdio.h>
+
+#define N 1000
+
+int main() {
+  int a[N];
+#pragma omp target teams distribute map(from : a[0:N])
+  for (int i = 0; i < N; i++)
+    a[i] += i;
+  printf("a[3] = %d\n", a[3]);
+  return 0;
+}
+
+// CHECK: ThreadSanitizer: no free hugetlbfs pages for the VSM
+// CHECK: ThreadSanitizer: falling back to transparent huge pages for the VSM
+// CHECK: WARNING: ThreadSanitizer: data inconsistency (uninitialized access)
+// CHECK: a[3] =
@@ -37,6 +37,7 @@
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
 #include "llvm/IR/Type.h"
 #include "llvm/ProfileData/InstrProf.h"
 #include "llvm/Support/CommandLine.h"
@@ -86,6 +87,11 @@ static cl::opt<bool> ClCompoundReadBeforeWrite(
 static cl::opt<bool> ClEnableArbalest(
     "tsan-arbalest", cl::init(false),
     cl::desc("Run Arbalest data inconsistency detector with TSan"), cl::Hidden);
+static cl::opt<bool> ClArbalestAllGlobals(
+    "tsan-arbalest-all-globals", cl::init(false),
+    cl::desc("Register all named globals with Arbalest at startup, not only "
+             "the ones whose address escapes"),
+    cl::Hidden);
 static cl::opt<bool> ClOMPDebugMode(
     "tsan-debug-info", cl::init(false),
     cl::desc("Instrument OpenMP outlined functions with debug info"), cl::Hidden);
@@ -198,10 +204,54 @@ private:
   Arbalest Arb;
 };
 
+// Whether the address V of a global is used for anything but direct loads
+// and stores. A global can only reach a map clause through such a use, e.g.
+// the offload base pointer arrays or the offload entries.
+static bool addressEscapes(const Value *V) {
+  for (const User *U : V->users()) {
+    if (isa<LoadInst>(U))
+      continue;
+    if (const auto *SI = dyn_cast<StoreInst>(U)) {
+      if (SI->getValueOperand() == V)
+        return true;
+      continue;
+    }
+    if (const auto *RMW = dyn_cast<AtomicRMWInst>(U)) {
+      if (RMW->getPointerOperand() != V)
+        return true;
+      continue;
+    }
+    if (const auto *CI = dyn_cast<CallInst>(U)) {
+      // Runtime callbacks do not map anything.
+      const Function *Callee = CI->getCalledFunction();
+      if (Callee && (Callee->getName().startswith("__tsan_") ||
+                     Callee->getName().startswith("__arbalest_")))
+        continue;
+      return true;
+    }
+    if (isa<GEPOperator>(U) || isa<BitCastOperator>(U)) {
+      if (addressEscapes(U))
+        return true;
+      continue;
+    }
+    return true;
+  }
+  return false;
+}
+
+// Globals registered with __arbalest_init. The others are registered by the
+// runtime when they are first mapped.
+static bool isArbalestGlobal(const GlobalVariable &G) {
+  if (G.getName().empty() || G.getName().startswith(".") ||
+      G.getName().startswith("llvm"))
+    return false;
+  return ClArbalestAllGlobals || addressEscapes(&G);
+}
+
 uint32_t insertGlobalVariableInfo(Module &M, SmallVector<Constant *> &GlobInfo) {
   SmallVector<GlobalVariable*, 8> UserDefinedGlobs;
   for (GlobalVariable &G : M.globals()) {
-    if (!G.getName().empty() && !G.getName().startswith(".") && !G.getName().startswith("llvm")) {
+    if (isArbalestGlobal(G)) {
       UserDefinedGlobs.push_back(&G);
     }
   }
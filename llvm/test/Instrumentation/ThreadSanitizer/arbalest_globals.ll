@@ -0,0 +1,39 @@
+; Globals whose address escapes are registered with __arbalest_init, the ones
+; only loaded and stored directly are left to the runtime.
+; RUN: opt < %s -passes=tsan-module -tsan-arbalest -S 2>/dev/null | FileCheck %s
+; RUN: opt < %s -passes=tsan-module -tsan-arbalest -tsan-arbalest-all-globals -S 2>/dev/null | FileCheck %s --check-prefix=ALL
+
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+@direct = global i32 0
+@escaped = global [4 x i32] zeroinitializer
+@gep_escaped = global [4 x i32] zeroinitializer
+@stored = global [4 x i32] zeroinitializer
+@callback = global i32 0
+@.private = private global i32 0
+@slot = global ptr null
+
+declare void @use(ptr)
+declare void @__tsan_read4(ptr)
+
+define void @f() {
+  %v = load i32, ptr @direct
+  %w = add i32 %v, 1
+  store i32 %w, ptr @direct
+  atomicrmw add ptr @direct, i32 1 seq_cst
+  call void @use(ptr @escaped)
+  call void @use(ptr getelementptr inbounds ([4 x i32], ptr @gep_escaped, i64 0, i64 1))
+  store ptr @stored, ptr @slot
+  call void @__tsan_read4(ptr @callback)
+  %p = load i32, ptr @.private
+  ret void
+}
+
+; CHECK: @arbalest_global_size = private global [3 x i64] [i64 16, i64 16, i64 16]
+; CHECK: @arbalest_global_ptr = private global [3 x ptr] [ptr @escaped, ptr @gep_escaped, ptr @stored]
+; CHECK: call void @__arbalest_init(i32 3, ptr @arbalest_global_ptr, ptr @arbalest_global_size, ptr @arbalest_global_name)
+
+; ALL: @arbalest_global_size = private global [6 x i64] [i64 4, i64 16, i64 16, i64 16, i64 4, i64 8]
+; ALL: @arbalest_global_ptr = private global [6 x ptr] [ptr @direct, ptr @escaped, ptr @gep_escaped, ptr @stored, ptr @callback, ptr @slot]
+; ALL: call void @__arbalest_init(i32 6, ptr @arbalest_global_ptr, ptr @arbalest_global_size, ptr @arbalest_global_name)
@@ -14,6 +14,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <mutex>
+#include <shared_mutex>
 
 /// Forward declaration.
 template <typename Ty> struct Accessor;
@@ -21,7 +22,8 @@ template <typename Ty> struct Accessor;
 /// A protected object is a simple wrapper to allocate an object of type \p Ty
 /// together with a mutex that guards accesses to the object. The only way to
 /// access the object is through the "exclusive accessor" which will lock the
-/// mutex accordingly.
+/// mutex accordingly, or through the "shared accessor" which allows concurrent
+/// readers that do not modify the object.
 template <typename Ty> struct ProtectedObj {
   using AccessorTy = Accessor<Ty>;
 
@@ -30,9 +32,13 @@ template <typename Ty> struct ProtectedObj {
   /// condition.
   AccessorTy getExclusiveAccessor(bool DoNotGetAccess = false);
 
+  /// Get a shared access Accessor object. The object must not be modified
+  /// through it, other shared accessors may exist at the same time.
+  AccessorTy getSharedAccessor();
+
 private:
   Ty Obj;
-  std::mutex Mtx;
+  std::shared_timed_mutex Mtx;
   friend struct Accessor<Ty>;
 };
 
@@ -41,15 +47,32 @@ template <typename Ty> struct Accessor {
   /// Default constructor does not own anything and cannot access anything.
   Accessor() : Ptr(nullptr) {}
 
-  /// Constructor to get exclusive access by locking the mutex protecting the
-  /// underlying object.
-  Accessor(ProtectedObj<Ty> &PO) : Ptr(&PO) { lock(); }
+  /// Constructor to get exclusive (or shared if \p Shared) access by locking
+  /// the mutex protecting the underlying object.
+  Accessor(ProtectedObj<Ty> &PO, bool Shared = false)
+      : Ptr(&PO), Shared(Shared) {
+    lock();
+  }
 
-  /// Constructor to get exclusive access by taking it from \p Other.
-  Accessor(Accessor<Ty> &&Other) : Ptr(Other.Ptr) { Other.Ptr = nullptr; }
+  /// Constructor to get access by taking it from \p Other.
+  Accessor(Accessor<Ty> &&Other) : Ptr(Other.Ptr), Shared(Other.Shared) {
+    Other.Ptr = nullptr;
+  }
+
+  /// Give up the current access and take the one of \p Other.
+  Accessor &operator=(Accessor<Ty> &&Other) {
+    unlock();
+    Ptr = Other.Ptr;
+    Shared = Other.Shared;
+    Other.Ptr = nullptr;
+    return *this;
+  }
 
   Accessor(Accessor &Other) = delete;
 
+  /// Return true if this accessor only has shared access.
+  bool isShared() const { return Shared; }
+
   /// If the object is still owned when the lifetime ends we give up access.
   ~Accessor() { unlock(); }
 
@@ -75,19 +98,30 @@ template <typename Ty> struct Accessor {
 private:
   /// Lock the underlying object if there is one.
   void lock() {
-    if (Ptr)
+    if (!Ptr)
+      return;
+    if (Shared)
+      Ptr->Mtx.lock_shared();
+    else
       Ptr->Mtx.lock();
   }
 
   /// Unlock the underlying object if there is one.
   void unlock() {
-    if (Ptr)
+    if (!Ptr)
+      return;
+    if (Shared)
+      Ptr->Mtx.unlock_shared();
+    else
       Ptr->Mtx.unlock();
   }
 
   /// Pointer to the underlying object or null if the accessor lost access,
   /// e.g., after a destroy call.
   ProtectedObj<Ty> *Ptr;
+
+  /// Whether the accessor holds the mutex in shared mode.
+  bool Shared = false;
 };
 
 template <typename Ty>
@@ -97,4 +131,8 @@ Accessor<Ty> ProtectedObj<Ty>::getExclusiveAccessor(bool DoNotGetAccess) {
   return Accessor<Ty>(*this);
 }
 
+template <typename Ty> Accessor<Ty> ProtectedObj<Ty>::getSharedAccessor() {
+  return Accessor<Ty>(*this, /*Shared=*/true);
+}
+
 #endif
@@ -108,6 +108,10 @@ private:
     /// will have a non-zero reference count *or* the thread will have changed
     /// this id, effectively taking over deletion responsibility.
     std::thread::id DeleteThreadId;
+
+    /// Protects the reference counts and DeleteThreadId against concurrent
+    /// updates from threads that only have shared access to the HDTT map.
+    std::mutex RefCountMtx;
   };
   // When HostDataToTargetTy is used by std::set, std::set::iterator is const
   // use unique_ptr to make States mutable.
@@ -229,6 +233,12 @@ public:
     return States->MayContainAttachedPointers;
   }
 
+  /// Lock the reference counts and the deletion state of this entry. Required
+  /// for updates made with shared access to the HDTT map.
+  std::unique_lock<std::mutex> lockRefCount() const {
+    return std::unique_lock<std::mutex>(States->RefCountMtx);
+  }
+
   void lock() const { States->UpdateMtx.lock(); }
 
   void unlock() const { States->UpdateMtx.unlock(); }
@@ -306,6 +316,10 @@ struct PendingCtorDtorListsTy {
 typedef std::map<__tgt_bin_desc *, PendingCtorDtorListsTy>
     PendingCtorsDtorsPerLibrary;
 
+#if OMPTARGET_OMPT_SUPPORT
+class OmptMappingIndex;
+#endif
+
 struct DeviceTy {
   int32_t DeviceID;
   RTLInfoTy *RTL;
@@ -321,13 +335,21 @@ struct DeviceTy {
   using HostDataToTargetListTy =
       std::set<HostDataToTargetMapKeyTy, std::less<>>;
 
-  /// The HDTTMap is a protected object that can only be accessed by one thread
-  /// at a time.
+  /// The HDTTMap is a protected object. Adding or removing entries requires
+  /// exclusive access, looking up existing entries and updating their
+  /// reference counts (under HostDataToTargetTy::lockRefCount) only needs
+  /// shared access, so threads reusing mappings do not serialize.
   ProtectedObj<HostDataToTargetListTy> HostDataToTargetMap;
 
   /// The type used to access the HDTT map.
   using HDTTMapAccessorTy = decltype(HostDataToTargetMap)::AccessorTy;
 
+#if OMPTARGET_OMPT_SUPPORT
+  /// Copy of HostDataToTargetMap for tools, updated whenever an entry is added
+  /// to or removed from the HDTT map.
+  std::unique_ptr<OmptMappingIndex> MappingIndex;
+#endif
+
   PendingCtorsDtorsPerLibrary PendingCtorsDtors;
 
   ShadowPtrListTy ShadowPtrMap;
@@ -349,7 +371,7 @@ struct DeviceTy {
   bool isDataExchangable(const DeviceTy &DstDevice);
 
   /// Lookup the mapping of \p HstPtrBegin in \p HDTTMap. The accessor ensures
-  /// exclusive access to the HDTT map.
+  /// shared or exclusive access to the HDTT map.
   LookupResult lookupMapping(HDTTMapAccessorTy &HDTTMap, void *HstPtrBegin,
                              int64_t Size);
 
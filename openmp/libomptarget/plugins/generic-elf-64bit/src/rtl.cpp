@@ -10,6 +10,7 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include <array>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
@@ -19,7 +20,11 @@
 #include <gelf.h>
 #include <link.h>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "Debug.h"
@@ -39,6 +44,10 @@
 #define NUMBER_OF_DEVICES 4
 #define OFFLOADSECTIONNAME "omp_offloading_entries"
 
+/// Kernels with at most this many arguments are launched through a direct
+/// call; larger ones fall back to libffi.
+#define MAX_DIRECT_LAUNCH_ARGS 16
+
 /// Array of Dynamic libraries loaded for this target.
 struct DynLibTy {
   std::string FileName;
@@ -109,6 +118,69 @@ public:
 
 static RTLDeviceInfoTy DeviceInfo(NUMBER_OF_DEVICES);
 
+/// Every kernel argument is passed as a pointer.
+template <size_t> using KernelArgTy = void *;
+
+/// Call \p Entry as `void(void *, ...)` with the first N entries of \p Ptrs.
+template <size_t... Is>
+static void callEntry(void *Entry, void **Ptrs, std::index_sequence<Is...>) {
+  using EntryTy = void (*)(KernelArgTy<Is>...);
+  reinterpret_cast<EntryTy>(Entry)(Ptrs[Is]...);
+}
+
+template <size_t N> static void launchDirect(void *Entry, void **Ptrs) {
+  callEntry(Entry, Ptrs, std::make_index_sequence<N>());
+}
+
+typedef void (*DirectLaunchTy)(void *Entry, void **Ptrs);
+
+template <size_t... Ns>
+static constexpr std::array<DirectLaunchTy, sizeof...(Ns)>
+makeDirectLaunchTable(std::index_sequence<Ns...>) {
+  return {{&launchDirect<Ns>...}};
+}
+
+/// Direct-call trampolines indexed by kernel arity.
+static constexpr std::array<DirectLaunchTy, MAX_DIRECT_LAUNCH_ARGS + 1>
+    DirectLaunchTable = makeDirectLaunchTable(
+        std::make_index_sequence<MAX_DIRECT_LAUNCH_ARGS + 1>());
+
+/// Prepared libffi call interfaces for kernels with too many arguments for a
+/// direct call. All arguments are pointers, so a CIF only depends on the arity
+/// and can be shared by every entry point with that arity.
+class LaunchCifCacheTy {
+  struct CifTy {
+    ffi_cif Cif;
+    std::vector<ffi_type *> ArgsTypes;
+  };
+
+  std::mutex Mtx;
+  std::unordered_map<int32_t, std::unique_ptr<CifTy>> Cifs;
+
+public:
+  /// Return the CIF for \p ArgNum pointer arguments, or nullptr if libffi
+  /// fails to prepare it.
+  ffi_cif *get(int32_t ArgNum) {
+    std::lock_guard<std::mutex> Lock(Mtx);
+    std::unique_ptr<CifTy> &C = Cifs[ArgNum];
+    if (C)
+      return &C->Cif;
+
+    std::unique_ptr<CifTy> NewC(new CifTy());
+    NewC->ArgsTypes.assign(ArgNum, &ffi_type_pointer);
+    ffi_status Status = ffi_prep_cif(&NewC->Cif, FFI_DEFAULT_ABI, ArgNum,
+                                     &ffi_type_void, NewC->ArgsTypes.data());
+    if (Status != FFI_OK) {
+      Cifs.erase(ArgNum);
+      return nullptr;
+    }
+    C = std::move(NewC);
+    return &C->Cif;
+  }
+};
+
+static LaunchCifCacheTy LaunchCifCache;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -299,11 +371,25 @@ int32_t __tgt_rtl_run_target_team_region(int32_t DeviceId, void *TgtEntryPtr,
                                          uint64_t LoopTripcount /*not used*/) {
   // ignore team num and thread limit.
 
+  DP("Running entry point at " DPxMOD "...\n", DPxPTR(TgtEntryPtr));
+
+  if (ArgNum >= 0 && ArgNum <= MAX_DIRECT_LAUNCH_ARGS) {
+    void *Ptrs[MAX_DIRECT_LAUNCH_ARGS];
+    for (int32_t I = 0; I < ArgNum; ++I)
+      Ptrs[I] = (void *)((intptr_t)TgtArgs[I] + TgtOffsets[I]);
+    DirectLaunchTable[ArgNum](TgtEntryPtr, Ptrs);
+    return OFFLOAD_SUCCESS;
+  }
+
   // Use libffi to launch execution.
-  ffi_cif Cif;
+  ffi_cif *Cif = LaunchCifCache.get(ArgNum);
+
+  assert(Cif && "Unable to prepare target launch!");
+
+  if (!Cif)
+    return OFFLOAD_FAIL;
 
   // All args are references.
-  std::vector<ffi_type *> ArgsTypes(ArgNum, &ffi_type_pointer);
   std::vector<void *> Args(ArgNum);
   std::vector<void *> Ptrs(ArgNum);
 
@@ -312,19 +398,9 @@ int32_t __tgt_rtl_run_target_team_region(int32_t DeviceId, void *TgtEntryPtr,
     Args[I] = &Ptrs[I];
   }
 
-  ffi_status Status = ffi_prep_cif(&Cif, FFI_DEFAULT_ABI, ArgNum,
-                                   &ffi_type_void, &ArgsTypes[0]);
-
-  assert(Status == FFI_OK && "Unable to prepare target launch!");
-
-  if (Status != FFI_OK)
-    return OFFLOAD_FAIL;
-
-  DP("Running entry point at " DPxMOD "...\n", DPxPTR(TgtEntryPtr));
-
   void (*Entry)(void);
   *((void **)&Entry) = TgtEntryPtr;
-  ffi_call(&Cif, Entry, NULL, &Args[0]);
+  ffi_call(Cif, Entry, NULL, &Args[0]);
   return OFFLOAD_SUCCESS;
 }
 
@@ -56,7 +56,11 @@ int HostDataToTargetTy::addEventIfNecessary(DeviceTy &Device,
 DeviceTy::DeviceTy(RTLInfoTy *RTL)
     : DeviceID(-1), RTL(RTL), RTLDeviceID(-1), IsInit(false), InitFlag(),
       HasPendingGlobals(false), PendingCtorsDtors(), ShadowPtrMap(),
-      PendingGlobalsMtx(), ShadowMtx() {}
+      PendingGlobalsMtx(), ShadowMtx() {
+#if OMPTARGET_OMPT_SUPPORT
+  MappingIndex = std::make_unique<OmptMappingIndex>();
+#endif
+}
 
 DeviceTy::~DeviceTy() {
   if (DeviceID == -1 || !(getInfoLevel() & OMP_INFOTYPE_DUMP_TABLE))
@@ -106,6 +110,10 @@ int DeviceTy::associatePtr(void *HstPtrBegin, void *TgtPtrBegin, int64_t Size,
                /*UseHoldRefCount=*/false, /*Name=*/nullptr,
                /*IsRefCountINF=*/true))
            .first->HDTT;
+#if OMPTARGET_OMPT_SUPPORT
+  MappingIndex->insert(NewEntry.HstPtrBegin, NewEntry.HstPtrEnd,
+                       NewEntry.TgtPtrBegin, NewEntry.HstPtrName);
+#endif
   DP("Creating new map entry: HstBase=" DPxMOD ", HstBegin=" DPxMOD
      ", HstEnd=" DPxMOD ", TgtBegin=" DPxMOD ", DynRefCount=%s, "
      "HoldRefCount=%s\n",
@@ -141,6 +149,9 @@ int DeviceTy::disassociatePtr(void *HstPtrBegin, bool OmpRoutine,
             It->HDTT->HstPtrEnd - It->HDTT->HstPtrBegin, OmpRoutine, CodePtr);
 #endif
       DP("Association found, removing it\n");
+#if OMPTARGET_OMPT_SUPPORT
+      MappingIndex->remove(HDTT.TgtPtrBegin);
+#endif
       void *Event = HDTT.getEvent();
       delete &HDTT;
       if (Event)
@@ -236,7 +247,9 @@ DeviceTy::getTargetPointer(void *HstPtrBegin, void *HstPtrBase, int64_t Size,
                            bool UpdateRefCount, bool HasCloseModifier,
                            bool HasPresentModifier, bool HasHoldModifier,
                            AsyncInfoTy &AsyncInfo, void *CodePtr) {
-  HDTTMapAccessorTy HDTTMap = HostDataToTargetMap.getExclusiveAccessor();
+  // Most calls reuse an existing mapping, look it up with shared access and
+  // only take the map exclusively if a new entry may be needed.
+  HDTTMapAccessorTy HDTTMap = HostDataToTargetMap.getSharedAccessor();
 #if OMPTARGET_OMPT_SUPPORT
   OmptDeviceMem Mem{HstPtrBase,    HstPtrBegin,
                     HostDeviceNum, nullptr,
@@ -248,6 +261,11 @@ DeviceTy::getTargetPointer(void *HstPtrBegin, void *HstPtrBase, int64_t Size,
   bool IsNew = false;
 
   LookupResult LR = lookupMapping(HDTTMap, HstPtrBegin, Size);
+  if (!LR.Flags.IsContained) {
+    HDTTMap.destroy();
+    HDTTMap = HostDataToTargetMap.getExclusiveAccessor();
+    LR = lookupMapping(HDTTMap, HstPtrBegin, Size);
+  }
   auto *Entry = LR.Entry;
 
   // Check if the pointer is contained.
@@ -257,6 +275,7 @@ DeviceTy::getTargetPointer(void *HstPtrBegin, void *HstPtrBase, int64_t Size,
   if (LR.Flags.IsContained ||
       ((LR.Flags.ExtendsBefore || LR.Flags.ExtendsAfter) && IsImplicit)) {
     auto &HT = *LR.Entry;
+    auto RefCountLock = HT.lockRefCount();
     const char *RefCountAction;
     if (UpdateRefCount) {
       // After this, reference count >= 1. If the reference count was 0 but the
@@ -324,6 +343,10 @@ DeviceTy::getTargetPointer(void *HstPtrBegin, void *HstPtrBase, int64_t Size,
                     (uintptr_t)HstPtrBegin + Size, Ptr, HasHoldModifier,
                     HstPtrName))
                 .first->HDTT;
+#if OMPTARGET_OMPT_SUPPORT
+    MappingIndex->insert(Entry->HstPtrBegin, Entry->HstPtrEnd,
+                         Entry->TgtPtrBegin, Entry->HstPtrName);
+#endif
     INFO(OMP_INFOTYPE_MAPPING_CHANGED, DeviceID,
          "Creating new map entry with HstPtrBase=" DPxMOD
          ", HstPtrBegin=" DPxMOD ", TgtPtrBegin=" DPxMOD ", Size=%ld, "
@@ -413,7 +436,9 @@ TargetPointerResultTy
 DeviceTy::getTgtPtrBegin(void *HstPtrBegin, int64_t Size, bool &IsLast,
                          bool UpdateRefCount, bool UseHoldRefCount,
                          bool &IsHostPtr, bool MustContain, bool ForceDelete) {
-  HDTTMapAccessorTy HDTTMap = HostDataToTargetMap.getExclusiveAccessor();
+  // Entries are only removed with exclusive access (see deallocTgtPtr), so
+  // updating the reference counts needs shared access only.
+  HDTTMapAccessorTy HDTTMap = HostDataToTargetMap.getSharedAccessor();
 
   void *TargetPointer = NULL;
   bool IsNew = false;
@@ -424,6 +449,7 @@ DeviceTy::getTgtPtrBegin(void *HstPtrBegin, int64_t Size, bool &IsLast,
   if (LR.Flags.IsContained ||
       (!MustContain && (LR.Flags.ExtendsBefore || LR.Flags.ExtendsAfter))) {
     auto &HT = *LR.Entry;
+    auto RefCountLock = HT.lockRefCount();
     IsLast = HT.decShouldRemove(UseHoldRefCount, ForceDelete);
 
     if (ForceDelete) {
@@ -515,6 +541,9 @@ int DeviceTy::deallocTgtPtr(HDTTMapAccessorTy &HDTTMap, LookupResult LR,
        ", Size=%" PRId64 ", Name=%s\n",
        DPxPTR(HT.HstPtrBegin), DPxPTR(HT.TgtPtrBegin), Size,
        (HT.HstPtrName) ? getNameFromMapping(HT.HstPtrName).c_str() : "unknown");
+#if OMPTARGET_OMPT_SUPPORT
+  MappingIndex->remove(HT.TgtPtrBegin);
+#endif
   void *Event = LR.Entry->getEvent();
   HDTTMap->erase(LR.Entry);
   delete LR.Entry;
@@ -600,7 +629,7 @@ int32_t DeviceTy::submitData(void *TgtPtrBegin, void *HstPtrBegin, int64_t Size,
                              AsyncInfoTy &AsyncInfo, bool OmpRoutine,
                              void *CodePtr) {
   if (getInfoLevel() & OMP_INFOTYPE_DATA_TRANSFER) {
-    HDTTMapAccessorTy HDTTMap = HostDataToTargetMap.getExclusiveAccessor();
+    HDTTMapAccessorTy HDTTMap = HostDataToTargetMap.getSharedAccessor();
     LookupResult LR = lookupMapping(HDTTMap, HstPtrBegin, Size);
     auto *HT = &*LR.Entry;
 
@@ -645,7 +674,7 @@ int32_t DeviceTy::retrieveData(void *HstPtrBegin, void *TgtPtrBegin,
                                int64_t Size, AsyncInfoTy &AsyncInfo,
                                bool OmpRoutine, void *CodePtr) {
   if (getInfoLevel() & OMP_INFOTYPE_DATA_TRANSFER) {
-    HDTTMapAccessorTy HDTTMap = HostDataToTargetMap.getExclusiveAccessor();
+    HDTTMapAccessorTy HDTTMap = HostDataToTargetMap.getSharedAccessor();
     LookupResult LR = lookupMapping(HDTTMap, HstPtrBegin, Size);
     auto *HT = &*LR.Entry;
     INFO(OMP_INFOTYPE_DATA_TRANSFER, DeviceID,
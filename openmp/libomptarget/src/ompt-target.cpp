@@ -1,4 +1,7 @@
 #include "ompt-target.h"
+
+#include <algorithm>
+#include <cstring>
 // #include "omptarget.h"
 
 /// Data attributes for each data reference used in an OpenMP target region. Copied from omptarget.h
@@ -225,3 +228,87 @@ OmptDeviceMem::~OmptDeviceMem() {
                                     Bytes, CodePtr, VarName);
   }
 }
+
+OmptMappingIndex::OmptMappingIndex() : Index{0, nullptr, 0}, Capacity(0) {}
+
+void OmptMappingIndex::beginUpdate() {
+  __atomic_store_n(&Index.version, Index.version + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void OmptMappingIndex::endUpdate() {
+  __atomic_store_n(&Index.version, Index.version + 1, __ATOMIC_RELEASE);
+}
+
+static ompt_target_mapping_entry_t *
+lowerBound(ompt_target_mapping_index_t &Index, uint64_t TgtPtrBegin) {
+  return std::lower_bound(Index.entries, Index.entries + Index.size,
+                          TgtPtrBegin,
+                          [](const ompt_target_mapping_entry_t &E,
+                             uint64_t Addr) { return E.target_begin < Addr; });
+}
+
+void OmptMappingIndex::insert(uintptr_t HstPtrBegin, uintptr_t HstPtrEnd,
+                              uintptr_t TgtPtrBegin, void *Name) {
+  ompt_target_mapping_entry_t Entry = {TgtPtrBegin,
+                                       TgtPtrBegin + (HstPtrEnd - HstPtrBegin),
+                                       HstPtrBegin,
+                                       reinterpret_cast<const char *>(Name)};
+  ompt_target_mapping_entry_t *End = Index.entries + Index.size;
+  ompt_target_mapping_entry_t *Pos = lowerBound(Index, TgtPtrBegin);
+  if (Index.size < Capacity) {
+    beginUpdate();
+    std::memmove(Pos + 1, Pos, (End - Pos) * sizeof(*Pos));
+    *Pos = Entry;
+    __atomic_store_n(&Index.size, Index.size + 1, __ATOMIC_RELEASE);
+    endUpdate();
+    return;
+  }
+  // Readers may still be using the full buffer, so publish a grown copy and
+  // keep the old one alive.
+  uint64_t NewCapacity = Capacity ? 2 * Capacity : 64;
+  std::unique_ptr<ompt_target_mapping_entry_t[]> NewBuffer(
+      new ompt_target_mapping_entry_t[NewCapacity]);
+  ompt_target_mapping_entry_t *NewPos =
+      std::copy(Index.entries, Pos, NewBuffer.get());
+  *NewPos = Entry;
+  std::copy(Pos, End, NewPos + 1);
+  // Readers load size before entries, so a reader never sees the new size
+  // together with the old buffer.
+  beginUpdate();
+  __atomic_store_n(&Index.entries, NewBuffer.get(), __ATOMIC_RELAXED);
+  __atomic_store_n(&Index.size, Index.size + 1, __ATOMIC_RELEASE);
+  endUpdate();
+  Buffers.push_back(std::move(NewBuffer));
+  Capacity = NewCapacity;
+}
+
+void OmptMappingIndex::remove(uintptr_t TgtPtrBegin) {
+  ompt_target_mapping_entry_t *End = Index.entries + Index.size;
+  ompt_target_mapping_entry_t *Pos = lowerBound(Index, TgtPtrBegin);
+  if (Pos == End || Pos->target_begin != TgtPtrBegin)
+    return;
+  beginUpdate();
+  std::memmove(Pos, Pos + 1, (End - Pos - 1) * sizeof(*Pos));
+  __atomic_store_n(&Index.size, Index.size - 1, __ATOMIC_RELEASE);
+  endUpdate();
+}
+
+// Kept apart from PM->Devices so that the inquiry does not take PM->RTLsMtx,
+// it is called from callbacks that hold other libomptarget locks.
+static std::mutex MappingIndicesMtx;
+static std::vector<ompt_target_mapping_index_t *> MappingIndices;
+
+void registerMappingIndex(int DeviceNum, OmptMappingIndex &Index) {
+  std::lock_guard<std::mutex> Lock(MappingIndicesMtx);
+  if (MappingIndices.size() <= static_cast<size_t>(DeviceNum))
+    MappingIndices.resize(DeviceNum + 1);
+  MappingIndices[DeviceNum] = Index.get();
+}
+
+ompt_target_mapping_index_t *getTargetMappingIndex(int DeviceNum) {
+  std::lock_guard<std::mutex> Lock(MappingIndicesMtx);
+  if (DeviceNum < 0 || static_cast<size_t>(DeviceNum) >= MappingIndices.size())
+    return nullptr;
+  return MappingIndices[DeviceNum];
+}
@@ -5,6 +5,11 @@
 #include "ompt-target-api.h"
 #undef FROM_LIBOMPTARGET
 
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #define OMPT_GET_RETURN_ADDRESS(level) __builtin_return_address(level)
 
 extern ompt_target_callbacks_active_t OmptTargetEnabled;
@@ -101,4 +106,32 @@ public:
   void setTargetAddr(void *TargetAddr);
   void invokeCallback();
 };
+
+/// Read-optimized copy of the HostDataToTargetMap of a device that tools read
+/// through ompt_get_target_mapping_index. Writers must hold the lock of the
+/// HostDataToTargetMap, readers do not take any lock.
+class OmptMappingIndex {
+private:
+  ompt_target_mapping_index_t Index;
+  uint64_t Capacity;
+  /// The current and all retired entry buffers, a reader may still use a
+  /// retired one.
+  std::vector<std::unique_ptr<ompt_target_mapping_entry_t[]>> Buffers;
+
+  void beginUpdate();
+  void endUpdate();
+
+public:
+  OmptMappingIndex();
+  void insert(uintptr_t HstPtrBegin, uintptr_t HstPtrEnd,
+              uintptr_t TgtPtrBegin, void *Name);
+  void remove(uintptr_t TgtPtrBegin);
+  ompt_target_mapping_index_t *get() { return &Index; }
+};
+
+/// Makes the index of device \p DeviceNum visible to getTargetMappingIndex.
+void registerMappingIndex(int DeviceNum, OmptMappingIndex &Index);
+
+/// Implementation of the ompt_get_target_mapping_index inquiry function.
+ompt_target_mapping_index_t *getTargetMappingIndex(int DeviceNum);
 #endif // LIBOMPTARGET_OMPT_TARGET_H
\ No newline at end of file
@@ -194,6 +194,10 @@ static int initLibrary(DeviceTy &Device) {
               false /*UseHoldRefCount*/, CurrHostEntry->name,
               true /*IsRefCountINF*/));
 #if OMPTARGET_OMPT_SUPPORT
+          Device.MappingIndex->insert(
+              (uintptr_t)CurrHostEntry->addr,
+              (uintptr_t)CurrHostEntry->addr + CurrHostEntry->size,
+              (uintptr_t)CurrDeviceEntry->addr, CurrHostEntry->name);
           if (!OmptTargetIssued) {
             OmptTargetIssued = true;
             MappingGlobals = new OmptTarget{ompt_target_enter_data, DeviceId, nullptr};
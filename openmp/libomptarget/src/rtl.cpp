@@ -242,6 +242,8 @@ void RTLsTy::loadRTLs() {
         DP("Turn off OMPT in libomptarget because libomp_start_tool returns "
            "false\n");
         memset(&OmptTargetEnabled, 0, sizeof(OmptTargetEnabled));
+      } else if (libomp_ompt_set_target_mapping_index_fn) {
+        libomp_ompt_set_target_mapping_index_fn(getTargetMappingIndex);
       }
     }
     OmptInitialized = true;
@@ -402,6 +404,10 @@ void RTLsTy::initRTLonce(RTLInfoTy &R) {
       PM->Devices[Start + DeviceId]->DeviceID = Start + DeviceId;
       // RTL local device ID
       PM->Devices[Start + DeviceId]->RTLDeviceID = DeviceId;
+#if OMPTARGET_OMPT_SUPPORT
+      registerMappingIndex(Start + DeviceId,
+                           *PM->Devices[Start + DeviceId]->MappingIndex);
+#endif
     }
 
     // Initialize the index of this RTL and save it in the used RTLs.
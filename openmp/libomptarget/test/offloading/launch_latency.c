@@ -0,0 +1,48 @@
+// RUN: %libomptarget-compileopt-run-and-check-generic
+
+// Measures the latency of launching tiny kernels with few and many arguments.
+// Kernels with more arguments than the plugin launches directly go through
+// the libffi fallback.
+
+#include <omp.h>
+#include <stdio.h>
+
+#define N 100000
+
+int main(void) {
+  int a = 0, b = 0, c = 0, d = 0, e = 0, f = 0, g = 0, h = 0, i = 0, j = 0,
+      k = 0, l = 0, m = 0, n = 0, o = 0, p = 0, q = 0, r = 0, s = 0, t = 0;
+
+  // Map the variables once so that only the launches are timed.
+#pragma omp target data map(tofrom: a, b, c, d, e, f, g, h, i, j, k, l, m, n, \
+                                o, p, q, r, s, t)
+  {
+    double start = omp_get_wtime();
+    for (int it = 0; it < N; ++it) {
+#pragma omp target map(tofrom: a)
+      { a++; }
+    }
+    double few = omp_get_wtime() - start;
+
+    start = omp_get_wtime();
+    for (int it = 0; it < N; ++it) {
+#pragma omp target map(tofrom: a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, \
+                            p, q, r, s, t)
+      {
+        a++; b++; c++; d++; e++; f++; g++; h++; i++; j++;
+        k++; l++; m++; n++; o++; p++; q++; r++; s++; t++;
+      }
+    }
+    double many = omp_get_wtime() - start;
+
+    printf("launch latency (1 arg): %.3lfus\n", few / N * 1e6);
+    printf("launch latency (20 args): %.3lfus\n", many / N * 1e6);
+  }
+
+  int sum = b + c + d + e + f + g + h + i + j + k + l + m + n + o + p + q + r +
+            s + t;
+  // CHECK: PASS
+  if (a == 2 * N && sum == 19 * N)
+    printf("PASS\n");
+  return 0;
+}
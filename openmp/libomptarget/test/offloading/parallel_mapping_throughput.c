@@ -0,0 +1,54 @@
+// RUN: %libomptarget-compileopt-run-and-check-generic
+
+// Measures the throughput of the mapping table when many host threads issue
+// target nowait regions at the same time. Every region maps an array that is
+// already present (reference count updates only) and a private array of the
+// thread (usually a new entry and its deletion).
+
+#include <omp.h>
+#include <stdio.h>
+
+#define NUM_THREADS 16
+#define ITERS 2000
+#define N 64
+
+int shared_data[N];
+
+int main(void) {
+  int priv[NUM_THREADS][N];
+  long sums[NUM_THREADS] = {0};
+
+  for (int i = 0; i < N; ++i)
+    shared_data[i] = i;
+
+#pragma omp target data map(to: shared_data)
+  {
+    double start = omp_get_wtime();
+#pragma omp parallel num_threads(NUM_THREADS)
+    {
+      int t = omp_get_thread_num();
+      for (int it = 0; it < ITERS; ++it) {
+#pragma omp target map(to: shared_data) map(from: priv[t]) nowait
+        for (int i = 0; i < N; ++i)
+          priv[t][i] = shared_data[i] + 1;
+        if (it % 64 == 63) {
+#pragma omp taskwait
+        }
+      }
+#pragma omp taskwait
+      for (int i = 0; i < N; ++i)
+        sums[t] += priv[t][i];
+    }
+    double elapsed = omp_get_wtime() - start;
+    printf("mapping throughput (%d threads): %.0lf regions/s\n", NUM_THREADS,
+           NUM_THREADS * ITERS / elapsed);
+  }
+
+  int ok = 1;
+  for (int t = 0; t < NUM_THREADS; ++t)
+    ok &= sums[t] == (long)N * (N + 1) / 2;
+  // CHECK: PASS
+  if (ok)
+    printf("PASS\n");
+  return 0;
+}
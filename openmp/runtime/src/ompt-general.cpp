@@ -1014,6 +1014,22 @@ OMPT_API_ROUTINE int ompt_get_num_devices(void) {
   return 1; // only one device (the current device) is available
 }
 
+// Set by libomptarget once it has started the tool
+static std::atomic<ompt_get_target_mapping_index_t>
+    ompt_target_mapping_index_fn;
+
+_OMP_EXTERN void
+libomp_ompt_set_target_mapping_index_fn(ompt_get_target_mapping_index_t fn) {
+  ompt_target_mapping_index_fn.store(fn, std::memory_order_release);
+}
+
+static ompt_target_mapping_index_t *
+ompt_get_target_mapping_index(int device_num) {
+  ompt_get_target_mapping_index_t fn =
+      ompt_target_mapping_index_fn.load(std::memory_order_acquire);
+  return fn ? fn(device_num) : NULL;
+}
+
 /*****************************************************************************
  * API inquiry for tool
  ****************************************************************************/
@@ -1027,6 +1043,9 @@ static ompt_interface_fn_t ompt_fn_lookup(const char *s) {
 
   FOREACH_OMPT_INQUIRY_FN(ompt_interface_fn)
 
+  if (strcmp(s, "ompt_get_target_mapping_index") == 0)
+    return (ompt_interface_fn_t)ompt_get_target_mapping_index;
+
   return NULL;
 }
 
@@ -22,6 +22,30 @@ typedef struct ompt_target_callbacks_active_s {
 #undef ompt_event_macro
 } ompt_target_callbacks_active_t;
 
+/* One host<->target mapping of a device, see ompt_target_mapping_index_t */
+typedef struct ompt_target_mapping_entry_s {
+  uint64_t target_begin;
+  uint64_t target_end; /* excluded */
+  uint64_t host_begin;
+  const char *name;
+} ompt_target_mapping_entry_t;
+
+/* The mappings of a device, owned by libomptarget and sorted by target_begin.
+   Tools read it without locking: version is odd while libomptarget updates
+   the index, a reader retries if version was odd or changed during the read.
+   Buffers that entries pointed to stay valid until the device is destroyed,
+   readers must load size before entries. */
+typedef struct ompt_target_mapping_index_s {
+  uint64_t version;
+  ompt_target_mapping_entry_t *entries;
+  uint64_t size;
+} ompt_target_mapping_index_t;
+
+/* Inquiry function "ompt_get_target_mapping_index", returns NULL if the
+   device does not exist or libomptarget has not been loaded yet */
+typedef ompt_target_mapping_index_t *(*ompt_get_target_mapping_index_t)(
+    int device_num);
+
 _OMP_EXTERN OMPT_INTERFACE_ATTRIBUTE bool
 libomp_start_tool(ompt_target_callbacks_active_t *libomptarget_ompt_enabled);
 
@@ -51,4 +75,7 @@ _OMP_EXTERN OMPT_INTERFACE_ATTRIBUTE void libomp_ompt_callback_device_mem(
     unsigned int device_mem_flag, void *host_base_addr, void *host_addr,
     int host_device_num, void *target_addr, int target_device_num,
     size_t bytes, void *codeptr, char *var_name);
+
+_OMP_EXTERN OMPT_INTERFACE_ATTRIBUTE void
+libomp_ompt_set_target_mapping_index_fn(ompt_get_target_mapping_index_t fn);
 #endif // __OMPT_TARGET_API_H__
\ No newline at end of file
@@ -0,0 +1,452 @@
+/*
+ * arbalest-replay.cpp -- Offline checker for Arbalest record files
+ */
+
+//===----------------------------------------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for details.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+// A program run with TSAN_OPTIONS=arbalest_record=<path> only logs mapping
+// events and access summaries. This tool replays such a log through the same
+// data-mapping model as tsan_arbalest_rtl.cpp and reports data
+// inconsistencies.
+//
+// The replay happens in two passes. The first pass walks the log in order,
+// maintains the host<->target mapping tables and translates every event into
+// an operation on host addresses. The second pass applies the operations to
+// the variable state machines (VSM). VSMs of different host addresses are
+// independent, so the host address space is split into chunks that are
+// distributed over worker threads, and every worker replays all operations
+// restricted to its own chunks.
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Record format, keep in sync with compiler-rt/lib/tsan/rtl/
+// tsan_arbalest_record.h.
+constexpr uint64_t LogMagic = 0x474f4c54534c4241ull;
+constexpr uint32_t LogVersion = 1;
+
+enum EventKind : uint8_t {
+  EventInvalid = 0,
+  EventMapping,
+  EventGlobal,
+  EventRead,
+  EventWrite,
+};
+
+constexpr uint8_t AccessOnTarget = 1 << 0;
+
+struct LogHeader {
+  uint64_t Magic;
+  uint32_t Version;
+  uint32_t RecordSize;
+  uint64_t Pid;
+  uint64_t NRecords;
+  uint64_t Capacity;
+};
+
+struct Record {
+  uint8_t Kind;
+  uint8_t Flags;
+  uint16_t Reserved;
+  uint32_t Tid;
+  uint64_t Addr;
+  uint64_t TargetAddr;
+  uint64_t Size;
+  uint64_t Pc;
+};
+
+static_assert(sizeof(LogHeader) == 40, "LogHeader does not match the runtime");
+static_assert(sizeof(Record) == 40, "Record does not match the runtime");
+
+// OMPT device memory flags, see ompt_device_mem_flag_t.
+enum DeviceMemFlag : uint8_t {
+  DeviceMemTo = 0x01,
+  DeviceMemFrom = 0x02,
+  DeviceMemAssociate = 0x10,
+  DeviceMemDisassociate = 0x20,
+};
+
+// VSM bits, see VariableStateMachine in tsan_shadow.h.
+constexpr uint8_t HostInit = 0x1;
+constexpr uint8_t DeviceInit = 0x2;
+constexpr uint8_t HostLatest = 0x4;
+constexpr uint8_t DeviceLatest = 0x8;
+constexpr uint8_t HostMask = HostInit | HostLatest;
+constexpr uint8_t DeviceMask = DeviceInit | DeviceLatest;
+
+enum class OpKind : uint8_t {
+  SetHostValid,
+  MapTo,
+  MapFrom,
+  DeviceReset,
+  HostWrite,
+  DeviceWrite,
+  HostRead,
+  DeviceRead,
+};
+
+/// A replay step on the host range [Addr, Addr + Size).
+struct Op {
+  OpKind Kind;
+  uint32_t Tid;
+  uint64_t Addr;
+  uint64_t Size;
+  uint64_t Pc;
+  /// Address the program accessed, differs from Addr for device accesses.
+  uint64_t AccessAddr;
+  /// Index of the record this operation was produced from.
+  uint64_t Index;
+};
+
+/// Ordered set of disjoint intervals with a translated start address.
+class MappingTable {
+  struct Entry {
+    uint64_t End;
+    uint64_t Other;
+  };
+  std::map<uint64_t, Entry> Entries;
+
+public:
+  /// Remove the parts of all intervals that overlap [Begin, End).
+  void removeRange(uint64_t Begin, uint64_t End) {
+    auto It = Entries.upper_bound(Begin);
+    if (It != Entries.begin())
+      --It;
+    while (It != Entries.end() && It->first < End) {
+      uint64_t B = It->first;
+      Entry E = It->second;
+      if (E.End <= Begin) {
+        ++It;
+        continue;
+      }
+      It = Entries.erase(It);
+      if (B < Begin)
+        Entries[B] = {Begin, E.Other};
+      if (E.End > End)
+        Entries[End] = {E.End, E.Other + (End - B)};
+    }
+  }
+
+  /// Return false if [Begin, End) overlaps an existing interval.
+  bool insert(uint64_t Begin, uint64_t End, uint64_t Other) {
+    if (overlaps(Begin, End))
+      return false;
+    Entries[Begin] = {End, Other};
+    return true;
+  }
+
+  bool overlaps(uint64_t Begin, uint64_t End) const {
+    auto It = Entries.lower_bound(End);
+    if (It == Entries.begin())
+      return false;
+    --It;
+    return It->second.End > Begin;
+  }
+
+  /// Remove the interval that contains [Begin, End).
+  bool removeContaining(uint64_t Begin, uint64_t End) {
+    auto It = Entries.upper_bound(Begin);
+    if (It == Entries.begin())
+      return false;
+    --It;
+    if (It->second.End < End)
+      return false;
+    Entries.erase(It);
+    return true;
+  }
+
+  /// Call F(Begin, End, TranslatedBegin) for every part of [Begin, End) that
+  /// is covered by an interval.
+  template <typename Fn>
+  void forEachOverlap(uint64_t Begin, uint64_t End, Fn F) const {
+    auto It = Entries.upper_bound(Begin);
+    if (It != Entries.begin())
+      --It;
+    for (; It != Entries.end() && It->first < End; ++It) {
+      uint64_t B = std::max(Begin, It->first);
+      uint64_t E = std::min(End, It->second.End);
+      if (B < E)
+        F(B, E, It->second.Other + (B - It->first));
+    }
+  }
+};
+
+/// First pass: translate the log into operations on host addresses.
+std::vector<Op> resolve(const Record *Records, uint64_t N) {
+  std::vector<Op> Ops;
+  MappingTable HostToTarget, TargetToHost;
+  for (uint64_t I = 0; I < N; I++) {
+    const Record &R = Records[I];
+    auto Emit = [&](OpKind Kind, uint64_t Addr, uint64_t Size,
+                    uint64_t AccessAddr) {
+      Ops.push_back({Kind, R.Tid, Addr, Size, R.Pc, AccessAddr, I});
+    };
+    uint64_t End = R.Addr + R.Size;
+    switch (R.Kind) {
+    case EventInvalid:
+      break;
+    case EventGlobal:
+      Emit(OpKind::SetHostValid, R.Addr, R.Size, R.Addr);
+      break;
+    case EventMapping:
+      if (R.Flags & DeviceMemAssociate) {
+        HostToTarget.removeRange(R.Addr, End);
+        HostToTarget.insert(R.Addr, End, R.TargetAddr);
+        if (!TargetToHost.insert(R.TargetAddr, R.TargetAddr + R.Size, R.Addr))
+          fprintf(stderr,
+                  "arbalest-replay: record %" PRIu64 ": device address 0x%" PRIx64
+                  " is already involved in a mapping\n",
+                  I, R.TargetAddr);
+        if (!(R.Flags & DeviceMemTo))
+          Emit(OpKind::DeviceReset, R.Addr, R.Size, R.Addr);
+      }
+      if (R.Flags & DeviceMemTo)
+        Emit(OpKind::MapTo, R.Addr, R.Size, R.Addr);
+      if (R.Flags & DeviceMemFrom)
+        Emit(OpKind::MapFrom, R.Addr, R.Size, R.Addr);
+      if (R.Flags & DeviceMemDisassociate)
+        TargetToHost.removeContaining(R.TargetAddr, R.TargetAddr + R.Size);
+      break;
+    case EventRead:
+    case EventWrite: {
+      bool IsWrite = R.Kind == EventWrite;
+      if (!(R.Flags & AccessOnTarget)) {
+        if (IsWrite) {
+          Emit(OpKind::HostWrite, R.Addr, R.Size, R.Addr);
+        } else {
+          HostToTarget.forEachOverlap(
+              R.Addr, End, [&](uint64_t B, uint64_t E, uint64_t) {
+                Emit(OpKind::HostRead, B, E - B, B);
+              });
+        }
+      } else {
+        TargetToHost.forEachOverlap(
+            R.Addr, End, [&](uint64_t B, uint64_t E, uint64_t Host) {
+              Emit(IsWrite ? OpKind::DeviceWrite : OpKind::DeviceRead, Host,
+                   E - B, B);
+            });
+      }
+      break;
+    }
+    default:
+      fprintf(stderr, "arbalest-replay: record %" PRIu64 ": unknown kind %u\n",
+              I, R.Kind);
+      break;
+    }
+  }
+  return Ops;
+}
+
+enum class ReportKind { Uninitialized, Stale };
+
+struct Report {
+  ReportKind Kind;
+  bool OnTarget;
+  uint32_t Tid;
+  uint64_t Pc;
+  uint64_t AccessAddr;
+  uint64_t HostAddr;
+  uint64_t Size;
+  uint64_t Index;
+};
+
+constexpr unsigned ChunkShift = 16;
+constexpr uint64_t ChunkSize = 1ull << ChunkShift;
+
+/// Second pass: VSMs of the chunks owned by one worker.
+class Worker {
+  unsigned Id;
+  unsigned NumWorkers;
+  std::unordered_map<uint64_t, std::unique_ptr<uint8_t[]>> Chunks;
+
+public:
+  std::vector<Report> Reports;
+
+  Worker(unsigned Id, unsigned NumWorkers) : Id(Id), NumWorkers(NumWorkers) {}
+
+  uint8_t *getChunk(uint64_t Chunk) {
+    std::unique_ptr<uint8_t[]> &C = Chunks[Chunk];
+    if (!C)
+      C.reset(new uint8_t[ChunkSize]());
+    return C.get();
+  }
+
+  void apply(const Op &O, uint8_t *V, uint64_t Size, uint64_t Offset) {
+    switch (O.Kind) {
+    case OpKind::SetHostValid:
+      std::fill(V, V + Size, HostMask);
+      break;
+    case OpKind::MapTo:
+      for (uint64_t I = 0; I < Size; I++)
+        V[I] = (V[I] & ~DeviceMask) | ((V[I] << 1) & DeviceMask);
+      break;
+    case OpKind::MapFrom:
+      for (uint64_t I = 0; I < Size; I++)
+        V[I] = (V[I] & ~HostMask) | ((V[I] >> 1) & HostMask);
+      break;
+    case OpKind::DeviceReset:
+      for (uint64_t I = 0; I < Size; I++)
+        V[I] &= ~DeviceMask;
+      break;
+    case OpKind::HostWrite:
+      for (uint64_t I = 0; I < Size; I++)
+        V[I] = (V[I] & ~(HostMask | DeviceLatest)) | HostMask;
+      break;
+    case OpKind::DeviceWrite:
+      for (uint64_t I = 0; I < Size; I++)
+        V[I] = (V[I] & ~(DeviceMask | HostLatest)) | DeviceMask;
+      break;
+    case OpKind::HostRead:
+    case OpKind::DeviceRead: {
+      bool OnTarget = O.Kind == OpKind::DeviceRead;
+      uint8_t Mask = OnTarget ? DeviceMask : HostMask;
+      for (uint64_t I = 0; I < Size; I++) {
+        if ((V[I] & Mask) == Mask)
+          continue;
+        bool Init = V[I] & (OnTarget ? DeviceInit : HostInit);
+        Reports.push_back({Init ? ReportKind::Stale : ReportKind::Uninitialized,
+                           OnTarget, O.Tid, O.Pc, O.AccessAddr + Offset + I,
+                           O.Addr + Offset + I, O.Size, O.Index});
+        break;
+      }
+      break;
+    }
+    }
+  }
+
+  void run(const std::vector<Op> &Ops) {
+    for (const Op &O : Ops) {
+      uint64_t End = O.Addr + O.Size;
+      for (uint64_t A = O.Addr; A < End;) {
+        uint64_t Chunk = A >> ChunkShift;
+        uint64_t ChunkEnd = std::min(End, (Chunk + 1) << ChunkShift);
+        if (Chunk % NumWorkers == Id)
+          apply(O, getChunk(Chunk) + (A & (ChunkSize - 1)), ChunkEnd - A,
+                A - O.Addr);
+        A = ChunkEnd;
+      }
+    }
+  }
+};
+
+void usage(const char *Argv0) {
+  fprintf(stderr, "Usage: %s [-j <threads>] <record file>\n", Argv0);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  unsigned NumWorkers = std::max(1u, std::thread::hardware_concurrency());
+  const char *Path = nullptr;
+  for (int I = 1; I < argc; I++) {
+    if (!strcmp(argv[I], "-j") && I + 1 < argc) {
+      NumWorkers = std::max(1, atoi(argv[++I]));
+    } else if (!Path) {
+      Path = argv[I];
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (!Path) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  int Fd = open(Path, O_RDONLY);
+  struct stat St;
+  if (Fd < 0 || fstat(Fd, &St) < 0) {
+    fprintf(stderr, "arbalest-replay: cannot open '%s': %s\n", Path,
+            strerror(errno));
+    return 2;
+  }
+  size_t FileSize = St.st_size;
+  if (FileSize < sizeof(LogHeader)) {
+    fprintf(stderr, "arbalest-replay: '%s' is too small\n", Path);
+    return 2;
+  }
+  void *Map = mmap(nullptr, FileSize, PROT_READ, MAP_PRIVATE, Fd, 0);
+  close(Fd);
+  if (Map == MAP_FAILED) {
+    fprintf(stderr, "arbalest-replay: cannot map '%s': %s\n", Path,
+            strerror(errno));
+    return 2;
+  }
+  const LogHeader *Header = static_cast<const LogHeader *>(Map);
+  if (Header->Magic != LogMagic || Header->Version != LogVersion ||
+      Header->RecordSize != sizeof(Record)) {
+    fprintf(stderr, "arbalest-replay: '%s' is not an Arbalest record file "
+                    "of version %u\n",
+            Path, LogVersion);
+    return 2;
+  }
+  // A process that did not exit normally leaves the sparse tail in place.
+  uint64_t N = std::min<uint64_t>(
+      {Header->NRecords, Header->Capacity,
+       (FileSize - sizeof(LogHeader)) / sizeof(Record)});
+  const Record *Records = reinterpret_cast<const Record *>(Header + 1);
+
+  std::vector<Op> Ops = resolve(Records, N);
+
+  std::vector<Worker> Workers;
+  for (unsigned I = 0; I < NumWorkers; I++)
+    Workers.emplace_back(I, NumWorkers);
+  std::vector<std::thread> Threads;
+  for (unsigned I = 1; I < NumWorkers; I++)
+    Threads.emplace_back([&, I] { Workers[I].run(Ops); });
+  Workers[0].run(Ops);
+  for (std::thread &T : Threads)
+    T.join();
+
+  // Report every site once, like the live runtime does.
+  std::vector<Report> Reports;
+  for (Worker &W : Workers)
+    Reports.insert(Reports.end(), W.Reports.begin(), W.Reports.end());
+  std::sort(Reports.begin(), Reports.end(),
+            [](const Report &A, const Report &B) { return A.Index < B.Index; });
+  std::map<std::pair<uint64_t, int>, bool> Seen;
+  unsigned NumReports = 0;
+  for (const Report &R : Reports) {
+    if (!Seen.emplace(std::make_pair(R.Pc, (int)R.Kind), true).second)
+      continue;
+    NumReports++;
+    printf("==================\n"
+           "WARNING: Arbalest: data inconsistency (%s) (pid=%" PRIu64
+           ") on the %s\n"
+           "  Read of size %" PRIu64 " at 0x%" PRIx64 " by thread T%u, "
+           "pc 0x%" PRIx64 "\n",
+           R.Kind == ReportKind::Stale ? "stale data access"
+                                       : "uninitialized access",
+           Header->Pid, R.OnTarget ? "target" : "host", R.Size, R.AccessAddr,
+           R.Tid, R.Pc);
+    if (R.OnTarget)
+      printf("  Corresponding host address: 0x%" PRIx64 "\n", R.HostAddr);
+    printf("==================\n");
+  }
+  printf("arbalest-replay: %" PRIu64 " records, %zu operations, %u warnings\n",
+         N, Ops.size(), NumReports);
+  munmap(Map, FileSize);
+  return NumReports ? 1 : 0;
+}
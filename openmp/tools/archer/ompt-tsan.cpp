@@ -69,6 +69,7 @@ public:
   int enabled{1};
   int report_data_leak{0};
   int ignore_serial{0};
+  int ignore_target{0};
 
   ArcherFlags(const char *env) {
     if (env) {
@@ -95,6 +96,8 @@ public:
           continue;
         if (sscanf(it->c_str(), "ignore_serial=%d", &ignore_serial))
           continue;
+        if (sscanf(it->c_str(), "ignore_target=%d", &ignore_target))
+          continue;
         std::cerr << "Illegal values for ARCHER_OPTIONS variable: " << token
                   << std::endl;
       }
@@ -182,6 +185,32 @@ void __attribute__((weak)) AnnotateIgnoreWritesEnd(const char *file, int line) {
 void __attribute__((weak))
 AnnotateNewMemory(const char *file, int line, const volatile void *cv,
                   size_t size) {}
+// Runtimes without the barrier annotations fall back to a plain
+// happens-before arc on the barrier address.
+void __attribute__((weak))
+AnnotateBarrierArrive(const char *file, int line, const volatile void *cv) {
+  AnnotateHappensBefore(file, line, cv);
+}
+void __attribute__((weak))
+AnnotateBarrierDepart(const char *file, int line, const volatile void *cv) {
+  AnnotateHappensAfter(file, line, cv);
+}
+unsigned __attribute__((weak)) AnnotateSyncCreate(const char *file, int line) {
+  assert(false && "Fail to invoke AnnotateSyncCreate in tsan");
+  return 0;
+}
+void __attribute__((weak))
+AnnotateSyncDestroy(const char *file, int line, unsigned handle) {
+  assert(false && "Fail to invoke AnnotateSyncDestroy in tsan");
+}
+void __attribute__((weak))
+AnnotateSyncRelease(const char *file, int line, unsigned handle) {
+  assert(false && "Fail to invoke AnnotateSyncRelease in tsan");
+}
+void __attribute__((weak))
+AnnotateSyncAcquire(const char *file, int line, unsigned handle) {
+  assert(false && "Fail to invoke AnnotateSyncAcquire in tsan");
+}
 void __attribute__((weak))
 AnnotateMapping(const void *host_addr, const void *target_addr, uintptr_t bytes,
                 uint8_t optype, const void *codeptr, const char *var_name) {
@@ -193,12 +222,19 @@ void __attribute__((weak)) AnnotateEnterTargetRegion() {
 void __attribute__((weak)) AnnotateExitTargetRegion() {
   assert(false && "Fail to invoke AnnotateExitTargetRegion in tsan");
 }
+void __attribute__((weak))
+AnnotateTargetMappingIndex(int device_num, void *index) {
+  assert(false && "Fail to invoke AnnotateTargetMappingIndex in tsan");
+}
 void __attribute__((weak)) AnnotatePrintf(const char *str) {
   assert(false && "Fail to invoke AnnotatePrintf in tsan");
 }
 void __attribute__((weak)) AnnotateArbalestVerboseMode(bool is_verbose) {
   assert(false && "Fail to invoke AnnotateArbalestVerboseMode in tsan");
 }
+void __attribute__((weak)) AnnotateArbalestIgnoreTarget(bool ignore) {
+  assert(false && "Fail to invoke AnnotateArbalestIgnoreTarget in tsan");
+}
 bool __attribute__((weak)) ArbalestEnabled() {
   assert(false && "Fail to invoke ArbalestEnabled in tsan");
   return false;
@@ -220,6 +256,20 @@ void __attribute__((weak)) __tsan_func_exit(void) {}
 // This marker defines the destination of a happens-before arc.
 #define TsanHappensAfter(cv) AnnotateHappensAfter(__FILE__, __LINE__, cv)
 
+// All threads arriving at a barrier happen before all threads departing it.
+// Unlike TsanHappensBefore/TsanHappensAfter the arrivals of one barrier do not
+// contend on a single clock.
+#define TsanBarrierArrive(cv) AnnotateBarrierArrive(__FILE__, __LINE__, cv)
+#define TsanBarrierDepart(cv) AnnotateBarrierDepart(__FILE__, __LINE__, cv)
+
+// Explicit sync objects of tsan. They are released and acquired like the
+// address of TsanHappensBefore/TsanHappensAfter, but are not looked up in the
+// meta shadow and live only between TsanSyncCreate and TsanSyncDestroy.
+#define TsanSyncCreate() AnnotateSyncCreate(__FILE__, __LINE__)
+#define TsanSyncDestroy(h) AnnotateSyncDestroy(__FILE__, __LINE__, h)
+#define TsanSyncRelease(h) AnnotateSyncRelease(__FILE__, __LINE__, h)
+#define TsanSyncAcquire(h) AnnotateSyncAcquire(__FILE__, __LINE__, h)
+
 // Ignore any races on writes between here and the next TsanIgnoreWritesEnd.
 #define TsanIgnoreWritesBegin() AnnotateIgnoreWritesBegin(__FILE__, __LINE__)
 
@@ -254,8 +304,16 @@ static ompt_get_parallel_info_t ompt_get_parallel_info;
 static ompt_get_thread_data_t ompt_get_thread_data;
 static ompt_get_task_info_t ompt_get_task_info;
 
+// Inquiry function of libomptarget, see ompt_target_mapping_index_t in
+// openmp/runtime/src/ompt-target-api.h. The index is opaque to Archer.
+typedef void *(*ompt_get_target_mapping_index_t)(int device_num);
+static ompt_get_target_mapping_index_t ompt_get_target_mapping_index;
+
 typedef char ompt_tsan_clockid;
 
+// Handle of a tsan sync object, see TsanSyncCreate.
+typedef unsigned ompt_tsan_sync;
+
 static uint64_t my_next_id() {
   static uint64_t ID = 0;
   uint64_t ret = __sync_fetch_and_add(&ID, 1);
@@ -266,18 +324,22 @@ static int pagesize{0};
 
 // Data structure to provide a threadsafe pool of reusable objects.
 // DataPool<Type of objects>
+// Objects returned by other threads are pushed onto a lock-free stack linked
+// through DataPoolEntry::RemoteNext. Only the owning thread pops, and it always
+// takes the whole stack at once, so the stack is not subject to ABA.
 template <typename T> struct DataPool final {
   static __thread DataPool<T> *ThreadDataPool;
-  std::mutex DPMutex{};
 
   // store unused objects
   std::vector<T *> DataPointer{};
-  std::vector<T *> RemoteDataPointer{};
+
+  // head of the stack of remotely returned objects
+  std::atomic<T *> RemoteHead{nullptr};
 
   // store all allocated memory to finally release
   std::list<void *> memory;
 
-  // count remotely returned data (RemoteDataPointer.size())
+  // count remotely returned data (length of the RemoteHead stack)
   std::atomic<int> remote{0};
 
   // totally allocated data objects in pool
@@ -290,18 +352,21 @@ template <typename T> struct DataPool final {
   int getLocal() { return localReturn; }
 #endif
   int getTotal() { return total; }
-  int getMissing() {
-    return total - DataPointer.size() - RemoteDataPointer.size();
-  }
+  int getMissing() { return total - DataPointer.size() - remote; }
 
   // fill the pool by allocating a page of memory
   void newDatas() {
     if (remote > 0) {
-      const std::lock_guard<std::mutex> lock(DPMutex);
-      // DataPointer is empty, so just swap the vectors
-      DataPointer.swap(RemoteDataPointer);
-      remote = 0;
-      return;
+      // DataPointer is empty, so just take over the remote stack
+      T *data = RemoteHead.exchange(nullptr, std::memory_order_acquire);
+      int taken = 0;
+      for (; data; data = data->RemoteNext, taken++)
+        DataPointer.push_back(data);
+      remote -= taken;
+      // A returning thread increments remote only after its push, so the
+      // stack may already be empty here.
+      if (taken > 0)
+        return;
     }
     // calculate size of an object including padding to cacheline size
     size_t elemSize = sizeof(T);
@@ -334,10 +399,14 @@ template <typename T> struct DataPool final {
 #endif
   }
 
-  // returning to a remote datapool using lock
+  // returning to a remote datapool by pushing onto its remote stack
   void returnData(T *data) {
-    const std::lock_guard<std::mutex> lock(DPMutex);
-    RemoteDataPointer.emplace_back(data);
+    T *head = RemoteHead.load(std::memory_order_relaxed);
+    do {
+      data->RemoteNext = head;
+    } while (!RemoteHead.compare_exchange_weak(head, data,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed));
     remote++;
 #ifdef DEBUG_DATA
     remoteReturn++;
@@ -356,9 +425,11 @@ template <typename T> struct DataPool final {
     for (auto i : DataPointer)
       if (i)
         i->~T();
-    for (auto i : RemoteDataPointer)
-      if (i)
-        i->~T();
+    for (T *i = RemoteHead.load(); i;) {
+      T *next = i->RemoteNext;
+      i->~T();
+      i = next;
+    }
     for (auto i : memory)
       if (i)
         free(i);
@@ -368,6 +439,9 @@ template <typename T> struct DataPool final {
 template <typename T> struct DataPoolEntry {
   DataPool<T> *owner;
 
+  // link in the owner's stack of remotely returned objects
+  T *RemoteNext{nullptr};
+
   static T *New() { return DataPool<T>::ThreadDataPool->getData(); }
 
   void Delete() {
@@ -388,55 +462,189 @@ __thread DependencyDataPool *DependencyDataPool::ThreadDataPool = nullptr;
 
 /// Data structure to store additional information for task dependency.
 struct DependencyData final : DataPoolEntry<DependencyData> {
-  ompt_tsan_clockid in;
-  ompt_tsan_clockid out;
-  ompt_tsan_clockid inoutset;
-  void *GetInPtr() { return &in; }
-  void *GetOutPtr() { return &out; }
-  void *GetInoutsetPtr() { return &inoutset; }
+  ompt_tsan_sync in;
+  ompt_tsan_sync out;
+  ompt_tsan_sync inoutset;
+
+  DependencyData *Init() {
+    in = TsanSyncCreate();
+    out = TsanSyncCreate();
+    inoutset = TsanSyncCreate();
+    return this;
+  }
 
-  void Reset() {}
+  void Reset() {
+    TsanSyncDestroy(in);
+    TsanSyncDestroy(out);
+    TsanSyncDestroy(inoutset);
+  }
 
-  static DependencyData *New() { return DataPoolEntry<DependencyData>::New(); }
+  static DependencyData *New() {
+    return DataPoolEntry<DependencyData>::New()->Init();
+  }
 
   DependencyData(DataPool<DependencyData> *dp)
       : DataPoolEntry<DependencyData>(dp) {}
 };
 
 struct TaskDependency {
-  void *inPtr;
-  void *outPtr;
-  void *inoutsetPtr;
+  ompt_tsan_sync in;
+  ompt_tsan_sync out;
+  ompt_tsan_sync inoutset;
   ompt_dependence_type_t type;
+  TaskDependency() = default;
   TaskDependency(DependencyData *depData, ompt_dependence_type_t type)
-      : inPtr(depData->GetInPtr()), outPtr(depData->GetOutPtr()),
-        inoutsetPtr(depData->GetInoutsetPtr()), type(type) {}
+      : in(depData->in), out(depData->out), inoutset(depData->inoutset),
+        type(type) {}
   void AnnotateBegin() {
     if (type == ompt_dependence_type_out ||
         type == ompt_dependence_type_inout ||
         type == ompt_dependence_type_mutexinoutset) {
-      TsanHappensAfter(inPtr);
-      TsanHappensAfter(outPtr);
-      TsanHappensAfter(inoutsetPtr);
+      TsanSyncAcquire(in);
+      TsanSyncAcquire(out);
+      TsanSyncAcquire(inoutset);
     } else if (type == ompt_dependence_type_in) {
-      TsanHappensAfter(outPtr);
-      TsanHappensAfter(inoutsetPtr);
+      TsanSyncAcquire(out);
+      TsanSyncAcquire(inoutset);
     } else if (type == ompt_dependence_type_inoutset) {
-      TsanHappensAfter(inPtr);
-      TsanHappensAfter(outPtr);
+      TsanSyncAcquire(in);
+      TsanSyncAcquire(out);
     }
   }
   void AnnotateEnd() {
     if (type == ompt_dependence_type_out ||
         type == ompt_dependence_type_inout ||
         type == ompt_dependence_type_mutexinoutset) {
-      TsanHappensBefore(outPtr);
+      TsanSyncRelease(out);
     } else if (type == ompt_dependence_type_in) {
-      TsanHappensBefore(inPtr);
+      TsanSyncRelease(in);
     } else if (type == ompt_dependence_type_inoutset) {
-      TsanHappensBefore(inoutsetPtr);
+      TsanSyncRelease(inoutset);
+    }
+  }
+};
+
+struct TaskDependencyBlock;
+typedef DataPool<TaskDependencyBlock> TaskDependencyBlockPool;
+template <>
+__thread TaskDependencyBlockPool *TaskDependencyBlockPool::ThreadDataPool =
+    nullptr;
+
+/// Pooled storage for the dependencies of a task. Tasks with more
+/// dependencies than fit into one block chain further blocks.
+struct TaskDependencyBlock final : DataPoolEntry<TaskDependencyBlock> {
+  static constexpr unsigned Capacity = 16;
+
+  TaskDependency Deps[Capacity];
+  unsigned Count{0};
+  TaskDependencyBlock *Next{nullptr};
+
+  bool isFull() { return Count == Capacity; }
+
+  void push(const TaskDependency &Dep) { Deps[Count++] = Dep; }
+
+  void Reset() {
+    Count = 0;
+    if (Next)
+      Next->Delete();
+    Next = nullptr;
+  }
+
+  static TaskDependencyBlock *New() {
+    return DataPoolEntry<TaskDependencyBlock>::New();
+  }
+
+  TaskDependencyBlock(DataPool<TaskDependencyBlock> *dp)
+      : DataPoolEntry<TaskDependencyBlock>(dp) {}
+};
+
+struct DependencyTable;
+typedef DataPool<DependencyTable> DependencyTablePool;
+template <>
+__thread DependencyTablePool *DependencyTablePool::ThreadDataPool = nullptr;
+
+/// Pooled open-addressing table mapping dependency variables to their
+/// DependencyData. Small tables live in the pooled entry; once the load limit
+/// is reached, the slots move to a heap array of twice the size and are
+/// rehashed. Entries are never removed individually.
+struct DependencyTable final : DataPoolEntry<DependencyTable> {
+  static constexpr unsigned NumInlineSlots = 32;
+
+  struct Slot {
+    void *Variable;
+    DependencyData *Data;
+  };
+
+  Slot InlineSlots[NumInlineSlots]{};
+  Slot *Slots{InlineSlots};
+  unsigned NumSlots{NumInlineSlots}; // always a power of two
+  unsigned Used{0};
+
+  static unsigned hash(void *Variable) {
+    uint64_t Hash =
+        reinterpret_cast<uintptr_t>(Variable) * 0x9E3779B97F4A7C15ull;
+    return Hash >> 32;
+  }
+
+  /// Return the slot holding \p Variable, or the empty slot where it would be
+  /// inserted.
+  Slot &lookup(void *Variable) {
+    unsigned Mask = NumSlots - 1;
+    unsigned Idx = hash(Variable) & Mask;
+    while (Slots[Idx].Variable && Slots[Idx].Variable != Variable)
+      Idx = (Idx + 1) & Mask;
+    return Slots[Idx];
+  }
+
+  void grow() {
+    Slot *Old = Slots;
+    unsigned OldNum = NumSlots;
+    NumSlots *= 2;
+    Slots = new Slot[NumSlots]{};
+    for (unsigned I = 0; I < OldNum; I++) {
+      if (Old[I].Variable)
+        lookup(Old[I].Variable) = Old[I];
+    }
+    if (Old != InlineSlots)
+      delete[] Old;
+  }
+
+  /// Return the DependencyData for \p Variable, creating it on first use.
+  DependencyData *getOrCreate(void *Variable) {
+    Slot *S = &lookup(Variable);
+    if (S->Variable)
+      return S->Data;
+    if ((Used + 1) * 4 > NumSlots * 3) {
+      grow();
+      S = &lookup(Variable);
+    }
+    S->Variable = Variable;
+    S->Data = DependencyData::New();
+    Used++;
+    return S->Data;
+  }
+
+  void Reset() {
+    for (unsigned I = 0; I < NumSlots; I++) {
+      if (Slots[I].Variable)
+        Slots[I].Data->Delete();
     }
+    // Pooled entries go back to the inline slots, a large table is rare.
+    if (Slots != InlineSlots)
+      delete[] Slots;
+    for (Slot &S : InlineSlots)
+      S = Slot{};
+    Slots = InlineSlots;
+    NumSlots = NumInlineSlots;
+    Used = 0;
   }
+
+  static DependencyTable *New() {
+    return DataPoolEntry<DependencyTable>::New();
+  }
+
+  DependencyTable(DataPool<DependencyTable> *dp)
+      : DataPoolEntry<DependencyTable>(dp) {}
 };
 
 struct ParallelData;
@@ -484,20 +692,19 @@ template <> __thread TaskgroupPool *TaskgroupPool::ThreadDataPool = nullptr;
 
 /// Data structure to support stacking of taskgroups and allow synchronization.
 struct Taskgroup final : DataPoolEntry<Taskgroup> {
-  /// Its address is used for relationships of the taskgroup's task set.
-  ompt_tsan_clockid Ptr;
+  /// Used for relationships of the taskgroup's task set.
+  ompt_tsan_sync Sync;
 
   /// Reference to the parent taskgroup.
   Taskgroup *Parent;
 
-  void *GetPtr() { return &Ptr; }
-
   Taskgroup *Init(Taskgroup *parent) {
+    Sync = TsanSyncCreate();
     Parent = parent;
     return this;
   }
 
-  void Reset() {}
+  void Reset() { TsanSyncDestroy(Sync); }
 
   static Taskgroup *New(Taskgroup *Parent) {
     return DataPoolEntry<Taskgroup>::New()->Init(Parent);
@@ -513,12 +720,11 @@ template <> __thread TaskDataPool *TaskDataPool::ThreadDataPool = nullptr;
 
 /// Data structure to store additional information for tasks.
 struct TaskData final : DataPoolEntry<TaskData> {
-  /// Its address is used for relationships of this task.
-  ompt_tsan_clockid Task{0};
+  /// Used for relationships of this task.
+  ompt_tsan_sync Task{0};
 
-  /// Child tasks use its address to declare a relationship to a taskwait in
-  /// this task.
-  ompt_tsan_clockid Taskwait{0};
+  /// Child tasks use it to declare a relationship to a taskwait in this task.
+  ompt_tsan_sync Taskwait{0};
 
   /// Whether this task is currently executing a barrier.
   bool InBarrier{false};
@@ -551,16 +757,14 @@ struct TaskData final : DataPoolEntry<TaskData> {
   Taskgroup *TaskGroup{nullptr};
 
   /// Dependency information for this task.
-  TaskDependency *Dependencies{nullptr};
-
-  /// Number of dependency entries.
-  unsigned DependencyCount{0};
+  TaskDependencyBlock *Dependencies{nullptr};
 
   // The dependency-map stores DependencyData objects representing
   // the dependency variables used on the sibling tasks created from
   // this task
-  // We expect a rare need for the dependency-map, so alloc on demand
-  std::unordered_map<void *, DependencyData *> *DependencyMap{nullptr};
+  // We expect a rare need for the dependency-map, so take it from the pool on
+  // demand
+  DependencyTable *DependencyMap{nullptr};
 
 #ifdef DEBUG
   int freed{0};
@@ -577,11 +781,13 @@ struct TaskData final : DataPoolEntry<TaskData> {
   bool isInitial() { return TaskType & ompt_task_initial; }
   bool isTarget() { return TaskType & ompt_task_target; }
 
-  void *GetTaskPtr() { return &Task; }
-
-  void *GetTaskwaitPtr() { return &Taskwait; }
+  void CreateSyncs() {
+    Task = TsanSyncCreate();
+    Taskwait = TsanSyncCreate();
+  }
 
   TaskData *Init(TaskData *parent, int taskType) {
+    CreateSyncs();
     TaskType = taskType;
     Parent = parent;
     Team = Parent->Team;
@@ -596,6 +802,7 @@ struct TaskData final : DataPoolEntry<TaskData> {
   }
 
   TaskData *Init(ParallelData *team, int taskType) {
+    CreateSyncs();
     TaskType = taskType;
     execution = 1;
     ImplicitTask = this;
@@ -607,6 +814,9 @@ struct TaskData final : DataPoolEntry<TaskData> {
   }
 
   void Reset() {
+    TsanSyncDestroy(Task);
+    TsanSyncDestroy(Taskwait);
+    Task = Taskwait = 0;
     InBarrier = false;
     TaskType = 0;
     execution = 0;
@@ -616,16 +826,12 @@ struct TaskData final : DataPoolEntry<TaskData> {
     ImplicitTask = nullptr;
     Team = nullptr;
     TaskGroup = nullptr;
-    if (DependencyMap) {
-      for (auto i : *DependencyMap)
-        i.second->Delete();
-      delete DependencyMap;
-    }
+    if (DependencyMap)
+      DependencyMap->Delete();
     DependencyMap = nullptr;
     if (Dependencies)
-      free(Dependencies);
+      Dependencies->Delete();
     Dependencies = nullptr;
-    DependencyCount = 0;
 #ifdef DEBUG
     freed = 0;
 #endif
@@ -647,8 +853,31 @@ static inline TaskData *ToTaskData(ompt_data_t *task_data) {
 }
 
 /// Store a mutex for each wait_id to resolve race condition with callbacks.
-std::unordered_map<ompt_wait_id_t, std::mutex> Locks;
-std::mutex LocksMutex;
+/// The map is split into shards by wait_id, so that threads operating on
+/// unrelated locks do not serialize on a single bookkeeping mutex. Elements of
+/// an unordered_map keep their address on rehash, so a returned mutex stays
+/// valid while other wait_ids are added to its shard.
+struct LockMap final {
+  static constexpr size_t NumShards = 64;
+
+  struct alignas(64) Shard {
+    std::mutex ShardMutex;
+    std::unordered_map<ompt_wait_id_t, std::mutex> Locks;
+  };
+
+  Shard Shards[NumShards];
+
+  std::mutex &get(ompt_wait_id_t wait_id) {
+    // wait_ids are usually addresses of lock objects; mix the bits so that
+    // neighboring locks end up in different shards.
+    uint64_t Hash = wait_id * 0x9E3779B97F4A7C15ull;
+    Shard &S = Shards[(Hash >> 32) % NumShards];
+    const std::lock_guard<std::mutex> lock(S.ShardMutex);
+    return S.Locks[wait_id];
+  }
+};
+
+static LockMap Locks;
 
 static void ompt_tsan_thread_begin(ompt_thread_t thread_type,
                                    ompt_data_t *thread_data) {
@@ -664,6 +893,12 @@ static void ompt_tsan_thread_begin(ompt_thread_t thread_type,
   DependencyDataPool::ThreadDataPool = new DependencyDataPool;
   TsanNewMemory(DependencyDataPool::ThreadDataPool,
                 sizeof(DependencyDataPool::ThreadDataPool));
+  DependencyTablePool::ThreadDataPool = new DependencyTablePool;
+  TsanNewMemory(DependencyTablePool::ThreadDataPool,
+                sizeof(DependencyTablePool::ThreadDataPool));
+  TaskDependencyBlockPool::ThreadDataPool = new TaskDependencyBlockPool;
+  TsanNewMemory(TaskDependencyBlockPool::ThreadDataPool,
+                sizeof(TaskDependencyBlockPool::ThreadDataPool));
   thread_data->value = my_next_id();
 }
 
@@ -673,6 +908,8 @@ static void ompt_tsan_thread_end(ompt_data_t *thread_data) {
   delete TaskgroupPool::ThreadDataPool;
   delete TaskDataPool::ThreadDataPool;
   delete DependencyDataPool::ThreadDataPool;
+  delete DependencyTablePool::ThreadDataPool;
+  delete TaskDependencyBlockPool::ThreadDataPool;
   TsanIgnoreWritesEnd();
 }
 
@@ -725,8 +962,8 @@ static void ompt_tsan_parallel_end(ompt_data_t *parallel_data,
   if (archer_flags->ignore_serial && ToTaskData(task_data)->isInitial())
     TsanIgnoreWritesBegin();
   ParallelData *Data = ToParallelData(parallel_data);
-  TsanHappensAfter(Data->GetBarrierPtr(0));
-  TsanHappensAfter(Data->GetBarrierPtr(1));
+  TsanBarrierDepart(Data->GetBarrierPtr(0));
+  TsanBarrierDepart(Data->GetBarrierPtr(1));
   
   const char *Par;
   if (flag & ompt_parallel_league) {
@@ -846,7 +1083,7 @@ static void ompt_tsan_sync_region(ompt_sync_region_t kind,
     case ompt_sync_region_barrier_teams:
     case ompt_sync_region_barrier: {
       char BarrierIndex = Data->BarrierIndex;
-      TsanHappensBefore(Data->Team->GetBarrierPtr(BarrierIndex));
+      TsanBarrierArrive(Data->Team->GetBarrierPtr(BarrierIndex));
 
       if (hasReductionCallback < ompt_set_always) {
         // We ignore writes inside the barrier. These would either occur during
@@ -894,7 +1131,7 @@ static void ompt_tsan_sync_region(ompt_sync_region_t kind,
       char BarrierIndex = Data->BarrierIndex;
       // Barrier will end after it has been entered by all threads.
       if (parallel_data)
-        TsanHappensAfter(Data->Team->GetBarrierPtr(BarrierIndex));
+        TsanBarrierDepart(Data->Team->GetBarrierPtr(BarrierIndex));
 
       // It is not guaranteed that all threads have exited this barrier before
       // we enter the next one. So we will use a different address.
@@ -907,7 +1144,7 @@ static void ompt_tsan_sync_region(ompt_sync_region_t kind,
 
     case ompt_sync_region_taskwait: {
       if (Data->execution > 1)
-        TsanHappensAfter(Data->GetTaskwaitPtr());
+        TsanSyncAcquire(Data->Taskwait);
       break;
     }
 
@@ -915,7 +1152,7 @@ static void ompt_tsan_sync_region(ompt_sync_region_t kind,
       assert(Data->TaskGroup != nullptr &&
              "Should have at least one taskgroup!");
 
-      TsanHappensAfter(Data->TaskGroup->GetPtr());
+      TsanSyncAcquire(Data->TaskGroup->Sync);
 
       // Delete this allocated taskgroup, all descendent task are finished by
       // now.
@@ -997,7 +1234,7 @@ static void ompt_tsan_task_create(
     // Use the newly created address. We cannot use a single address from the
     // parent because that would declare wrong relationships with other
     // sibling tasks that may be created before this task is started!
-    TsanHappensBefore(Data->GetTaskPtr());
+    TsanSyncRelease(Data->Task);
     ToTaskData(parent_task_data)->execution++;
   }
 }
@@ -1011,14 +1248,16 @@ static void freeTask(TaskData *task) {
 }
 
 static void releaseDependencies(TaskData *task) {
-  for (unsigned i = 0; i < task->DependencyCount; i++) {
-    task->Dependencies[i].AnnotateEnd();
+  for (TaskDependencyBlock *B = task->Dependencies; B; B = B->Next) {
+    for (unsigned i = 0; i < B->Count; i++)
+      B->Deps[i].AnnotateEnd();
   }
 }
 
 static void acquireDependencies(TaskData *task) {
-  for (unsigned i = 0; i < task->DependencyCount; i++) {
-    task->Dependencies[i].AnnotateBegin();
+  for (TaskDependencyBlock *B = task->Dependencies; B; B = B->Next) {
+    for (unsigned i = 0; i < B->Count; i++)
+      B->Deps[i].AnnotateBegin();
   }
 }
 
@@ -1059,7 +1298,7 @@ static void ompt_tsan_task_schedule(ompt_data_t *first_task_data,
 
   // The late fulfill happens after the detached task finished execution
   if (prior_task_status == ompt_task_late_fulfill)
-    TsanHappensAfter(FromTask->GetTaskPtr());
+    TsanSyncAcquire(FromTask->Task);
 
   // task completed execution
   if (prior_task_status == ompt_task_complete ||
@@ -1071,16 +1310,16 @@ static void ompt_tsan_task_schedule(ompt_data_t *first_task_data,
       // Task will finish before a barrier in the surrounding parallel region
       // ...
       ParallelData *PData = FromTask->Team;
-      TsanHappensBefore(
+      TsanBarrierArrive(
           PData->GetBarrierPtr(FromTask->ImplicitTask->BarrierIndex));
 
       // ... and before an eventual taskwait by the parent thread.
-      TsanHappensBefore(FromTask->Parent->GetTaskwaitPtr());
+      TsanSyncRelease(FromTask->Parent->Taskwait);
 
       if (FromTask->TaskGroup != nullptr) {
         // This task is part of a taskgroup, so it will finish before the
         // corresponding taskgroup_end.
-        TsanHappensBefore(FromTask->TaskGroup->GetPtr());
+        TsanSyncRelease(FromTask->TaskGroup->Sync);
       }
     }
 
@@ -1107,7 +1346,7 @@ static void ompt_tsan_task_schedule(ompt_data_t *first_task_data,
       prior_task_status == ompt_task_yield ||
       prior_task_status == ompt_task_detach) {
     // Task may be resumed at a later point in time.
-    TsanHappensBefore(FromTask->GetTaskPtr());
+    TsanSyncRelease(FromTask->Task);
     ToTask->ImplicitTask = FromTask->ImplicitTask;
     assert(ToTask->ImplicitTask != NULL &&
            "A task belongs to a team and has an implicit task on the stack");
@@ -1120,7 +1359,7 @@ static void ompt_tsan_task_schedule(ompt_data_t *first_task_data,
   }
   // 1. Task will begin execution after it has been created.
   // 2. Task will resume after it has been switched away.
-  TsanHappensAfter(ToTask->GetTaskPtr());
+  TsanSyncAcquire(ToTask->Task);
 
   // Update isOnTarget in tsan
   if(ToTask->IsOnTarget){
@@ -1140,23 +1379,24 @@ static void ompt_tsan_dependences(ompt_data_t *task_data,
       return;
     }
     if (!Data->Parent->DependencyMap)
-      Data->Parent->DependencyMap =
-          new std::unordered_map<void *, DependencyData *>();
-    Data->Dependencies =
-        (TaskDependency *)malloc(sizeof(TaskDependency) * ndeps);
-    Data->DependencyCount = ndeps;
+      Data->Parent->DependencyMap = DependencyTable::New();
+    TaskDependencyBlock *Block = nullptr;
     for (int i = 0; i < ndeps; i++) {
-      auto ret = Data->Parent->DependencyMap->insert(
-          std::make_pair(deps[i].variable.ptr, nullptr));
-      if (ret.second) {
-        ret.first->second = DependencyData::New();
+      if (!Block || Block->isFull()) {
+        TaskDependencyBlock *NewBlock = TaskDependencyBlock::New();
+        if (Block)
+          Block->Next = NewBlock;
+        else
+          Data->Dependencies = NewBlock;
+        Block = NewBlock;
       }
-      new ((void *)(Data->Dependencies + i))
-          TaskDependency(ret.first->second, deps[i].dependence_type);
+      DependencyData *DepData =
+          Data->Parent->DependencyMap->getOrCreate(deps[i].variable.ptr);
+      Block->push(TaskDependency(DepData, deps[i].dependence_type));
     }
 
     // This callback is executed before this task is first started.
-    TsanHappensBefore(Data->GetTaskPtr());
+    TsanSyncRelease(Data->Task);
   }
 }
 
@@ -1167,9 +1407,7 @@ static void ompt_tsan_mutex_acquired(ompt_mutex_t kind, ompt_wait_id_t wait_id,
   // Acquire our own lock to make sure that
   // 1. the previous release has finished.
   // 2. the next acquire doesn't start before we have finished our release.
-  LocksMutex.lock();
-  std::mutex &Lock = Locks[wait_id];
-  LocksMutex.unlock();
+  std::mutex &Lock = Locks.get(wait_id);
 
   Lock.lock();
   TsanHappensAfter(&Lock);
@@ -1177,9 +1415,7 @@ static void ompt_tsan_mutex_acquired(ompt_mutex_t kind, ompt_wait_id_t wait_id,
 
 static void ompt_tsan_mutex_released(ompt_mutex_t kind, ompt_wait_id_t wait_id,
                                      const void *codeptr_ra) {
-  LocksMutex.lock();
-  std::mutex &Lock = Locks[wait_id];
-  LocksMutex.unlock();
+  std::mutex &Lock = Locks.get(wait_id);
   TsanHappensBefore(&Lock);
 
   Lock.unlock();
@@ -1188,6 +1424,34 @@ static void ompt_tsan_mutex_released(ompt_mutex_t kind, ompt_wait_id_t wait_id,
 static const char *device_mem_flag_str[] = {"to",      "from",      "alloc",
                                "release", "associate", "disassociate"};
 
+// Hands the mapping index of a device to tsan the first time the device shows
+// up, so tsan translates device addresses with libomptarget's own table.
+static void AttachTargetMappingIndex(int device_num) {
+  // Called on every device_mem and target begin, devices below
+  // AttachedFastSize are checked without the lock once attached.
+  static constexpr int AttachedFastSize = 64;
+  static std::atomic<bool> AttachedFast[AttachedFastSize];
+  static std::mutex Mtx;
+  static std::vector<bool> Attached;
+  if (!ompt_get_target_mapping_index || device_num < 0)
+    return;
+  if (device_num < AttachedFastSize &&
+      AttachedFast[device_num].load(std::memory_order_acquire))
+    return;
+  std::lock_guard<std::mutex> Lock(Mtx);
+  if ((size_t)device_num < Attached.size() && Attached[device_num])
+    return;
+  void *index = ompt_get_target_mapping_index(device_num);
+  if (!index)
+    return;
+  if ((size_t)device_num >= Attached.size())
+    Attached.resize(device_num + 1);
+  Attached[device_num] = true;
+  AnnotateTargetMappingIndex(device_num, index);
+  if (device_num < AttachedFastSize)
+    AttachedFast[device_num].store(true, std::memory_order_release);
+}
+
 static void ompt_tsan_device_mem(ompt_data_t *target_task_data,
                                 ompt_data_t *target_data,
                                 unsigned int device_mem_flag,
@@ -1214,6 +1478,7 @@ static void ompt_tsan_device_mem(ompt_data_t *target_task_data,
             (var_name ? var_name : "unknown"), 
             host_addr, target_addr, bytes, device_mem_flag, buf);
   }
+  AttachTargetMappingIndex(target_device_num);
   AnnotateMapping(host_addr, target_addr, bytes, device_mem_flag, codeptr_ra, var_name);
 }
 
@@ -1238,6 +1503,7 @@ static void ompt_tsan_target(ompt_target_t kind, ompt_scope_endpoint_t endpoint,
   switch (endpoint) {
   case ompt_scope_begin:
     Task->IsOnTarget = true;
+    AttachTargetMappingIndex(device_num);
     TsanFuncEntry(codeptr_ra);
     VPrintf("%s %lu begin, encounter task %p\n", target_kind_str[kind],
             target_id, task_data->ptr);
@@ -1340,6 +1606,10 @@ static int ompt_tsan_initialize(ompt_function_lookup_t lookup, int device_num,
   SET_CALLBACK(dependences);
 
   if (ArbalestEnabled()) {
+    // NULL if libomp does not know about the mapping index, tsan keeps its own
+    // copy of the mappings then.
+    ompt_get_target_mapping_index = (ompt_get_target_mapping_index_t)lookup(
+        "ompt_get_target_mapping_index");
     SET_CALLBACK(device_mem);
     SET_CALLBACK(target);
   }
@@ -1361,6 +1631,10 @@ static int ompt_tsan_initialize(ompt_function_lookup_t lookup, int device_num,
   
   if (ArbalestEnabled()) {
     AnnotateArbalestVerboseMode(archer_flags->verbose);
+    // Target regions keep their mapping checks, but their accesses are not
+    // tracked for races, see arbalest_ignore_target of TSAN_OPTIONS.
+    if (archer_flags->ignore_target)
+      AnnotateArbalestIgnoreTarget(true);
     fprintf(stderr, "\n\n*****************************"      \
                     "\nArbalest successfully starts"         \
                     "\n*****************************\n\n");
@@ -0,0 +1,72 @@
+/*
+ * lock-contention.c -- Archer testcase
+ */
+
+//===----------------------------------------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+//
+// See tools/archer/LICENSE.txt for details.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+
+// RUN: %libarcher-compile-and-run | FileCheck %s
+// REQUIRES: tsan
+
+// Every thread hammers its own lock and a few named critical sections, so
+// Archer's per-lock bookkeeping is the only shared state. The elapsed time is
+// printed to compare contention in the tool across changes.
+
+#include <omp.h>
+#include <stdio.h>
+
+#define NUM_THREADS 8
+#define ITERATIONS 20000
+
+int main(int argc, char *argv[]) {
+  omp_lock_t locks[NUM_THREADS];
+  int vars[NUM_THREADS] = {0};
+  int crit_a = 0, crit_b = 0;
+
+  for (int i = 0; i < NUM_THREADS; i++)
+    omp_init_lock(&locks[i]);
+
+  double start = omp_get_wtime();
+#pragma omp parallel num_threads(NUM_THREADS) shared(vars, locks)
+  {
+    int tid = omp_get_thread_num();
+    for (int i = 0; i < ITERATIONS; i++) {
+      omp_set_lock(&locks[tid]);
+      vars[tid]++;
+      omp_unset_lock(&locks[tid]);
+      if (i % 64 == 0) {
+        if (tid % 2) {
+#pragma omp critical(a)
+          crit_a++;
+        } else {
+#pragma omp critical(b)
+          crit_b++;
+        }
+      }
+    }
+  }
+  double elapsed = omp_get_wtime() - start;
+
+  for (int i = 0; i < NUM_THREADS; i++)
+    omp_destroy_lock(&locks[i]);
+
+  int error = 0;
+  for (int i = 0; i < NUM_THREADS; i++)
+    error |= (vars[i] != ITERATIONS);
+
+  fprintf(stderr, "lock/critical operations: %d, time: %lfs\n",
+          NUM_THREADS * ITERATIONS, elapsed);
+  fprintf(stderr, "DONE\n");
+  return error;
+}
+
+// CHECK-NOT: ThreadSanitizer: data race
+// CHECK-NOT: ThreadSanitizer: reported
+// CHECK: DONE
@@ -0,0 +1,52 @@
+/*
+ * task-dependency-many.c -- Archer testcase
+ */
+
+//===----------------------------------------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+//
+// See tools/archer/LICENSE.txt for details.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+
+// RUN: %libarcher-compile-and-run | FileCheck %s
+// REQUIRES: tsan
+
+// Uses more dependency variables and more dependencies per task than fit into
+// a single pooled dependency table and dependency block.
+
+#include <omp.h>
+#include <stdio.h>
+
+#define NVARS 64
+
+int main(int argc, char *argv[]) {
+  int v[NVARS] = {0};
+  int sum = 0;
+
+#pragma omp parallel num_threads(2) shared(v, sum)
+#pragma omp master
+  {
+    for (int i = 0; i < NVARS; i++) {
+#pragma omp task shared(v) firstprivate(i) depend(out : v[i])
+      v[i] = i;
+    }
+
+#pragma omp task shared(v, sum) depend(iterator(it = 0 : NVARS), in : v[it])
+    {
+      for (int i = 0; i < NVARS; i++)
+        sum += v[i];
+    }
+  }
+
+  fprintf(stderr, "DONE\n");
+  int error = (sum != NVARS * (NVARS - 1) / 2);
+  return error;
+}
+
+// CHECK-NOT: ThreadSanitizer: data race
+// CHECK-NOT: ThreadSanitizer: reported
+// CHECK: DONE
@@ -0,0 +1,58 @@
+/*
+ * task-remote-return.c -- Archer testcase
+ */
+
+//===----------------------------------------------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+//
+// See tools/archer/LICENSE.txt for details.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+
+// RUN: %libarcher-compile-and-run | FileCheck %s
+// REQUIRES: tsan
+
+// A single thread creates many tiny tasks that are mostly completed by the
+// other threads of the team, so Archer's task data is typically returned to
+// a remote pool. The elapsed time is printed to compare pool overhead across
+// changes.
+
+#include <omp.h>
+#include <stdio.h>
+
+#define NUM_TASKS 100000
+
+int main(int argc, char *argv[]) {
+  int counts[8] = {0};
+
+  double start = omp_get_wtime();
+#pragma omp parallel num_threads(8) shared(counts)
+#pragma omp single
+  {
+    for (int i = 0; i < NUM_TASKS; i++) {
+#pragma omp task shared(counts)
+      {
+        int tid = omp_get_thread_num();
+#pragma omp atomic
+        counts[tid]++;
+      }
+    }
+  }
+  double elapsed = omp_get_wtime() - start;
+
+  int total = 0;
+  for (int i = 0; i < 8; i++)
+    total += counts[i];
+
+  fprintf(stderr, "tasks: %d, time: %lfs\n", NUM_TASKS, elapsed);
+  fprintf(stderr, "DONE\n");
+  int error = (total != NUM_TASKS);
+  return error;
+}
+
+// CHECK-NOT: ThreadSanitizer: data race
+// CHECK-NOT: ThreadSanitizer: reported
+// CHECK: DONE